@@ -22,13 +22,23 @@ int test_eigen();
 int test_save_ppm();
 int test_json(nlohmann::json& j);
     
-int main()
+int main(int argc, char* argv[])
 {
-    std::ifstream t("/home/abhay/Documents/Projects/COMP371_all/COMP371_RaytracerBase/code/assets/test_scene3B.json");
+    //Usage : ./raytracer <filename.json> [threads]
+    std::string sceneFile = "/home/abhay/Documents/Projects/COMP371_all/COMP371_RaytracerBase/code/assets/test_scene3B.json";
+    if(argc > 1) sceneFile = argv[1];
+#ifdef STUDENT_SOLUTION
+    //The geometry is streamed into the compiled scene, only the lights and outputs are kept as json
+    SceneLoader loader;
+    loader.load(sceneFile);
+    cout<<"Parsed successfully"<<endl;
+#else
+    std::ifstream t(sceneFile);
     std::stringstream buffer;
     buffer << t.rdbuf();
     nlohmann::json j = nlohmann::json::parse(buffer.str());
     cout<<"Parsed successfully"<<endl;
+#endif
 
 #ifdef COURSE_SOLUTION
         srand(234);
@@ -46,7 +56,10 @@ int main()
         cout<<"Running student solution"<<endl;
         time_t tstart, tend;
         tstart = time(nullptr);
-        RayTracer rt(j);
+        //Optional number of worker threads, overrides the threads value of the outputs
+        uint threads = 0;
+        if(argc > 2) threads = (uint)std::stoul(argv[2]);
+        RayTracer rt(loader, threads);
         rt.run();
         tend = time(nullptr);
         cout << "It took "<< difftime(tend, tstart) <<" second(s)."<< endl;
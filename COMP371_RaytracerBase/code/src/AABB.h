@@ -0,0 +1,64 @@
+#pragma once
+#include <algorithm>
+#include <limits>
+#include "Eigen/Core"
+#include "CacheStream.h"
+
+//Axis aligned bounding box
+struct AABB{
+    Eigen::Vector3f min{std::numeric_limits<float>::infinity(), std::numeric_limits<float>::infinity(), std::numeric_limits<float>::infinity()};
+    Eigen::Vector3f max{-std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity()};
+    AABB() = default;
+    AABB(const Eigen::Vector3f& min, const Eigen::Vector3f& max): min(min), max(max){}
+    void expand(const Eigen::Vector3f& point){
+        min = min.cwiseMin(point);
+        max = max.cwiseMax(point);
+    }
+    void expand(const AABB& box){
+        min = min.cwiseMin(box.min);
+        max = max.cwiseMax(box.max);
+    }
+    //Gives flat boxes (rectangles aligned with an axis) a small thickness so that rays
+    //travelling inside their plane do not produce NaNs in the slab test
+    void pad(float epsilon = 1e-4f){
+        for(int i = 0; i < 3; i++){
+            if(max[i] - min[i] < epsilon){
+                min[i] -= epsilon;
+                max[i] += epsilon;
+            }
+        }
+    }
+    bool isEmpty() const{return min.x() > max.x();}
+    Eigen::Vector3f getCentroid() const{return 0.5f * (min + max);}
+    Eigen::Vector3f getExtent() const{return max - min;}
+    //Index of the longest axis
+    int getLargestAxis() const{
+        Eigen::Vector3f extent = getExtent();
+        if(extent.x() > extent.y() && extent.x() > extent.z()) return 0;
+        return extent.y() > extent.z() ? 1 : 2;
+    }
+    float getSurfaceArea() const{
+        if(isEmpty()) return 0;
+        Eigen::Vector3f extent = getExtent();
+        return 2 * (extent.x() * extent.y() + extent.y() * extent.z() + extent.z() * extent.x());
+    }
+    //Slab test : returns true if the ray enters the box before tMax and leaves it after tMin
+    //tEntry receives the distance at which the ray enters the box
+    bool intersect(const Eigen::Vector3f& origin, const Eigen::Vector3f& inverseDirection, float tMin, float tMax, float& tEntry) const{
+        for(int i = 0; i < 3; i++){
+            float t0 = (min[i] - origin[i]) * inverseDirection[i];
+            float t1 = (max[i] - origin[i]) * inverseDirection[i];
+            if(t0 > t1) std::swap(t0, t1);
+            tMin = t0 > tMin ? t0 : tMin;
+            tMax = t1 < tMax ? t1 : tMax;
+            if(tMax < tMin) return false;
+        }
+        tEntry = tMin;
+        return true;
+    }
+    void save(CacheWriter& writer) const{
+        writer.writeFloats(min.data(), 3);
+        writer.writeFloats(max.data(), 3);
+    }
+    bool load(CacheReader& reader){return reader.readFloats(min.data(), 3) && reader.readFloats(max.data(), 3);}
+};
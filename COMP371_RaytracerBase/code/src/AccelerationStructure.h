@@ -0,0 +1,21 @@
+#pragma once
+#include "HitRecord.h"
+#include "Ray.h"
+#include "RayPacket.h"
+
+//Structure over the primitives of the compiled scene answering the ray queries of the renderer
+//The speedup of an output selects it : 1 for the BVH, 2 for the uniform grid (0 tests every primitive without one)
+//Primitive ids are the ids in the compiled scene
+class AccelerationStructure{
+public:
+    virtual ~AccelerationStructure() = default;
+    //Closest hit along the ray with a distance in [tMin, tMax]
+    virtual bool intersect(const Ray& ray, float tMin, float tMax, HitRecord& hit) const = 0;
+    //Closest hit of every ray of the packet at a distance in [tMin, tMax of the ray]
+    //Fills the tMax and primitiveId arrays of the packet, the hit records are then filled with CompiledScene::fillPacketHit
+    virtual void intersect(RayPacket& packet, float tMin) const = 0;
+    //Returns true as soon as one primitive is hit at a distance in [tMin, tMax]
+    virtual bool occluded(const Ray& ray, float tMin, float tMax) const = 0;
+    //Occlusion of every ray of the packet in [tMin, tMax of the ray], the primitive id of an occluded ray is set to a value >= 0
+    virtual void occluded(RayPacket& packet, float tMin) const = 0;
+};
@@ -0,0 +1,100 @@
+#include "Animation.h"
+#include <cmath>
+#include <iostream>
+
+namespace {
+
+//Reads a vector member of a keyframe when it is given
+void readVector(const nlohmann::json& keyframe, const char* name, Eigen::Vector3f& vector, const std::string& owner){
+    if(!keyframe.contains(name)) return;
+    const nlohmann::json& values = keyframe[name];
+    if(!values.is_array() || values.size() != 3){
+        std::cout << "Exiting program: " << name << " of the keyframes of " << owner << " should be an array of 3 numbers" << std::endl;
+        exit(1);
+    }
+    for(int i = 0; i < 3; i++) vector[i] = values[i].get<float>();
+}
+
+//Checks the keyframe array and reads the frame of a keyframe, the frames must increase
+float readFrame(const nlohmann::json& keyframes, size_t index, float previous, const std::string& owner){
+    if(!keyframes[index].is_object() || !keyframes[index].contains("frame") || !keyframes[index]["frame"].is_number()){
+        std::cout << "Exiting program: every keyframe of " << owner << " should be an object with a frame" << std::endl;
+        exit(1);
+    }
+    const float frame = keyframes[index]["frame"].get<float>();
+    if(index > 0 && !(frame > previous)){
+        std::cout << "Exiting program: the frames of the keyframes of " << owner << " should increase" << std::endl;
+        exit(1);
+    }
+    return frame;
+}
+
+void checkArray(const nlohmann::json& json, const std::string& owner){
+    if(!json.is_array() || json.empty()){
+        std::cout << "Exiting program: keyframes of " << owner << " should be a non empty array" << std::endl;
+        exit(1);
+    }
+}
+
+}
+
+std::vector<TransformKeyframe> TransformKeyframe::parse(const nlohmann::json &json, const std::string &owner) {
+    checkArray(json, owner);
+    std::vector<TransformKeyframe> keyframes(json.size());
+    for(size_t i = 0; i < json.size(); i++){
+        keyframes[i].frame = readFrame(json, i, i > 0 ? keyframes[i - 1].frame : 0, owner);
+        readVector(json[i], "translate", keyframes[i].translate, owner);
+        readVector(json[i], "rotate", keyframes[i].rotate, owner);
+        readVector(json[i], "scale", keyframes[i].scale, owner);
+        //A scale of 0, or changing sign between two keyframes (0 in between), gives a transform that is not invertible
+        for(int a = 0; a < 3; a++){
+            const float scale = keyframes[i].scale[a];
+            if(scale == 0 || (i > 0 && (scale > 0) != (keyframes[i - 1].scale[a] > 0))){
+                std::cout << "Exiting program: the scale of the keyframes of " << owner << " should not be 0 or change sign, the transform would not be invertible" << std::endl;
+                exit(1);
+            }
+        }
+    }
+    return keyframes;
+}
+
+Eigen::Matrix4f TransformKeyframe::evaluate(const TransformKeyframe *keyframes, size_t count, float frame) {
+    Eigen::Vector3f translate, rotate, scale;
+    interpolateKeyframes(keyframes, count, frame, [&](const TransformKeyframe& previous, const TransformKeyframe& next, float weight){
+        translate = previous.translate + weight * (next.translate - previous.translate);
+        rotate = previous.rotate + weight * (next.rotate - previous.rotate);
+        scale = previous.scale + weight * (next.scale - previous.scale);
+    });
+    const float toRadians = (float)M_PI / 180;
+    const Eigen::Matrix3f rotation = (Eigen::AngleAxisf(rotate.z() * toRadians, Eigen::Vector3f::UnitZ())
+                                      * Eigen::AngleAxisf(rotate.y() * toRadians, Eigen::Vector3f::UnitY())
+                                      * Eigen::AngleAxisf(rotate.x() * toRadians, Eigen::Vector3f::UnitX())).toRotationMatrix();
+    Eigen::Matrix4f transform = Eigen::Matrix4f::Identity();
+    transform.topLeftCorner<3, 3>() = rotation * scale.asDiagonal();
+    transform.topRightCorner<3, 1>() = translate;
+    return transform;
+}
+
+std::vector<CameraKeyframe> CameraKeyframe::parse(const nlohmann::json &json, const CameraKeyframe &initial, const std::string &owner) {
+    checkArray(json, owner);
+    std::vector<CameraKeyframe> keyframes(json.size());
+    for(size_t i = 0; i < json.size(); i++){
+        keyframes[i] = i > 0 ? keyframes[i - 1] : initial;
+        keyframes[i].frame = readFrame(json, i, i > 0 ? keyframes[i - 1].frame : 0, owner);
+        readVector(json[i], "centre", keyframes[i].centre, owner);
+        readVector(json[i], "lookat", keyframes[i].lookAt, owner);
+        readVector(json[i], "up", keyframes[i].up, owner);
+    }
+    return keyframes;
+}
+
+CameraKeyframe CameraKeyframe::evaluate(const std::vector<CameraKeyframe> &keyframes, float frame) {
+    CameraKeyframe camera;
+    camera.frame = frame;
+    interpolateKeyframes(keyframes.data(), keyframes.size(), frame, [&](const CameraKeyframe& previous, const CameraKeyframe& next, float weight){
+        camera.centre = previous.centre + weight * (next.centre - previous.centre);
+        camera.lookAt = previous.lookAt + weight * (next.lookAt - previous.lookAt);
+        camera.up = previous.up + weight * (next.up - previous.up);
+    });
+    return camera;
+}
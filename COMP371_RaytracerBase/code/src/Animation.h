@@ -0,0 +1,48 @@
+#pragma once
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "../external/json.hpp"
+#include "Eigen/Core"
+#include "Eigen/Geometry"
+#include "CacheStream.h"
+
+//Keyframes of the animations, the values between two keyframes are interpolated linearly and held before the first
+//keyframe and after the last one. Frames are numbered from 0
+
+//Keyframe of an animated geometry, applied after the transform of the geometry
+//rotate --> angles in degrees around x, then y, then z
+struct TransformKeyframe{
+    float frame = 0;
+    Eigen::Vector3f translate{0, 0, 0}, rotate{0, 0, 0}, scale{1, 1, 1};
+    //Keyframes of a geometry or output (what is printed in the error messages), exits the program when they are not valid
+    static std::vector<TransformKeyframe> parse(const nlohmann::json& json, const std::string& owner);
+    //Transform of the keyframes at a frame
+    static Eigen::Matrix4f evaluate(const TransformKeyframe* keyframes, size_t count, float frame);
+    void save(CacheWriter& writer) const{
+        writer.write(frame);
+        for(const Eigen::Vector3f* value : {&translate, &rotate, &scale}) writer.writeFloats(value->data(), 3);
+    }
+    bool load(CacheReader& reader){
+        return reader.read(frame) && reader.readFloats(translate.data(), 3) && reader.readFloats(rotate.data(), 3) && reader.readFloats(scale.data(), 3);
+    }
+};
+
+//Keyframe of the camera of an output
+struct CameraKeyframe{
+    float frame = 0;
+    Eigen::Vector3f centre{0, 0, 0}, lookAt{0, 0, -1}, up{0, 1, 0};
+    //Members not given by a keyframe keep the value of the output (first keyframe) or of the previous keyframe
+    static std::vector<CameraKeyframe> parse(const nlohmann::json& json, const CameraKeyframe& initial, const std::string& owner);
+    static CameraKeyframe evaluate(const std::vector<CameraKeyframe>& keyframes, float frame);
+};
+
+//Calls blend(previous, next, weight) with the two keyframes around the frame, or (keyframe, keyframe, 0) outside of them
+//The keyframes are sorted by frame
+template<typename Keyframe, typename F>
+void interpolateKeyframes(const Keyframe* keyframes, size_t count, float frame, F blend){
+    const Keyframe* next = std::upper_bound(keyframes, keyframes + count, frame, [](float value, const Keyframe& keyframe){return value < keyframe.frame;});
+    if(next == keyframes) blend(*next, *next, 0.0f);
+    else if(next == keyframes + count) blend(next[-1], next[-1], 0.0f);
+    else blend(next[-1], *next, (frame - next[-1].frame) / (next->frame - next[-1].frame));
+}
@@ -0,0 +1,1022 @@
+#include "BVH.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <memory>
+
+BVH::BVH(const CompiledScene &scene, ThreadPool &pool, BVHBuilder builder, uint bins) :
+        scene(scene), builder(builder), binCount(std::max(2u, bins)), pool(pool) {
+    auto start = std::chrono::steady_clock::now();
+    const uint objectCount = scene.getPrimitiveCount();
+    indices.resize(objectCount);
+    objectBounds.resize(objectCount);
+    centroids.resize(objectCount);
+    forEachChunk(0, objectCount, getChunkCount(objectCount), [this](uint first, uint count, uint){
+        for(uint i = first; i < first + count; i++){
+            indices[i] = i;
+            objectBounds[i] = this->scene.getBounds(i);
+            objectBounds[i].pad();
+            centroids[i] = objectBounds[i].getCentroid();
+        }
+    });
+    //A binary tree with N leaves has at most 2N - 1 nodes
+    nodes.resize(std::max(1u, 2 * objectCount));
+    nodes[0] = Node{AABB(), 0, objectCount};
+    nodeCount = 1;
+    if(objectCount > 0){
+        TaskGroup group;
+        pool.submit(group, [this, &group, objectCount](uint){build(group, 0, 0, objectCount, 0);});
+        pool.wait(group);
+    }
+    nodes.resize(nodeCount);
+    nodes.shrink_to_fit();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    buildTime = elapsed.count();
+    computeStatistics();
+}
+
+BVH::BVH(const CompiledScene &scene, ThreadPool &pool, CacheReader &reader) :
+        scene(scene), builder(BVHBuilder::SAH), binCount(2), pool(pool) {
+    uint32_t builderValue = 0;
+    if(!reader.read(builderValue) || !reader.read(binCount) || !reader.readObjects(nodes) || !reader.readArray(indices)) nodes.clear();
+    builder = (BVHBuilder)builderValue;
+}
+
+BVH::BVH(const BVH &tree) :
+        nodes(tree.nodes), indices(tree.indices), scene(tree.scene), builder(tree.builder), binCount(tree.binCount), pool(tree.pool),
+        nodeCount((uint)tree.nodes.size()), leafCount(tree.leafCount), depth(tree.depth), traversalCost(tree.traversalCost),
+        builtCosts(tree.builtCosts), unusedNodes(tree.unusedNodes) {
+    //The bounds of the primitives are computed again by the first refit
+}
+
+BVH *BVH::load(const CompiledScene &scene, ThreadPool &pool, CacheReader &reader) {
+    std::unique_ptr<BVH> bvh(new BVH(scene, pool, reader));
+    if(bvh->nodes.empty() || bvh->indices.size() != scene.getPrimitiveCount()) return nullptr;
+    //The references of the nodes are checked so that a damaged cache can not send the traversal out of the arrays
+    //Children always come after their parent, so the tree has no cycle
+    for(size_t i = 0; i < bvh->nodes.size() && !bvh->indices.empty(); i++){
+        const Node& node = bvh->nodes[i];
+        if(node.count > 0 ? node.leftFirst + (uint64_t)node.count > bvh->indices.size()
+                          : node.leftFirst <= i || node.leftFirst + (uint64_t)1 >= bvh->nodes.size()) return nullptr;
+    }
+    for(uint index : bvh->indices){
+        if(index >= scene.getPrimitiveCount()) return nullptr;
+    }
+    bvh->nodeCount = (uint)bvh->nodes.size();
+    bvh->computeStatistics();
+    if(bvh->depth >= STACK_SIZE) return nullptr;
+    return bvh.release();
+}
+
+void BVH::save(CacheWriter &writer) const {
+    writer.write((uint32_t)builder);
+    writer.write(binCount);
+    writer.writeObjects(nodes);
+    writer.writeArray(indices);
+}
+
+uint BVH::getChunkCount(uint count) const {
+    return count >= 4 * PARALLEL_BUILD_THRESHOLD ? pool.getThreadCount() : 1;
+}
+
+void BVH::forEachChunk(uint first, uint count, uint chunks, const std::function<void(uint, uint, uint)> &work) {
+    if(chunks <= 1){
+        work(first, count, 0);
+        return;
+    }
+    const uint chunkSize = (count + chunks - 1) / chunks;
+    TaskGroup group;
+    for(uint chunk = 0; chunk < chunks; chunk++){
+        const uint chunkFirst = first + chunk * chunkSize;
+        if(chunkFirst >= first + count) break;
+        const uint chunkCount = std::min(chunkSize, first + count - chunkFirst);
+        pool.submit(group, [&work, chunkFirst, chunkCount, chunk](uint){work(chunkFirst, chunkCount, chunk);});
+    }
+    pool.wait(group);
+}
+
+void BVH::computeBounds(uint first, uint count, AABB &bounds, AABB &centroidBounds) {
+    const uint chunks = getChunkCount(count);
+    std::vector<AABB> chunkBounds(chunks), chunkCentroidBounds(chunks);
+    forEachChunk(first, count, chunks, [&](uint chunkFirst, uint chunkCount, uint chunk){
+        for(uint i = chunkFirst; i < chunkFirst + chunkCount; i++){
+            chunkBounds[chunk].expand(objectBounds[indices[i]]);
+            chunkCentroidBounds[chunk].expand(centroids[indices[i]]);
+        }
+    });
+    for(uint chunk = 0; chunk < chunks; chunk++){
+        bounds.expand(chunkBounds[chunk]);
+        centroidBounds.expand(chunkCentroidBounds[chunk]);
+    }
+}
+
+uint BVH::getBin(const Eigen::Vector3f &centroid, int axis, const AABB &centroidBounds) const {
+    const float scale = binCount / (centroidBounds.max[axis] - centroidBounds.min[axis]);
+    const uint bin = (uint)((centroid[axis] - centroidBounds.min[axis]) * scale);
+    return std::min(bin, binCount - 1);
+}
+
+bool BVH::findSAHSplit(uint first, uint count, const AABB &bounds, const AABB &centroidBounds, int &axis, uint &splitBin, float &cost) {
+    //Binning the centroids on the three axes, every chunk fills its own bins
+    const uint chunks = getChunkCount(count);
+    std::vector<Bin> chunkBins(chunks * 3 * binCount);
+    forEachChunk(first, count, chunks, [&](uint chunkFirst, uint chunkCount, uint chunk){
+        Bin* bins = &chunkBins[chunk * 3 * binCount];
+        for(uint i = chunkFirst; i < chunkFirst + chunkCount; i++){
+            const uint object = indices[i];
+            for(int a = 0; a < 3; a++){
+                if(centroidBounds.max[a] <= centroidBounds.min[a]) continue;
+                Bin& bin = bins[a * binCount + getBin(centroids[object], a, centroidBounds)];
+                bin.bounds.expand(objectBounds[object]);
+                bin.count++;
+            }
+        }
+    });
+    std::vector<Bin> bins(3 * binCount);
+    for(uint chunk = 0; chunk < chunks; chunk++){
+        for(uint b = 0; b < 3 * binCount; b++){
+            bins[b].bounds.expand(chunkBins[chunk * 3 * binCount + b].bounds);
+            bins[b].count += chunkBins[chunk * 3 * binCount + b].count;
+        }
+    }
+    //Sweeping the split planes between the bins, from the left and from the right
+    bool found = false;
+    cost = std::numeric_limits<float>::infinity();
+    const float inverseArea = 1 / bounds.getSurfaceArea();
+    std::vector<float> leftArea(binCount), rightArea(binCount);
+    std::vector<uint> leftCount(binCount), rightCount(binCount);
+    for(int a = 0; a < 3; a++){
+        if(centroidBounds.max[a] <= centroidBounds.min[a]) continue;
+        const Bin* axisBins = &bins[a * binCount];
+        AABB leftBox, rightBox;
+        uint leftSum = 0, rightSum = 0;
+        for(uint b = 0; b < binCount - 1; b++){
+            leftBox.expand(axisBins[b].bounds);
+            leftSum += axisBins[b].count;
+            leftArea[b] = leftBox.getSurfaceArea();
+            leftCount[b] = leftSum;
+            rightBox.expand(axisBins[binCount - 1 - b].bounds);
+            rightSum += axisBins[binCount - 1 - b].count;
+            rightArea[binCount - 2 - b] = rightBox.getSurfaceArea();
+            rightCount[binCount - 2 - b] = rightSum;
+        }
+        //Split b puts bins [0, b] on the left
+        for(uint b = 0; b < binCount - 1; b++){
+            if(leftCount[b] == 0 || rightCount[b] == 0) continue;
+            float splitCost = TRAVERSAL_COST + INTERSECTION_COST * (leftArea[b] * leftCount[b] + rightArea[b] * rightCount[b]) * inverseArea;
+            if(splitCost < cost){
+                cost = splitCost;
+                axis = a;
+                splitBin = b;
+                found = true;
+            }
+        }
+    }
+    return found;
+}
+
+void BVH::build(TaskGroup &group, uint nodeIndex, uint first, uint count, uint level) {
+    AABB bounds, centroidBounds;
+    computeBounds(first, count, bounds, centroidBounds);
+    //The node array is never reallocated during the build so the reference stays valid
+    Node& node = nodes[nodeIndex];
+    node.bounds = bounds;
+    const uint leafSize = builder == BVHBuilder::SAH ? 1 : MEDIAN_LEAF_SIZE;
+    if(count <= leafSize){
+        node.leftFirst = first;
+        node.count = count;
+        return;
+    }
+    int axis = centroidBounds.getLargestAxis();
+    uint leftSize = 0;
+    if(builder == BVHBuilder::SAH && level < MAX_DEPTH){
+        uint splitBin = 0;
+        float cost;
+        bool found = findSAHSplit(first, count, bounds, centroidBounds, axis, splitBin, cost);
+        if((!found || cost >= INTERSECTION_COST * count) && count <= MAX_LEAF_SIZE){
+            node.leftFirst = first;
+            node.count = count;
+            return;
+        }
+        if(found){
+            auto middle = std::partition(indices.begin() + first, indices.begin() + first + count, [&](uint object){
+                return getBin(centroids[object], axis, centroidBounds) <= splitBin;
+            });
+            leftSize = (uint)(middle - indices.begin()) - first;
+        }
+    }
+    if(leftSize == 0 || leftSize == count){
+        //Median split along the axis where the centroids are the most spread
+        leftSize = count / 2;
+        std::nth_element(indices.begin() + first, indices.begin() + first + leftSize, indices.begin() + first + count,
+                         [this, axis](uint a, uint b){return centroids[a][axis] < centroids[b][axis];});
+    }
+    const uint left = nodeCount.fetch_add(2, std::memory_order_relaxed);
+    node.leftFirst = left;
+    node.count = 0;
+    if(count > PARALLEL_BUILD_THRESHOLD){
+        //Left subtree built by another worker while this one continues with the right subtree
+        pool.submit(group, [this, &group, left, first, leftSize, level](uint){build(group, left, first, leftSize, level + 1);});
+    }
+    else build(group, left, first, leftSize, level + 1);
+    build(group, left + 1, first + leftSize, count - leftSize, level + 1);
+}
+
+uint BVH::refit(float rebuildThreshold) {
+    const uint rebuilt = refitNodes(rebuildThreshold);
+    //The wide nodes copy the bounds of the binary nodes
+    if(width != BINARY_WIDTH) setWidth(width, quantization);
+    return rebuilt;
+}
+
+uint BVH::refitNodes(float rebuildThreshold) {
+    if(indices.empty()) return 0;
+    if(builtCosts.size() != nodes.size()) computeCosts(builtCosts);
+    const uint objectCount = (uint)indices.size();
+    objectBounds.resize(objectCount);
+    centroids.resize(objectCount);
+    forEachChunk(0, objectCount, getChunkCount(objectCount), [this](uint first, uint count, uint){
+        for(uint i = first; i < first + count; i++){
+            objectBounds[i] = scene.getBounds(i);
+            objectBounds[i].pad();
+            centroids[i] = objectBounds[i].getCentroid();
+        }
+    });
+    //Range of the primitives of every subtree, the left subtree comes first in indices
+    std::vector<uint> rangeFirst(nodes.size()), rangeCount(nodes.size());
+    for(uint i = (uint)nodes.size(); i-- > 0;){
+        Node& node = nodes[i];
+        AABB bounds;
+        if(node.count > 0){
+            for(uint j = node.leftFirst; j < node.leftFirst + node.count; j++) bounds.expand(objectBounds[indices[j]]);
+            rangeFirst[i] = node.leftFirst;
+            rangeCount[i] = node.count;
+        }
+        else{
+            bounds = nodes[node.leftFirst].bounds;
+            bounds.expand(nodes[node.leftFirst + 1].bounds);
+            rangeFirst[i] = rangeFirst[node.leftFirst];
+            rangeCount[i] = rangeCount[node.leftFirst] + rangeCount[node.leftFirst + 1];
+        }
+        node.bounds = bounds;
+    }
+    //The topmost subtrees that degraded are rebuilt
+    std::vector<float> costs;
+    std::vector<uint> subtreeNodes;
+    computeCosts(costs, &subtreeNodes);
+    std::vector<std::pair<uint, uint>> stack{{0, 0}}, degraded;
+    while(!stack.empty()){
+        const auto entry = stack.back();
+        stack.pop_back();
+        const Node& node = nodes[entry.first];
+        if(costs[entry.first] > rebuildThreshold * builtCosts[entry.first]){
+            degraded.push_back(entry);
+            continue;
+        }
+        if(node.count > 0) continue;
+        stack.emplace_back(node.leftFirst, entry.second + 1);
+        stack.emplace_back(node.leftFirst + 1, entry.second + 1);
+    }
+    if(degraded.empty()) return 0;
+    const uint previousSize = (uint)nodes.size();
+    for(const auto& entry : degraded) unusedNodes += subtreeNodes[entry.first] - 1;
+    //Once most of the nodes are unused the whole tree is rebuilt, which also compacts it
+    if(degraded[0].first == 0 || 2 * unusedNodes > nodes.size()){
+        rebuild(0, 0, objectCount, 0);
+        computeCosts(builtCosts);
+    }
+    else{
+        for(const auto& entry : degraded) rebuild(entry.first, rangeFirst[entry.first], rangeCount[entry.first], entry.second);
+        //The new nodes and the roots of the rebuilt subtrees get the cost they were rebuilt with
+        computeCosts(costs);
+        builtCosts.resize(nodes.size());
+        std::copy(costs.begin() + previousSize, costs.end(), builtCosts.begin() + previousSize);
+        for(const auto& entry : degraded) builtCosts[entry.first] = costs[entry.first];
+    }
+    computeStatistics();
+    return (uint)degraded.size();
+}
+
+void BVH::rebuild(uint node, uint first, uint count, uint level) {
+    if(node == 0){
+        nodes.assign(std::max(1u, 2 * count), Node{AABB(), 0, count});
+        nodeCount = 1;
+        unusedNodes = 0;
+    }
+    else{
+        nodeCount = (uint)nodes.size();
+        nodes.resize(nodes.size() + 2 * count);
+    }
+    //The node array is sized before the build, which never reallocates it
+    TaskGroup group;
+    pool.submit(group, [this, &group, node, first, count, level](uint){build(group, node, first, count, level);});
+    pool.wait(group);
+    nodes.resize(nodeCount);
+}
+
+void BVH::computeCosts(std::vector<float> &costs, std::vector<uint> *subtreeNodes) const {
+    costs.resize(nodes.size());
+    if(subtreeNodes != nullptr) subtreeNodes->resize(nodes.size());
+    for(uint i = (uint)nodes.size(); i-- > 0;){
+        const Node& node = nodes[i];
+        if(node.count > 0){
+            costs[i] = INTERSECTION_COST * node.count;
+            if(subtreeNodes != nullptr) (*subtreeNodes)[i] = 1;
+            continue;
+        }
+        const Node& left = nodes[node.leftFirst];
+        const Node& right = nodes[node.leftFirst + 1];
+        const float area = node.bounds.getSurfaceArea();
+        //Probability of a ray hitting the node to also hit each child
+        const float leftProbability = area > 0 ? left.bounds.getSurfaceArea() / area : 1;
+        const float rightProbability = area > 0 ? right.bounds.getSurfaceArea() / area : 1;
+        costs[i] = TRAVERSAL_COST + leftProbability * costs[node.leftFirst] + rightProbability * costs[node.leftFirst + 1];
+        if(subtreeNodes != nullptr) (*subtreeNodes)[i] = 1 + (*subtreeNodes)[node.leftFirst] + (*subtreeNodes)[node.leftFirst + 1];
+    }
+}
+
+void BVH::computeStatistics() {
+    leafCount = 0;
+    depth = 0;
+    traversalCost = 0;
+    if(indices.empty()) return;
+    const float inverseRootArea = 1 / nodes[0].bounds.getSurfaceArea();
+    std::vector<std::pair<uint, uint>> stack{{0, 1}};
+    while(!stack.empty()){
+        auto entry = stack.back();
+        stack.pop_back();
+        const Node& node = nodes[entry.first];
+        depth = std::max(depth, entry.second);
+        //Probability of a ray hitting the root to also hit the node times the cost of the node
+        const float probability = node.bounds.getSurfaceArea() * inverseRootArea;
+        if(node.count > 0){
+            leafCount++;
+            traversalCost += probability * INTERSECTION_COST * node.count;
+            continue;
+        }
+        traversalCost += probability * TRAVERSAL_COST;
+        stack.emplace_back(node.leftFirst, entry.second + 1);
+        stack.emplace_back(node.leftFirst + 1, entry.second + 1);
+    }
+}
+
+bool BVH::intersect(const Ray &ray, float tMin, float tMax, HitRecord &hit) const {
+    if(width != BINARY_WIDTH){
+        return visitWideLayout([&](const auto* wide, const uint* leafIndices){return intersectWide(wide, leafIndices, ray, tMin, tMax, hit);});
+    }
+    const Eigen::Vector3f& origin = ray.getOrigin();
+    const Eigen::Vector3f inverseDirection = ray.getDirection().cwiseInverse();
+    bool intersected = false;
+    float tEntry;
+    if(indices.empty() || !nodes[0].bounds.intersect(origin, inverseDirection, tMin, tMax, tEntry)) return false;
+    uint stack[STACK_SIZE];
+    uint stackSize = 0;
+    stack[stackSize++] = 0;
+    while(stackSize > 0){
+        const Node& node = nodes[stack[--stackSize]];
+        if(node.count > 0){
+            for(uint i = node.leftFirst; i < node.leftFirst + node.count; i++){
+                //tMax shrinks to the closest hit so far
+                if(scene.intersect(indices[i], ray, tMin, tMax, hit)){
+                    intersected = true;
+                    tMax = hit.t;
+                    hit.primitiveId = (int)indices[i];
+                }
+            }
+            continue;
+        }
+        //Visiting the nearest child first so that tMax shrinks as early as possible
+        float tLeft, tRight;
+        bool hitLeft = nodes[node.leftFirst].bounds.intersect(origin, inverseDirection, tMin, tMax, tLeft);
+        bool hitRight = nodes[node.leftFirst + 1].bounds.intersect(origin, inverseDirection, tMin, tMax, tRight);
+        if(hitLeft && hitRight){
+            if(tLeft <= tRight){
+                stack[stackSize++] = node.leftFirst + 1;
+                stack[stackSize++] = node.leftFirst;
+            }
+            else{
+                stack[stackSize++] = node.leftFirst;
+                stack[stackSize++] = node.leftFirst + 1;
+            }
+        }
+        else if(hitLeft) stack[stackSize++] = node.leftFirst;
+        else if(hitRight) stack[stackSize++] = node.leftFirst + 1;
+    }
+    return intersected;
+}
+
+bool BVH::occluded(const Ray &ray, float tMin, float tMax) const {
+    if(width != BINARY_WIDTH){
+        return visitWideLayout([&](const auto* wide, const uint* leafIndices){return occludedWide(wide, leafIndices, ray, tMin, tMax);});
+    }
+    const Eigen::Vector3f& origin = ray.getOrigin();
+    const Eigen::Vector3f inverseDirection = ray.getDirection().cwiseInverse();
+    float tEntry;
+    if(indices.empty() || !nodes[0].bounds.intersect(origin, inverseDirection, tMin, tMax, tEntry)) return false;
+    uint stack[STACK_SIZE];
+    uint stackSize = 0;
+    stack[stackSize++] = 0;
+    while(stackSize > 0){
+        const Node& node = nodes[stack[--stackSize]];
+        if(node.count > 0){
+            //Any hit ends the query, no hit record is filled
+            for(uint i = node.leftFirst; i < node.leftFirst + node.count; i++){
+                if(scene.occludes(indices[i], ray, tMin, tMax)) return true;
+            }
+            continue;
+        }
+        //Visiting first the larger child, the most likely to contain an occluder
+        const AABB& left = nodes[node.leftFirst].bounds;
+        const AABB& right = nodes[node.leftFirst + 1].bounds;
+        const bool hitLeft = left.intersect(origin, inverseDirection, tMin, tMax, tEntry);
+        const bool hitRight = right.intersect(origin, inverseDirection, tMin, tMax, tEntry);
+        if(hitLeft && hitRight){
+            if(left.getSurfaceArea() >= right.getSurfaceArea()){
+                stack[stackSize++] = node.leftFirst + 1;
+                stack[stackSize++] = node.leftFirst;
+            }
+            else{
+                stack[stackSize++] = node.leftFirst;
+                stack[stackSize++] = node.leftFirst + 1;
+            }
+        }
+        else if(hitLeft) stack[stackSize++] = node.leftFirst;
+        else if(hitRight) stack[stackSize++] = node.leftFirst + 1;
+    }
+    return false;
+}
+
+BVH::PacketInterval::PacketInterval(const RayPacket &packet) {
+    const float* origins[3] = {packet.ox, packet.oy, packet.oz};
+    const float* inverses[3] = {packet.invX, packet.invY, packet.invZ};
+    for(int a = 0; a < 3; a++){
+        originMin[a] = originMax[a] = origins[a][0];
+        inverseMin[a] = inverseMax[a] = inverses[a][0];
+        for(uint i = 1; i < packet.size; i++){
+            originMin[a] = std::min(originMin[a], origins[a][i]);
+            originMax[a] = std::max(originMax[a], origins[a][i]);
+            inverseMin[a] = std::min(inverseMin[a], inverses[a][i]);
+            inverseMax[a] = std::max(inverseMax[a], inverses[a][i]);
+        }
+        //With mixed signs or rays parallel to a plane of the axis the near and far planes differ between rays
+        if(!(inverseMin[a] > 0 || inverseMax[a] < 0) || std::isinf(inverseMin[a]) || std::isinf(inverseMax[a])) valid = false;
+    }
+}
+
+bool BVH::PacketInterval::misses(const AABB &box, float tMin, float tMax) const {
+    if(!valid) return false;
+    for(int a = 0; a < 3; a++){
+        //Every ray enters the slab of the axis through the same plane
+        const bool positive = inverseMin[a] > 0;
+        const float nearPlane = positive ? box.min[a] : box.max[a];
+        const float farPlane = positive ? box.max[a] : box.min[a];
+        //Bounds of (plane - origin) * inverseDirection over all the rays
+        const float near[4] = {(nearPlane - originMin[a]) * inverseMin[a], (nearPlane - originMin[a]) * inverseMax[a],
+                               (nearPlane - originMax[a]) * inverseMin[a], (nearPlane - originMax[a]) * inverseMax[a]};
+        const float far[4] = {(farPlane - originMin[a]) * inverseMin[a], (farPlane - originMin[a]) * inverseMax[a],
+                              (farPlane - originMax[a]) * inverseMin[a], (farPlane - originMax[a]) * inverseMax[a]};
+        //No ray enters the box before the lowest near distance nor leaves it after the highest far distance
+        tMin = std::max(tMin, *std::min_element(near, near + 4));
+        tMax = std::min(tMax, *std::max_element(far, far + 4));
+        if(tMax < tMin) return true;
+    }
+    return false;
+}
+
+void BVH::intersect(RayPacket &packet, float tMin) const {
+    if(width != BINARY_WIDTH){
+        return visitWideLayout([&](const auto* wide, const uint* leafIndices){intersectWide(wide, leafIndices, packet, tMin);});
+    }
+    if(indices.empty() || packet.size == 0) return;
+    packet.pad();
+    const SimdKernels& kernels = SimdKernels::get();
+    const PacketInterval interval(packet);
+    //Largest tMax of the rays, shrinks when the rays hit primitives
+    float packetTMax = *std::max_element(packet.tMax, packet.tMax + packet.size);
+    //Node and first ray that may hit it, the rays before it missed one of the ancestors of the node
+    std::pair<uint, uint> stack[STACK_SIZE];
+    uint stackSize = 0;
+    stack[stackSize++] = std::make_pair(0u, 0u);
+    while(stackSize > 0){
+        const auto entry = stack[--stackSize];
+        const Node& node = nodes[entry.first];
+        if(interval.misses(node.bounds, tMin, packetTMax)) continue;
+        const uint first = kernels.packetBox(packet, entry.second, node.bounds.min.data(), node.bounds.max.data(), tMin);
+        if(first >= packet.size) continue;
+        if(node.count > 0){
+            intersectLeaf(packet, first, indices.data(), node.leftFirst, node.count, tMin, false);
+            packetTMax = *std::max_element(packet.tMax, packet.tMax + packet.size);
+            continue;
+        }
+        //Visiting first the child nearest along the first ray hitting the node
+        const Eigen::Vector3f origin(packet.ox[first], packet.oy[first], packet.oz[first]);
+        const Eigen::Vector3f direction(packet.dx[first], packet.dy[first], packet.dz[first]);
+        const float distanceLeft = (nodes[node.leftFirst].bounds.getCentroid() - origin).dot(direction);
+        const float distanceRight = (nodes[node.leftFirst + 1].bounds.getCentroid() - origin).dot(direction);
+        if(distanceLeft <= distanceRight){
+            stack[stackSize++] = std::make_pair(node.leftFirst + 1, first);
+            stack[stackSize++] = std::make_pair(node.leftFirst, first);
+        }
+        else{
+            stack[stackSize++] = std::make_pair(node.leftFirst, first);
+            stack[stackSize++] = std::make_pair(node.leftFirst + 1, first);
+        }
+    }
+}
+
+void BVH::occluded(RayPacket &packet, float tMin) const {
+    if(width != BINARY_WIDTH){
+        return visitWideLayout([&](const auto* wide, const uint* leafIndices){occludedWide(wide, leafIndices, packet, tMin);});
+    }
+    if(indices.empty() || packet.size == 0) return;
+    packet.pad();
+    const SimdKernels& kernels = SimdKernels::get();
+    const PacketInterval interval(packet);
+    float packetTMax = *std::max_element(packet.tMax, packet.tMax + packet.size);
+    uint remaining = packet.size;
+    std::pair<uint, uint> stack[STACK_SIZE];
+    uint stackSize = 0;
+    stack[stackSize++] = std::make_pair(0u, 0u);
+    while(stackSize > 0 && remaining > 0){
+        const auto entry = stack[--stackSize];
+        const Node& node = nodes[entry.first];
+        if(interval.misses(node.bounds, tMin, packetTMax)) continue;
+        const uint first = kernels.packetBox(packet, entry.second, node.bounds.min.data(), node.bounds.max.data(), tMin);
+        if(first >= packet.size) continue;
+        if(node.count > 0){
+            intersectLeaf(packet, first, indices.data(), node.leftFirst, node.count, tMin, true);
+            remaining -= retireOccluded(packet, first, tMin);
+            packetTMax = *std::max_element(packet.tMax, packet.tMax + packet.size);
+            continue;
+        }
+        //Visiting first the larger child, the most likely to contain an occluder
+        const AABB& left = nodes[node.leftFirst].bounds;
+        const AABB& right = nodes[node.leftFirst + 1].bounds;
+        if(left.getSurfaceArea() >= right.getSurfaceArea()){
+            stack[stackSize++] = std::make_pair(node.leftFirst + 1, first);
+            stack[stackSize++] = std::make_pair(node.leftFirst, first);
+        }
+        else{
+            stack[stackSize++] = std::make_pair(node.leftFirst, first);
+            stack[stackSize++] = std::make_pair(node.leftFirst + 1, first);
+        }
+    }
+}
+
+
+void BVH::intersectLeaf(RayPacket &packet, uint first, const uint* leafIndices, uint leafFirst, uint leafCount, float tMin, bool occluded) const {
+    const SimdKernels& kernels = SimdKernels::get();
+    const SphereArrays spheres = scene.getSphereArrays();
+    const QuadArrays quads = scene.getQuadArrays();
+    const TriangleArrays triangles = scene.getTriangleArrays();
+    for(uint i = leafFirst; i < leafFirst + leafCount; i++){
+        const uint primitive = leafIndices[i];
+        if(primitive < scene.getSphereCount()) kernels.packetSphere(packet, first, spheres, primitive, (int)primitive, tMin);
+        else if(primitive < scene.getFirstTriangle()) kernels.packetQuad(packet, first, quads, primitive - scene.getSphereCount(), (int)primitive, tMin);
+        else if(primitive < scene.getFirstInstance()) kernels.packetTriangle(packet, first, triangles, primitive - scene.getFirstTriangle(), (int)primitive, tMin);
+        else if(occluded) scene.instanceOccludes(packet, first, primitive - scene.getFirstInstance(), tMin);
+        else scene.intersectInstance(packet, first, primitive - scene.getFirstInstance(), tMin);
+    }
+}
+
+uint BVH::retireOccluded(RayPacket &packet, uint first, float tMin) {
+    //With a tMax of -infinity the occluded rays cannot hit any other box or primitive
+    uint retired = 0;
+    for(uint i = first; i < packet.size; i++){
+        if(packet.primitiveId[i] >= 0 && packet.tMax[i] >= tMin){
+            packet.tMax[i] = -std::numeric_limits<float>::infinity();
+            retired++;
+        }
+    }
+    return retired;
+}
+
+namespace {
+
+//2^exponent for an exponent giving a normal float, built from its bits
+inline float powerOfTwo(int exponent){
+    const uint32_t bits = (uint32_t)(exponent + 127) << 23;
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+//Exponents of the scales of the quantized nodes, a scale always is a normal float and levels * scale never overflows
+const int MIN_EXPONENT = -126;
+const int MAX_EXPONENT = 100;
+
+}
+
+void BVH::setWidth(uint width, uint quantization) {
+    this->width = width == 4 || width == 8 ? width : BINARY_WIDTH;
+    this->quantization = this->width != BINARY_WIDTH && (quantization == 8 || quantization == 16) ? quantization : 0;
+    wideNodes4 = WideNodes<4>();
+    wideNodes8 = WideNodes<8>();
+    quantizedNodes = decltype(quantizedNodes)();
+    quantizedIndices = std::vector<uint>();
+    quantizedNodeCount = 0;
+    wideTraversalCost = quantizedTraversalCost = 0;
+    rootBounds = AABB();
+    if(indices.empty()) return;
+    rootBounds = nodes[0].bounds;
+    if(this->quantization == 8) this->width == 4 ? compress<4, uint8_t>() : compress<8, uint8_t>();
+    else if(this->quantization == 16) this->width == 4 ? compress<4, uint16_t>() : compress<8, uint16_t>();
+    else if(this->width == 4) collapse(wideNodes4);
+    else if(this->width == 8) collapse(wideNodes8);
+}
+
+void BVH::releaseBinaryNodes() {
+    if(width == BINARY_WIDTH) return;
+    nodes = std::vector<Node>();
+    objectBounds = std::vector<AABB>();
+    centroids = std::vector<Eigen::Vector3f>();
+    builtCosts = std::vector<float>();
+    //The quantized nodes reference their own copy of the primitive ids
+    if(quantization != 0) indices = std::vector<uint>();
+}
+
+uint BVH::getTraversalNodeCount() const {
+    if(quantization != 0) return quantizedNodeCount;
+    if(width == 4) return (uint)wideNodes4.size();
+    if(width == 8) return (uint)wideNodes8.size();
+    return (uint)nodes.size();
+}
+
+size_t BVH::getTraversalNodeBytes() const {
+    if(quantization != 0) return quantizedNodes.size();
+    if(width == 4) return wideNodes4.size() * sizeof(WideNode<4>);
+    if(width == 8) return wideNodes8.size() * sizeof(WideNode<8>);
+    return nodes.size() * sizeof(Node);
+}
+
+uint BVH::gatherChildren(uint binary, uint maxChildren, uint *children) const {
+    uint childCount = 0;
+    //A leaf root is the only child of the root
+    if(nodes[binary].count > 0) children[childCount++] = binary;
+    else{
+        children[childCount++] = nodes[binary].leftFirst;
+        children[childCount++] = nodes[binary].leftFirst + 1;
+    }
+    //The interior child with the largest area, the most likely to be visited, is replaced by its children
+    while(childCount < maxChildren){
+        int largest = -1;
+        float largestArea = -1;
+        for(uint i = 0; i < childCount; i++){
+            const Node& child = nodes[children[i]];
+            if(child.count == 0 && child.bounds.getSurfaceArea() > largestArea){
+                largest = (int)i;
+                largestArea = child.bounds.getSurfaceArea();
+            }
+        }
+        if(largest < 0) break;
+        const uint opened = children[largest];
+        children[largest] = nodes[opened].leftFirst;
+        children[childCount++] = nodes[opened].leftFirst + 1;
+    }
+    return childCount;
+}
+
+template<uint W>
+void BVH::collapse(WideNodes<W> &wide) {
+    const float rootArea = rootBounds.getSurfaceArea();
+    //Binary node and wide node of every wide node still to fill, the children of a wide node are allocated together
+    std::vector<std::pair<uint, uint>> pending{{0u, 0u}};
+    wide.reserve(nodes.size() / 2 + 1);
+    wide.emplace_back();
+    while(!pending.empty()){
+        const uint binary = pending.back().first;
+        const uint index = pending.back().second;
+        pending.pop_back();
+        uint children[W];
+        const uint childCount = gatherChildren(binary, W, children);
+        WideNode<W> node{};
+        node.childCount = (uint8_t)childCount;
+        for(uint i = 0; i < childCount; i++){
+            const Node& child = nodes[children[i]];
+            for(int a = 0; a < 3; a++){
+                node.bounds[a][i] = child.bounds.min[a];
+                node.bounds[3 + a][i] = child.bounds.max[a];
+            }
+            const float probability = rootArea > 0 ? child.bounds.getSurfaceArea() / rootArea : 1;
+            if(child.count > 0){
+                node.children[i] = child.leftFirst;
+                node.counts[i] = (uint8_t)child.count;
+                wideTraversalCost += probability * INTERSECTION_COST * child.count;
+                continue;
+            }
+            node.children[i] = (uint)wide.size();
+            pending.emplace_back(children[i], node.children[i]);
+            wide.emplace_back();
+        }
+        wide[index] = node;
+        wideTraversalCost += (rootArea > 0 ? nodes[binary].bounds.getSurfaceArea() / rootArea : 1) * TRAVERSAL_COST;
+    }
+    wide.shrink_to_fit();
+}
+
+template<uint W, typename Q>
+void BVH::compress() {
+    const uint levels = (1u << (8 * sizeof(Q))) - 1;
+    const float rootArea = rootBounds.getSurfaceArea();
+    auto probability = [rootArea](float area){return rootArea > 0 ? area / rootArea : 1;};
+    //Binary node and quantized node of every node still to fill, with the area of the decoded box its parent tests
+    struct Pending{
+        uint binary;
+        uint index;
+        float decodedArea;
+    };
+    std::vector<Pending> pending{{0u, 0u, rootArea}};
+    std::vector<QuantizedNode<W, Q>> compressed(1);
+    compressed.reserve(nodes.size() / 2 + 1);
+    quantizedIndices.reserve(indices.size());
+    while(!pending.empty()){
+        const Pending entry = pending.back();
+        pending.pop_back();
+        uint children[W];
+        const uint childCount = gatherChildren(entry.binary, W, children);
+        //The interior children come first so that their nodes are consecutive
+        std::stable_partition(children, children + childCount, [this](uint child){return nodes[child].count == 0;});
+        QuantizedNode<W, Q> node{};
+        node.childCount = (uint8_t)childCount;
+        //Frame of the node : its box, the smallest power of two scale whose last level reaches the max plane
+        const AABB& bounds = nodes[entry.binary].bounds;
+        float scales[3];
+        for(int a = 0; a < 3; a++){
+            node.origin[a] = bounds.min[a];
+            int exponent;
+            std::frexp((bounds.max[a] - bounds.min[a]) / levels, &exponent);
+            exponent = exponent < MIN_EXPONENT ? MIN_EXPONENT : exponent;
+            while(exponent < MAX_EXPONENT && node.origin[a] + (float)levels * powerOfTwo(exponent) < bounds.max[a]) exponent++;
+            node.exponents[a] = (int8_t)exponent;
+            scales[a] = powerOfTwo(exponent);
+        }
+        bool leafFound = false;
+        for(uint i = 0; i < childCount; i++){
+            const Node& child = nodes[children[i]];
+            //Levels rounded outwards, then moved until the decoded planes contain the child box
+            AABB decoded;
+            for(int a = 0; a < 3; a++){
+                auto decode = [&](uint level){return node.origin[a] + (float)level * scales[a];};
+                uint low = (uint)std::min(std::max(std::floor((child.bounds.min[a] - node.origin[a]) / scales[a]), 0.0f), (float)levels);
+                while(low > 0 && decode(low) > child.bounds.min[a]) low--;
+                uint high = (uint)std::min(std::max(std::ceil((child.bounds.max[a] - node.origin[a]) / scales[a]), 0.0f), (float)levels);
+                while(high < levels && decode(high) < child.bounds.max[a]) high++;
+                node.bounds[a][i] = (Q)low;
+                node.bounds[3 + a][i] = (Q)high;
+                decoded.min[a] = decode(low);
+                decoded.max[a] = decode(high);
+            }
+            if(child.count > 0){
+                if(!leafFound) node.firstGeometry = (uint)quantizedIndices.size();
+                leafFound = true;
+                node.counts[i] = (uint8_t)child.count;
+                quantizedIndices.insert(quantizedIndices.end(), indices.begin() + child.leftFirst, indices.begin() + child.leftFirst + child.count);
+                wideTraversalCost += probability(child.bounds.getSurfaceArea()) * INTERSECTION_COST * child.count;
+                quantizedTraversalCost += probability(decoded.getSurfaceArea()) * INTERSECTION_COST * child.count;
+                continue;
+            }
+            if(i == 0) node.firstChild = (uint)compressed.size();
+            pending.push_back(Pending{children[i], (uint)compressed.size(), decoded.getSurfaceArea()});
+            compressed.emplace_back();
+        }
+        compressed[entry.index] = node;
+        wideTraversalCost += probability(bounds.getSurfaceArea()) * TRAVERSAL_COST;
+        quantizedTraversalCost += probability(entry.decodedArea) * TRAVERSAL_COST;
+    }
+    quantizedNodeCount = (uint)compressed.size();
+    quantizedNodes.resize(compressed.size() * sizeof(QuantizedNode<W, Q>));
+    std::memcpy(quantizedNodes.data(), compressed.data(), quantizedNodes.size());
+    quantizedIndices.shrink_to_fit();
+}
+
+template<typename F>
+auto BVH::visitWideLayout(F visit) const -> decltype(visit((const WideNode<4>*)nullptr, (const uint*)nullptr)) {
+    if(quantization == 0){
+        if(width == 4) return visit(wideNodes4.data(), indices.data());
+        return visit(wideNodes8.data(), indices.data());
+    }
+    const uint8_t* bytes = quantizedNodes.data();
+    const uint* leafIndices = quantizedIndices.data();
+    if(quantization == 8){
+        if(width == 4) return visit(reinterpret_cast<const QuantizedNode<4, uint8_t>*>(bytes), leafIndices);
+        return visit(reinterpret_cast<const QuantizedNode<8, uint8_t>*>(bytes), leafIndices);
+    }
+    if(width == 4) return visit(reinterpret_cast<const QuantizedNode<4, uint16_t>*>(bytes), leafIndices);
+    return visit(reinterpret_cast<const QuantizedNode<8, uint16_t>*>(bytes), leafIndices);
+}
+
+template<uint W>
+uint BVH::childHits(const SimdKernels &kernels, const WideNode<W> &node, const float *origin, const float *inverseDirection, float tMin, float tMax, float *entries) {
+    return (W == 4 ? kernels.wideBox4 : kernels.wideBox8)(node.bounds[0], origin, inverseDirection, tMin, tMax, entries);
+}
+
+template<uint W>
+uint BVH::childHits(const SimdKernels &kernels, const QuantizedNode<W, uint8_t> &node, const float *origin, const float *inverseDirection, float tMin, float tMax, float *entries) {
+    float frame[6];
+    nodeFrame(node, frame);
+    return (W == 4 ? kernels.quantizedBox4x8 : kernels.quantizedBox8x8)(node.bounds[0], frame, origin, inverseDirection, tMin, tMax, entries);
+}
+
+template<uint W>
+uint BVH::childHits(const SimdKernels &kernels, const QuantizedNode<W, uint16_t> &node, const float *origin, const float *inverseDirection, float tMin, float tMax, float *entries) {
+    float frame[6];
+    nodeFrame(node, frame);
+    return (W == 4 ? kernels.quantizedBox4x16 : kernels.quantizedBox8x16)(node.bounds[0], frame, origin, inverseDirection, tMin, tMax, entries);
+}
+
+template<uint W, typename Q>
+void BVH::nodeFrame(const QuantizedNode<W, Q> &node, float *frame) {
+    for(int a = 0; a < 3; a++){
+        frame[a] = node.origin[a];
+        frame[3 + a] = powerOfTwo(node.exponents[a]);
+    }
+}
+
+template<uint W>
+const float* BVH::childBounds(const SimdKernels &kernels, const QuantizedNode<W, uint8_t> &node, float *decoded) {
+    float frame[6];
+    nodeFrame(node, frame);
+    kernels.decodeBounds8(node.bounds[0], frame, W, decoded);
+    return decoded;
+}
+
+template<uint W>
+const float* BVH::childBounds(const SimdKernels &kernels, const QuantizedNode<W, uint16_t> &node, float *decoded) {
+    float frame[6];
+    nodeFrame(node, frame);
+    kernels.decodeBounds16(node.bounds[0], frame, W, decoded);
+    return decoded;
+}
+
+template<uint W, typename Q>
+void BVH::childAt(const QuantizedNode<W, Q> &node, uint i, uint &child, uint &count) {
+    count = node.counts[i];
+    if(count == 0){
+        child = node.firstChild + i;
+        return;
+    }
+    //The interior children before the leaf have no geometries
+    child = node.firstGeometry;
+    for(uint j = 0; j < i; j++) child += node.counts[j];
+}
+
+template<typename N>
+bool BVH::intersectWide(const N* wide, const uint* leafIndices, const Ray &ray, float tMin, float tMax, HitRecord &hit) const {
+    const uint W = N::WIDTH;
+    const Eigen::Vector3f& origin = ray.getOrigin();
+    const Eigen::Vector3f inverseDirection = ray.getDirection().cwiseInverse();
+    float tEntry;
+    if(rootBounds.isEmpty() || !rootBounds.intersect(origin, inverseDirection, tMin, tMax, tEntry)) return false;
+    const SimdKernels& kernels = SimdKernels::get();
+    bool intersected = false;
+    //Every wide node pushes at most W - 1 more children than the binary traversal would
+    WideEntry stack[STACK_SIZE * (W - 1)];
+    uint stackSize = 0;
+    stack[stackSize++] = WideEntry{0, 0, 0, tEntry};
+    while(stackSize > 0){
+        const WideEntry entry = stack[--stackSize];
+        //The closest hit may have moved in front of the child since it was pushed
+        if(entry.entry > tMax) continue;
+        if(entry.count > 0){
+            for(uint i = entry.child; i < entry.child + entry.count; i++){
+                if(scene.intersect(leafIndices[i], ray, tMin, tMax, hit)){
+                    intersected = true;
+                    tMax = hit.t;
+                    hit.primitiveId = (int)leafIndices[i];
+                }
+            }
+            continue;
+        }
+        const N& node = wide[entry.child];
+        float entries[W];
+        uint hits = childHits(kernels, node, origin.data(), inverseDirection.data(), tMin, tMax, entries) & ((1u << node.childCount) - 1);
+        //The children hit are pushed from the farthest to the nearest, so that the nearest is visited first
+        const uint bottom = stackSize;
+        for(; hits != 0; hits &= hits - 1){
+            const uint i = lowestBit(hits);
+            WideEntry child{0, 0, 0, entries[i]};
+            childAt(node, i, child.child, child.count);
+            uint j = stackSize++;
+            for(; j > bottom && stack[j - 1].entry < child.entry; j--) stack[j] = stack[j - 1];
+            stack[j] = child;
+        }
+    }
+    return intersected;
+}
+
+template<typename N>
+bool BVH::occludedWide(const N* wide, const uint* leafIndices, const Ray &ray, float tMin, float tMax) const {
+    const uint W = N::WIDTH;
+    const Eigen::Vector3f& origin = ray.getOrigin();
+    const Eigen::Vector3f inverseDirection = ray.getDirection().cwiseInverse();
+    float tEntry;
+    if(rootBounds.isEmpty() || !rootBounds.intersect(origin, inverseDirection, tMin, tMax, tEntry)) return false;
+    const SimdKernels& kernels = SimdKernels::get();
+    WideEntry stack[STACK_SIZE * (W - 1)];
+    uint stackSize = 0;
+    stack[stackSize++] = WideEntry{0, 0, 0, tEntry};
+    while(stackSize > 0){
+        const WideEntry entry = stack[--stackSize];
+        if(entry.count > 0){
+            //Any hit ends the query, no hit record is filled
+            for(uint i = entry.child; i < entry.child + entry.count; i++){
+                if(scene.occludes(leafIndices[i], ray, tMin, tMax)) return true;
+            }
+            continue;
+        }
+        const N& node = wide[entry.child];
+        float entries[W];
+        uint hits = childHits(kernels, node, origin.data(), inverseDirection.data(), tMin, tMax, entries) & ((1u << node.childCount) - 1);
+        //Any order finds an occluder, the children are not sorted
+        for(; hits != 0; hits &= hits - 1){
+            const uint i = lowestBit(hits);
+            WideEntry& child = stack[stackSize++];
+            child.entry = entries[i];
+            childAt(node, i, child.child, child.count);
+        }
+    }
+    return false;
+}
+
+template<typename N>
+void BVH::intersectWide(const N* wide, const uint* leafIndices, RayPacket &packet, float tMin) const {
+    const uint W = N::WIDTH;
+    if(rootBounds.isEmpty() || packet.size == 0) return;
+    packet.pad();
+    const SimdKernels& kernels = SimdKernels::get();
+    const PacketInterval interval(packet);
+    float packetTMax = *std::max_element(packet.tMax, packet.tMax + packet.size);
+    if(interval.misses(rootBounds, tMin, packetTMax)) return;
+    const uint rootFirst = kernels.packetBox(packet, 0, rootBounds.min.data(), rootBounds.max.data(), tMin);
+    if(rootFirst >= packet.size) return;
+    WideEntry stack[STACK_SIZE * (W - 1)];
+    uint stackSize = 0;
+    stack[stackSize++] = WideEntry{0, 0, rootFirst, 0};
+    while(stackSize > 0){
+        const WideEntry entry = stack[--stackSize];
+        if(entry.count > 0){
+            intersectLeaf(packet, entry.first, leafIndices, entry.child, entry.count, tMin, false);
+            packetTMax = *std::max_element(packet.tMax, packet.tMax + packet.size);
+            continue;
+        }
+        const N& node = wide[entry.child];
+        alignas(32) float decoded[6 * W];
+        const float* bounds = childBounds(kernels, node, decoded);
+        //The children are ordered by the distance of their centroid along the first ray hitting the node, farthest pushed first
+        const Eigen::Vector3f origin(packet.ox[entry.first], packet.oy[entry.first], packet.oz[entry.first]);
+        const Eigen::Vector3f direction(packet.dx[entry.first], packet.dy[entry.first], packet.dz[entry.first]);
+        const uint bottom = stackSize;
+        for(uint i = 0; i < node.childCount; i++){
+            const AABB box(Eigen::Vector3f(bounds[i], bounds[W + i], bounds[2 * W + i]),
+                           Eigen::Vector3f(bounds[3 * W + i], bounds[4 * W + i], bounds[5 * W + i]));
+            if(interval.misses(box, tMin, packetTMax)) continue;
+            const uint first = kernels.packetBox(packet, entry.first, box.min.data(), box.max.data(), tMin);
+            if(first >= packet.size) continue;
+            WideEntry child{0, 0, first, (box.getCentroid() - origin).dot(direction)};
+            childAt(node, i, child.child, child.count);
+            uint j = stackSize++;
+            for(; j > bottom && stack[j - 1].entry < child.entry; j--) stack[j] = stack[j - 1];
+            stack[j] = child;
+        }
+    }
+}
+
+template<typename N>
+void BVH::occludedWide(const N* wide, const uint* leafIndices, RayPacket &packet, float tMin) const {
+    const uint W = N::WIDTH;
+    if(rootBounds.isEmpty() || packet.size == 0) return;
+    packet.pad();
+    const SimdKernels& kernels = SimdKernels::get();
+    const PacketInterval interval(packet);
+    float packetTMax = *std::max_element(packet.tMax, packet.tMax + packet.size);
+    if(interval.misses(rootBounds, tMin, packetTMax)) return;
+    const uint rootFirst = kernels.packetBox(packet, 0, rootBounds.min.data(), rootBounds.max.data(), tMin);
+    if(rootFirst >= packet.size) return;
+    uint remaining = packet.size;
+    WideEntry stack[STACK_SIZE * (W - 1)];
+    uint stackSize = 0;
+    stack[stackSize++] = WideEntry{0, 0, rootFirst, 0};
+    while(stackSize > 0 && remaining > 0){
+        const WideEntry entry = stack[--stackSize];
+        if(entry.count > 0){
+            intersectLeaf(packet, entry.first, leafIndices, entry.child, entry.count, tMin, true);
+            remaining -= retireOccluded(packet, entry.first, tMin);
+            packetTMax = *std::max_element(packet.tMax, packet.tMax + packet.size);
+            continue;
+        }
+        const N& node = wide[entry.child];
+        alignas(32) float decoded[6 * W];
+        const float* bounds = childBounds(kernels, node, decoded);
+        for(uint i = 0; i < node.childCount; i++){
+            const AABB box(Eigen::Vector3f(bounds[i], bounds[W + i], bounds[2 * W + i]),
+                           Eigen::Vector3f(bounds[3 * W + i], bounds[4 * W + i], bounds[5 * W + i]));
+            if(interval.misses(box, tMin, packetTMax)) continue;
+            const uint first = kernels.packetBox(packet, entry.first, box.min.data(), box.max.data(), tMin);
+            if(first >= packet.size) continue;
+            WideEntry& child = stack[stackSize++];
+            child.first = first;
+            childAt(node, i, child.child, child.count);
+        }
+    }
+}
@@ -0,0 +1,293 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+#include "AABB.h"
+#include "AccelerationStructure.h"
+#include "CompiledScene.h"
+#include "Ray.h"
+#include "RayPacket.h"
+#include "ThreadPool.h"
+
+//Strategy used to split the geometries of a node
+//MEDIAN --> cheapest build, splits at the median centroid of the widest axis
+//SAH --> binned surface area heuristic, slower build but cheaper traversal
+enum class BVHBuilder{MEDIAN, SAH};
+
+//Allocator of the wide BVH nodes, aligned to cache lines (std::allocator ignores over-alignment before C++17)
+template<typename T>
+struct CacheLineAllocator{
+    typedef T value_type;
+    static const size_t ALIGNMENT = 64;
+    CacheLineAllocator() = default;
+    template<typename U>
+    CacheLineAllocator(const CacheLineAllocator<U>&){}
+    T* allocate(size_t count){
+#ifdef _WIN32
+        void* pointer = _aligned_malloc(count * sizeof(T), ALIGNMENT);
+        if(pointer == nullptr) throw std::bad_alloc();
+#else
+        void* pointer = nullptr;
+        if(posix_memalign(&pointer, ALIGNMENT, count * sizeof(T)) != 0) throw std::bad_alloc();
+#endif
+        return static_cast<T*>(pointer);
+    }
+#ifdef _WIN32
+    void deallocate(T* pointer, size_t){_aligned_free(pointer);}
+#else
+    void deallocate(T* pointer, size_t){free(pointer);}
+#endif
+    template<typename U>
+    bool operator==(const CacheLineAllocator<U>&) const{return true;}
+    template<typename U>
+    bool operator!=(const CacheLineAllocator<U>&) const{return false;}
+};
+
+//Bounding volume hierarchy over the primitives of the compiled scene
+//Used when the output has speedup set to 1
+//The tree is always built binary; it can then be collapsed into nodes of 4 or 8 children (bvhwidth of the output)
+//whose child boxes are tested against a ray with one SIMD instruction, and whose child boxes can be quantized
+class BVH final : public AccelerationStructure{
+public:
+    //Maximum number of geometries stored in a leaf
+    static const uint MAX_LEAF_SIZE = 8;
+    //Leaf size of the median builder
+    static const uint MEDIAN_LEAF_SIZE = 2;
+    //Past this depth nodes are split at the median so that the traversal stack never overflows
+    static const uint MAX_DEPTH = 48;
+    //Nodes with more geometries than this are built as separate tasks of the thread pool
+    static const uint PARALLEL_BUILD_THRESHOLD = 4096;
+    //Size of the traversal stack, deeper than any tree the builders produce
+    static const uint STACK_SIZE = 128;
+    //Relative cost of one node traversal and one geometry intersection for the surface area heuristic
+    static constexpr float TRAVERSAL_COST = 1.0f;
+    static constexpr float INTERSECTION_COST = 2.0f;
+    //Children per node of the layouts the traversal can use
+    static const uint BINARY_WIDTH = 2;
+    static const uint MAX_WIDTH = 8;
+    //bins --> number of bins per axis used by the SAH builder
+    BVH(const CompiledScene& scene, ThreadPool& pool, BVHBuilder builder = BVHBuilder::SAH, uint bins = 16);
+    //Binary tree of another BVH copied instead of built again, to give it another layout with setWidth
+    //The binary nodes of tree must not have been released
+    explicit BVH(const BVH& tree);
+    //Tree read from the binary scene cache, nullptr when the cache is truncated or does not match the scene
+    static BVH* load(const CompiledScene& scene, ThreadPool& pool, CacheReader& reader);
+    //Builder settings and tree in the binary scene cache
+    void save(CacheWriter& writer) const;
+    //Closest hit along the ray with a distance in [tMin, tMax], the primitive id of the hit is the id in the compiled scene
+    bool intersect(const Ray& ray, float tMin, float tMax, HitRecord& hit) const override;
+    //Closest hit of every ray of the packet at a distance in [tMin, tMax of the ray], the rays share the traversal
+    //Fills the tMax and primitiveId arrays of the packet, the hit records are then filled with CompiledScene::intersect
+    void intersect(RayPacket& packet, float tMin) const override;
+    //Returns true as soon as one geometry is hit at a distance in [tMin, tMax]
+    bool occluded(const Ray& ray, float tMin, float tMax) const override;
+    //Occlusion of every ray of the packet in [tMin, tMax of the ray], the rays share the traversal
+    //The primitive id of an occluded ray is set to the occluder, the tMax of the occluded rays is not kept
+    void occluded(RayPacket& packet, float tMin) const override;
+    //Refits the bounds of the nodes to the current bounds of the primitives (animated instances), bottom up
+    //The subtrees whose expected cost grew past rebuildThreshold times their cost when they were built are then rebuilt,
+    //the whole tree when it is the root. Returns the number of rebuilt subtrees
+    //Must not run while rays traverse the tree
+    uint refit(float rebuildThreshold);
+    //Layout used by the traversal : 2 for the binary nodes, 4 or 8 to collapse them into wide nodes
+    //quantization --> 0 for float child boxes, 8 or 16 to store the child boxes of the wide nodes with that many bits per
+    //plane relative to the box of their node (ignored with the binary nodes)
+    //The binary nodes are kept, they are the ones refitted and written to the cache
+    void setWidth(uint width, uint quantization = 0);
+    uint getWidth() const{return width;}
+    uint getQuantization() const{return quantization;}
+    //Frees the binary nodes and the primitive bounds kept to refit them once the traversal uses the wide nodes
+    //The tree can then no longer be refitted, saved or given another width
+    void releaseBinaryNodes();
+    //Number and size in bytes of the nodes of the layout used by the traversal
+    uint getTraversalNodeCount() const;
+    size_t getTraversalNodeBytes() const;
+    //Expected cost of a ray with the wide nodes, a wide node counts as one traversal step whatever its number of children
+    float getWideTraversalCost() const{return wideTraversalCost;}
+    //Expected cost of a ray with the quantized wide nodes, higher than the wide cost as the decoded boxes are larger
+    float getQuantizedTraversalCost() const{return quantizedTraversalCost;}
+    uint getNodeCount() const{return (uint)nodes.size();}
+    uint getLeafCount() const{return leafCount;}
+    uint getDepth() const{return depth;}
+    //Wall clock time of the construction in seconds
+    double getBuildTime() const{return buildTime;}
+    //Expected cost of tracing a ray through the tree according to the surface area heuristic
+    float getTraversalCost() const{return traversalCost;}
+    static std::string builderName(BVHBuilder builder){return builder == BVHBuilder::SAH ? "sah" : "median";}
+    BVHBuilder getBuilder() const{return builder;}
+    uint getBinCount() const{return binCount;}
+private:
+    //Tree read from the cache by load, left without nodes when the cache is truncated
+    BVH(const CompiledScene& scene, ThreadPool& pool, CacheReader& reader);
+    //Interior node --> children at leftFirst and leftFirst + 1
+    //Leaf node --> count > 0 geometries starting at leftFirst in indices
+    struct Node{
+        AABB bounds;
+        uint leftFirst;
+        uint count;
+        void save(CacheWriter& writer) const{
+            bounds.save(writer);
+            writer.write(leftFirst);
+            writer.write(count);
+        }
+        bool load(CacheReader& reader){return bounds.load(reader) && reader.read(leftFirst) && reader.read(count);}
+    };
+    //Interval bounds of the origins and inverse directions of the rays of a packet
+    //Used to discard a node that no ray of the packet can hit with a single test (interval culling)
+    struct PacketInterval{
+        float originMin[3], originMax[3], inverseMin[3], inverseMax[3];
+        //False when the directions of the rays do not have the same sign on every axis
+        bool valid = true;
+        explicit PacketInterval(const RayPacket& packet);
+        //Returns true if no ray of the packet can hit the box in [tMin, tMax]
+        bool misses(const AABB& box, float tMin, float tMax) const;
+    };
+    //Node of the wide layout, one lane per child, the children are packed at the front and padded to whole cache lines
+    template<uint W>
+    struct alignas(64) WideNode{
+        static const uint WIDTH = W;
+        //Bounds of the children by axis : min x, min y, min z, max x, max y and max z (the layout of SimdKernels::wideBox)
+        float bounds[6][W];
+        //Interior child --> index of its wide node, leaf child --> first geometry in indices
+        uint children[W];
+        //Number of geometries of a leaf child, 0 for an interior child
+        uint8_t counts[W];
+        uint8_t childCount;
+    };
+    template<uint W>
+    using WideNodes = std::vector<WideNode<W>, CacheLineAllocator<WideNode<W>>>;
+    //Wide node whose child boxes are stored as Q integers : plane = origin + q * 2^exponent on its axis
+    //The power of two scale keeps q * 2^exponent exact, so a decoded box always contains the child box it was encoded from
+    //The interior children come first and are consecutive nodes from firstChild, the geometries of the leaf children
+    //are consecutive in quantizedIndices from firstGeometry
+    template<uint W, typename Q>
+    struct QuantizedNode{
+        static const uint WIDTH = W;
+        float origin[3];
+        int8_t exponents[3];
+        uint8_t childCount;
+        uint firstChild;
+        uint firstGeometry;
+        //Number of geometries of a leaf child, 0 for an interior child
+        uint8_t counts[W];
+        //Planes of the children in the order of WideNode::bounds
+        Q bounds[6][W];
+    };
+    //Child of a wide node waiting on a traversal stack (children and counts of WideNode) with the entry distance
+    //of the ray, or the first ray of a packet that hits it
+    struct WideEntry{
+        uint child;
+        uint count;
+        uint first;
+        float entry;
+    };
+    //Bounds and number of geometries whose centroid falls in a bin
+    struct Bin{
+        AABB bounds;
+        uint count = 0;
+    };
+    std::vector<Node> nodes;
+    //Primitive ids ordered so that every leaf references a contiguous range
+    std::vector<uint> indices;
+    const CompiledScene& scene;
+    std::vector<AABB> objectBounds;
+    std::vector<Eigen::Vector3f> centroids;
+    BVHBuilder builder;
+    uint binCount;
+    ThreadPool& pool;
+    //Nodes are allocated in pairs from the preallocated node array by the building tasks
+    std::atomic<uint> nodeCount{0};
+    uint leafCount = 0;
+    uint depth = 0;
+    double buildTime = 0;
+    float traversalCost = 0;
+    //Expected cost of every node for the bounds it was built with, filled by the first refit
+    std::vector<float> builtCosts;
+    //Nodes of the subtrees replaced by refit, no longer referenced by the tree
+    uint unusedNodes = 0;
+    uint width = BINARY_WIDTH;
+    uint quantization = 0;
+    WideNodes<4> wideNodes4;
+    WideNodes<8> wideNodes8;
+    //Quantized nodes of the width and quantization set, stored as bytes
+    std::vector<uint8_t, CacheLineAllocator<uint8_t>> quantizedNodes;
+    uint quantizedNodeCount = 0;
+    //Primitive ids ordered so that the leaf children of every quantized node reference a contiguous range
+    std::vector<uint> quantizedIndices;
+    //Bounds of the root, tested before the first wide node
+    AABB rootBounds;
+    float wideTraversalCost = 0;
+    float quantizedTraversalCost = 0;
+    void build(TaskGroup& group, uint nodeIndex, uint first, uint count, uint level);
+    //Bounds of the geometries and of their centroids in [first, first + count)
+    void computeBounds(uint first, uint count, AABB& bounds, AABB& centroidBounds);
+    //Finds the cheapest binned SAH split and its cost, returns false if the centroids cannot be separated
+    bool findSAHSplit(uint first, uint count, const AABB& bounds, const AABB& centroidBounds, int& axis, uint& splitBin, float& cost);
+    //Bin of a centroid along an axis
+    uint getBin(const Eigen::Vector3f& centroid, int axis, const AABB& centroidBounds) const;
+    //Number of chunks a range of geometries is split into, more than one only for large ranges
+    uint getChunkCount(uint count) const;
+    //Runs work(chunkFirst, chunkCount, chunk) on every chunk of [first, first + count) in parallel
+    void forEachChunk(uint first, uint count, uint chunks, const std::function<void(uint, uint, uint)>& work);
+    void computeStatistics();
+    //Surface area heuristic cost of the subtree of every node relative to the node, and the number of nodes of the subtree
+    //Children always come after their parent, so one pass from the last node computes them bottom up
+    void computeCosts(std::vector<float>& costs, std::vector<uint>* subtreeNodes = nullptr) const;
+    //Builds again the subtree of a node over the primitives [first, first + count) of indices, its nodes are appended
+    void rebuild(uint node, uint first, uint count, uint level);
+    //Binary nodes becoming the children of the wide node of a binary node : the children of the largest interior
+    //nodes below it are taken until there are maxChildren, returns their number
+    uint gatherChildren(uint binary, uint maxChildren, uint* children) const;
+    //Builds the wide nodes from the binary nodes
+    template<uint W>
+    void collapse(WideNodes<W>& wide);
+    //Builds the quantized nodes and their primitive ids from the binary nodes
+    template<uint W, typename Q>
+    void compress();
+    //Calls visit(nodes, leafIndices) with the wide or quantized nodes used by the traversal
+    template<typename F>
+    auto visitWideLayout(F visit) const -> decltype(visit((const WideNode<4>*)nullptr, (const uint*)nullptr));
+    //Mask of the children of a wide node hit by a ray in [tMin, tMax] and their entry distances, with the SIMD kernels
+    template<uint W>
+    static uint childHits(const SimdKernels& kernels, const WideNode<W>& node, const float* origin, const float* inverseDirection, float tMin, float tMax, float* entries);
+    template<uint W>
+    static uint childHits(const SimdKernels& kernels, const QuantizedNode<W, uint8_t>& node, const float* origin, const float* inverseDirection, float tMin, float tMax, float* entries);
+    template<uint W>
+    static uint childHits(const SimdKernels& kernels, const QuantizedNode<W, uint16_t>& node, const float* origin, const float* inverseDirection, float tMin, float tMax, float* entries);
+    //Frame of a quantized node for the kernels : origin then scale on x, y and z
+    template<uint W, typename Q>
+    static void nodeFrame(const QuantizedNode<W, Q>& node, float* frame);
+    //Boxes of the children of a wide node in the layout of WideNode::bounds, decoded to decoded for a quantized node
+    template<uint W>
+    static const float* childBounds(const SimdKernels&, const WideNode<W>& node, float*){return node.bounds[0];}
+    template<uint W>
+    static const float* childBounds(const SimdKernels& kernels, const QuantizedNode<W, uint8_t>& node, float* decoded);
+    template<uint W>
+    static const float* childBounds(const SimdKernels& kernels, const QuantizedNode<W, uint16_t>& node, float* decoded);
+    //Wide node or first geometry and number of geometries of a child
+    template<uint W>
+    static void childAt(const WideNode<W>& node, uint i, uint& child, uint& count){child = node.children[i]; count = node.counts[i];}
+    template<uint W, typename Q>
+    static void childAt(const QuantizedNode<W, Q>& node, uint i, uint& child, uint& count);
+    //Closest primitive hit and occlusion through the wide or quantized nodes N
+    template<typename N>
+    bool intersectWide(const N* wide, const uint* leafIndices, const Ray& ray, float tMin, float tMax, HitRecord& hit) const;
+    template<typename N>
+    bool occludedWide(const N* wide, const uint* leafIndices, const Ray& ray, float tMin, float tMax) const;
+    template<typename N>
+    void intersectWide(const N* wide, const uint* leafIndices, RayPacket& packet, float tMin) const;
+    template<typename N>
+    void occludedWide(const N* wide, const uint* leafIndices, RayPacket& packet, float tMin) const;
+    //Tests the primitives of a leaf against the rays of the packet from first, occluded --> any hit instead of the closest
+    void intersectLeaf(RayPacket& packet, uint first, const uint* leafIndices, uint leafFirst, uint leafCount, float tMin, bool occluded) const;
+    //Ends the rays of the packet from first that were just occluded, their tMax is set to -infinity, returns their number
+    static uint retireOccluded(RayPacket& packet, uint first, float tMin);
+    //Refit of the binary nodes, see refit
+    uint refitNodes(float rebuildThreshold);
+};
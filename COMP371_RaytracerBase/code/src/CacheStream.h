@@ -0,0 +1,91 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <type_traits>
+#include <vector>
+
+//Sequential writer of the binary scene cache, values are stored as their raw bytes in the byte order of the machine
+//Arrays are stored as their size followed by their elements
+//Only trivially copyable values are copied as raw bytes, structs holding Eigen vectors write their floats with save
+class CacheWriter{
+public:
+    explicit CacheWriter(std::ostream& stream): stream(stream){}
+    template<typename T>
+    void write(const T& value){
+        static_assert(std::is_trivially_copyable<T>::value, "only plain values can be cached");
+        stream.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+    template<typename T>
+    void writeArray(const std::vector<T>& array){
+        static_assert(std::is_trivially_copyable<T>::value, "only plain values can be cached");
+        write((uint64_t)array.size());
+        stream.write(reinterpret_cast<const char*>(array.data()), (std::streamsize)(array.size() * sizeof(T)));
+    }
+    void writeFloats(const float* values, size_t count){
+        stream.write(reinterpret_cast<const char*>(values), (std::streamsize)(count * sizeof(float)));
+    }
+    //Array of structs written one by one with their save(CacheWriter&) member
+    template<typename T>
+    void writeObjects(const std::vector<T>& array){
+        write((uint64_t)array.size());
+        for(const T& element : array) element.save(*this);
+    }
+    bool isGood() const{return stream.good();}
+private:
+    std::ostream& stream;
+};
+
+//Sequential reader of a binary scene cache mapped in memory, every read fails once the end of the data is passed
+class CacheReader{
+public:
+    CacheReader(const char* data, size_t size): data(data), size(size){}
+    template<typename T>
+    bool read(T& value){
+        static_assert(std::is_trivially_copyable<T>::value, "only plain values can be cached");
+        if(size - offset < sizeof(T)) return false;
+        std::memcpy(&value, data + offset, sizeof(T));
+        offset += sizeof(T);
+        return true;
+    }
+    //The elements are copied from the mapping in one block
+    template<typename T>
+    bool readArray(std::vector<T>& array){
+        static_assert(std::is_trivially_copyable<T>::value, "only plain values can be cached");
+        uint64_t count;
+        if(!read(count) || count > (size - offset) / sizeof(T)) return false;
+        array.resize((size_t)count);
+        std::memcpy(array.data(), data + offset, (size_t)count * sizeof(T));
+        offset += (size_t)count * sizeof(T);
+        return true;
+    }
+    bool readFloats(float* values, size_t count){
+        if((size - offset) / sizeof(float) < count) return false;
+        std::memcpy(values, data + offset, count * sizeof(float));
+        offset += count * sizeof(float);
+        return true;
+    }
+    //Array of structs read one by one with their load(CacheReader&) member, which returns false past the end of the data
+    template<typename T>
+    bool readObjects(std::vector<T>& array){
+        uint64_t count;
+        if(!read(count) || count > size - offset) return false;
+        array.resize((size_t)count);
+        for(T& element : array){
+            if(!element.load(*this)) return false;
+        }
+        return true;
+    }
+    //Data not read yet
+    const char* getPosition() const{return data + offset;}
+    size_t getRemaining() const{return size - offset;}
+    bool skip(size_t bytes){
+        if(size - offset < bytes) return false;
+        offset += bytes;
+        return true;
+    }
+private:
+    const char* data;
+    size_t size;
+    size_t offset = 0;
+};
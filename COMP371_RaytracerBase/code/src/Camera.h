@@ -0,0 +1,43 @@
+#pragma once
+#include <cmath>
+#include "Eigen/Core"
+#include "Eigen/Geometry"
+#include "Output.h"
+#include "Ray.h"
+
+//Pinhole camera of an output : maps pixels of the image plane to primary rays
+class Camera{
+private:
+    //Center of the camera
+    Eigen::Vector3f origin;
+    //Normalised up and right vector of the image plane
+    Eigen::Vector3f up, rightVec;
+    //Top left corner of the image plane
+    Eigen::Vector3f C;
+    //Size of a pixel on the image plane
+    float delta;
+public:
+    explicit Camera(Output& output){
+        const uint imgWidth = output.getSize()[0];
+        const uint imgHeight = output.getSize()[1];
+        origin = output.getCenter();
+        //Normalising lookAt, up and rightVec
+        const Eigen::Vector3f lookAt = output.getLookAt().normalized();
+        up = output.getUp().normalized();
+        rightVec = lookAt.cross(up).normalized();
+        const float PI = M_PI;
+        const float fov = output.getFOV() * PI/180;
+        const Eigen::Vector3f A = origin + lookAt;
+        const Eigen::Vector3f B = A + tan(fov/2) * up;
+        delta = 2 * tan(fov/2) / imgHeight;
+        C = B - ((imgWidth/2) * delta * rightVec);
+    }
+    const Eigen::Vector3f& getOrigin() const{return origin;}
+    //Ray going through the center of pixel (w, h)
+    Ray generateRay(uint w, uint h) const{return generateRay(w, h, 0.5f, 0.5f);}
+    //Ray going through the point (dx, dy) in [0, 1) x [0, 1) of pixel (w, h), (0, 0) is its top left corner
+    Ray generateRay(uint w, uint h, float dx, float dy) const{
+        Eigen::Vector3f pixel = C + (w * delta + dx * delta) * rightVec - (h * delta + dy * delta) * up;
+        return Ray(origin, pixel - origin);
+    }
+};
@@ -38,6 +38,15 @@ public:
         colorVector << colorVector.x(), colorVector.y(), blue;
     }
     void set(Color& color){colorVector << color.getRed(), color.getGreen(), color.getBlue();}
+    //Adds the color clamped to [0, 1] to an accumulation buffer of samples
+    void accumulate(std::vector<float>& buffer, int position) const{
+        for(int i = 0; i < 3; i++){
+            float value = colorVector[i];
+            if(value < 0) value = 0;
+            else if(value > 1) value = 1;
+            buffer[position + i] += value;
+        }
+    }
     void write(std::vector<double>& buffer, int position){
         if(colorVector.x() < 0){
             buffer[position] = 0;
@@ -0,0 +1,375 @@
+#include "CompiledScene.h"
+#include <algorithm>
+#include <map>
+#include <string>
+#include "BVH.h"
+
+bool Material::operator<(const Material &other) const {
+    const float first[13] = {ka, kd, ks, pc, ac.x(), ac.y(), ac.z(), dc.x(), dc.y(), dc.z(), sc.x(), sc.y(), sc.z()};
+    const float second[13] = {other.ka, other.kd, other.ks, other.pc, other.ac.x(), other.ac.y(), other.ac.z(),
+                              other.dc.x(), other.dc.y(), other.dc.z(), other.sc.x(), other.sc.y(), other.sc.z()};
+    return std::lexicographical_compare(first, first + 13, second, second + 13);
+}
+
+CompiledScene::CompiledScene(std::vector<Geometry *> &objects) {
+    //Shape of every object, the transformed geometries of the same shape are instances of the same object like in the SceneLoader
+    std::map<std::string, uint> objectIndices;
+    for(auto* geometry : objects){
+        if(geometry->getType() != Type::SPHERE && geometry->getType() != Type::RECTANGLE) continue;
+        Material material{geometry->getKa(), geometry->getKd(), geometry->getKs(), geometry->getPc(),
+                          geometry->getAc(), geometry->getDc(), geometry->getSc()};
+        //A transformed geometry is the single primitive of an object placed by an instance
+        CompiledScene* target = this;
+        std::unique_ptr<CompiledScene> object;
+        if(geometry->hasTransform()){
+            std::string key(1, (char)geometry->getType());
+            const auto appendToKey = [&key](const Eigen::Vector3f& values){key.append(reinterpret_cast<const char*>(values.data()), 3 * sizeof(float));};
+            if(geometry->getType() == Type::SPHERE){
+                auto* sphere = static_cast<Sphere*>(geometry);
+                const float radius = sphere->getRadius();
+                appendToKey(sphere->getCenter());
+                key.append(reinterpret_cast<const char*>(&radius), sizeof(float));
+            }
+            else{
+                auto* rectangle = static_cast<Rectangle*>(geometry);
+                for(const Eigen::Vector3f* corner : {&rectangle->getP1(), &rectangle->getP2(), &rectangle->getP3(), &rectangle->getP4()}) appendToKey(*corner);
+            }
+            auto entry = objectIndices.find(key);
+            if(entry != objectIndices.end()){
+                addInstance(entry->second, geometry->getTransform(), material);
+                continue;
+            }
+            object.reset(new CompiledScene());
+            target = object.get();
+            objectIndices[key] = getObjectCount();
+        }
+        if(geometry->getType() == Type::SPHERE){
+            auto* sphere = static_cast<Sphere*>(geometry);
+            target->addSphere(sphere->getCenter(), sphere->getRadius(), material);
+        }
+        else target->addQuad(*static_cast<Rectangle*>(geometry), material);
+        if(object) addInstance(addObject(std::move(object)), geometry->getTransform(), material);
+    }
+}
+
+void CompiledScene::addSphere(const Eigen::Vector3f &center, float radius, const Material &material) {
+    sphereCenters.push_back(center);
+    sphereRadii.push_back(radius);
+    sphereMaterials.push_back(getMaterialTableIndex(material));
+}
+
+void CompiledScene::addQuad(Rectangle &rectangle, const Material &material) {
+    quadCorners.push_back(rectangle.getP1());
+    quadPlaneNormals.push_back(rectangle.getPlaneNormal());
+    quadUnitNormals.push_back(rectangle.getNormal());
+    quadDu1.push_back(rectangle.getDu1());
+    quadDv1.push_back(rectangle.getDv1());
+    quadDu2.push_back(rectangle.getDu2());
+    quadDv2.push_back(rectangle.getDv2());
+    quadIsParallelogram.push_back(rectangle.getIsParallelogram() ? 1.0f : 0.0f);
+    quadBounds.push_back(rectangle.getBounds());
+    quadMaterials.push_back(getMaterialTableIndex(material));
+}
+
+void CompiledScene::addMesh(const Vector3Array &vertices, const std::vector<uint> &indices, const Material &material) {
+    //The indices of the mesh are shifted past the vertices of the previous meshes
+    const uint firstVertex = (uint)meshVertices.size();
+    meshFirstTriangles.push_back(getTriangleCount());
+    meshMaterials.push_back(getMaterialTableIndex(material));
+    meshVertices.x.insert(meshVertices.x.end(), vertices.x.begin(), vertices.x.end());
+    meshVertices.y.insert(meshVertices.y.end(), vertices.y.begin(), vertices.y.end());
+    meshVertices.z.insert(meshVertices.z.end(), vertices.z.begin(), vertices.z.end());
+    triangleIndices.reserve(triangleIndices.size() + indices.size());
+    for(uint index : indices) triangleIndices.push_back(firstVertex + index);
+}
+
+uint CompiledScene::addObject(std::unique_ptr<CompiledScene> object) {
+    AABB bounds;
+    for(uint i = 0; i < object->getPrimitiveCount(); i++) bounds.expand(object->getBounds(i));
+    objects.push_back(std::move(object));
+    objectBounds.push_back(bounds);
+    objectBVHs.push_back(nullptr);
+    return (uint)objects.size() - 1;
+}
+
+void CompiledScene::addInstance(uint object, const Eigen::Matrix4f &transform, const Material &material) {
+    instanceObjects.push_back(object);
+    instanceMaterials.push_back(getMaterialTableIndex(material));
+    instanceToWorld.emplace_back();
+    worldToInstance.emplace_back();
+    instanceBounds.emplace_back();
+    setInstanceTransform(getInstanceCount() - 1, transform);
+}
+
+void CompiledScene::setInstanceTransform(uint instance, const Eigen::Matrix4f &transform) {
+    const AffineTransform toWorld = AffineTransform::fromMatrix(transform);
+    Eigen::Matrix4f affine = transform;
+    affine.row(3) << 0, 0, 0, 1;
+    instanceToWorld[instance] = toWorld;
+    worldToInstance[instance] = AffineTransform::fromMatrix(affine.inverse());
+    //World bounds of the 8 corners of the bounds of the object
+    const AABB& local = objectBounds[instanceObjects[instance]];
+    AABB bounds;
+    for(int corner = 0; corner < 8; corner++){
+        bounds.expand(toWorld.transformPoint(corner & 1 ? local.max.x() : local.min.x(), corner & 2 ? local.max.y() : local.min.y(),
+                                             corner & 4 ? local.max.z() : local.min.z()));
+    }
+    instanceBounds[instance] = bounds;
+}
+
+void CompiledScene::animateInstance(uint instance, const std::vector<TransformKeyframe> &instanceKeyframes) {
+    animatedInstances.push_back(instance);
+    animationBases.push_back(instanceToWorld[instance]);
+    keyframes.insert(keyframes.end(), instanceKeyframes.begin(), instanceKeyframes.end());
+    animationKeyframeOffsets.push_back((uint)keyframes.size());
+    const uint animation = getAnimatedInstanceCount() - 1;
+    setInstanceTransform(instance, TransformKeyframe::evaluate(instanceKeyframes.data(), instanceKeyframes.size(), 0)
+                                   * animationBases[animation].toMatrix());
+}
+
+void CompiledScene::setFrame(float frame) {
+    for(uint i = 0; i < getAnimatedInstanceCount(); i++){
+        const TransformKeyframe* first = keyframes.data() + animationKeyframeOffsets[i];
+        const size_t count = animationKeyframeOffsets[i + 1] - animationKeyframeOffsets[i];
+        setInstanceTransform(animatedInstances[i], TransformKeyframe::evaluate(first, count, frame) * animationBases[i].toMatrix());
+    }
+}
+
+uint CompiledScene::getMaterialTableIndex(const Material &material) {
+    auto entry = materialTable.insert(std::make_pair(material, (uint)materials.size()));
+    if(entry.second) materials.push_back(material);
+    return entry.first->second;
+}
+
+void CompiledScene::save(CacheWriter &writer) const {
+    sphereCenters.save(writer);
+    writer.writeArray(sphereRadii);
+    for(const Vector3Array* array : {&quadCorners, &quadPlaneNormals, &quadUnitNormals, &quadDu1, &quadDv1, &quadDu2, &quadDv2}) array->save(writer);
+    writer.writeArray(quadIsParallelogram);
+    writer.writeObjects(quadBounds);
+    writer.writeArray(sphereMaterials);
+    writer.writeArray(quadMaterials);
+    writer.writeObjects(materials);
+    meshVertices.save(writer);
+    writer.writeArray(triangleIndices);
+    writer.writeArray(meshFirstTriangles);
+    writer.writeArray(meshMaterials);
+    writer.write((uint64_t)objects.size());
+    for(const auto& object : objects) object->save(writer);
+    writer.writeObjects(objectBounds);
+    writer.writeArray(instanceObjects);
+    writer.writeArray(instanceMaterials);
+    writer.writeArray(instanceToWorld);
+    writer.writeArray(worldToInstance);
+    writer.writeObjects(instanceBounds);
+    writer.writeArray(animatedInstances);
+    writer.writeArray(animationBases);
+    writer.writeArray(animationKeyframeOffsets);
+    writer.writeObjects(keyframes);
+}
+
+bool CompiledScene::load(CacheReader &reader) {
+    if(!sphereCenters.load(reader) || !reader.readArray(sphereRadii)) return false;
+    for(Vector3Array* array : {&quadCorners, &quadPlaneNormals, &quadUnitNormals, &quadDu1, &quadDv1, &quadDu2, &quadDv2}){
+        if(!array->load(reader)) return false;
+    }
+    if(!reader.readArray(quadIsParallelogram) || !reader.readObjects(quadBounds) || !reader.readArray(sphereMaterials)
+       || !reader.readArray(quadMaterials) || !reader.readObjects(materials) || !meshVertices.load(reader)
+       || !reader.readArray(triangleIndices) || !reader.readArray(meshFirstTriangles) || !reader.readArray(meshMaterials)) return false;
+    uint64_t objectCount;
+    if(!reader.read(objectCount) || objectCount > reader.getRemaining()) return false;
+    for(uint64_t i = 0; i < objectCount; i++){
+        objects.emplace_back(new CompiledScene());
+        if(!objects.back()->load(reader) || objects.back()->getObjectCount() > 0) return false;
+    }
+    objectBVHs.assign(objects.size(), nullptr);
+    if(!reader.readObjects(objectBounds) || !reader.readArray(instanceObjects) || !reader.readArray(instanceMaterials)
+       || !reader.readArray(instanceToWorld) || !reader.readArray(worldToInstance) || !reader.readObjects(instanceBounds)
+       || !reader.readArray(animatedInstances) || !reader.readArray(animationBases) || !reader.readArray(animationKeyframeOffsets)
+       || !reader.readObjects(keyframes)) return false;
+    //The instances must reference the objects of the cache, and the animations their instances and keyframes
+    for(uint object : instanceObjects){
+        if(object >= objects.size()) return false;
+    }
+    for(uint instance : animatedInstances){
+        if(instance >= instanceObjects.size()) return false;
+    }
+    if(animationBases.size() != animatedInstances.size() || animationKeyframeOffsets.size() != animatedInstances.size() + 1
+       || animationKeyframeOffsets[0] != 0 || animationKeyframeOffsets.back() != keyframes.size()) return false;
+    for(uint i = 0; i < animatedInstances.size(); i++){
+        if(animationKeyframeOffsets[i + 1] <= animationKeyframeOffsets[i]) return false;
+    }
+    return objectBounds.size() == objects.size() && instanceMaterials.size() == instanceObjects.size()
+           && instanceToWorld.size() == instanceObjects.size() && worldToInstance.size() == instanceObjects.size()
+           && instanceBounds.size() == instanceObjects.size();
+}
+
+AABB CompiledScene::getBounds(uint primitive) const {
+    if(primitive < getSphereCount()){
+        Eigen::Vector3f extent = Eigen::Vector3f::Constant(std::abs(sphereRadii[primitive]));
+        return AABB(sphereCenters[primitive] - extent, sphereCenters[primitive] + extent);
+    }
+    if(primitive < getFirstTriangle()) return quadBounds[primitive - getSphereCount()];
+    if(primitive >= getFirstInstance()) return instanceBounds[primitive - getFirstInstance()];
+    const uint* indices = &triangleIndices[3 * (primitive - getFirstTriangle())];
+    AABB bounds(meshVertices[indices[0]], meshVertices[indices[0]]);
+    bounds.expand(meshVertices[indices[1]]);
+    bounds.expand(meshVertices[indices[2]]);
+    return bounds;
+}
+
+AABB CompiledScene::getSceneBounds() const {
+    AABB bounds;
+    for(uint i = 0; i < getPrimitiveCount(); i++) bounds.expand(getBounds(i));
+    return bounds;
+}
+
+SphereArrays CompiledScene::getSphereArrays() const {
+    return {sphereCenters.x.data(), sphereCenters.y.data(), sphereCenters.z.data(), sphereRadii.data(), getSphereCount()};
+}
+
+QuadArrays CompiledScene::getQuadArrays() const {
+    return {quadCorners.x.data(), quadCorners.y.data(), quadCorners.z.data(),
+            quadPlaneNormals.x.data(), quadPlaneNormals.y.data(), quadPlaneNormals.z.data(),
+            quadDu1.x.data(), quadDu1.y.data(), quadDu1.z.data(), quadDv1.x.data(), quadDv1.y.data(), quadDv1.z.data(),
+            quadDu2.x.data(), quadDu2.y.data(), quadDu2.z.data(), quadDv2.x.data(), quadDv2.y.data(), quadDv2.z.data(),
+            quadIsParallelogram.data(), getQuadCount()};
+}
+
+TriangleArrays CompiledScene::getTriangleArrays() const {
+    return {meshVertices.x.data(), meshVertices.y.data(), meshVertices.z.data(), triangleIndices.data(), getTriangleCount()};
+}
+
+bool CompiledScene::closestHit(const Ray &ray, float tMin, float tMax, HitRecord &hit) const {
+    const SimdKernels& kernels = SimdKernels::get();
+    const RayData rayData{ray.getOrigin().data(), ray.getDirection().data()};
+    //The kernels only find the closest primitive, its hit record is then filled by the scalar test
+    //tMax shrinks to the closest hit so far
+    const float tLimit = tMax;
+    const int sphere = kernels.closestSphere(getSphereArrays(), rayData, tMin, tMax);
+    const int quad = kernels.closestQuad(getQuadArrays(), rayData, tMin, tMax);
+    //The triangles are tested one at a time, brute force is only meant for small scenes
+    int triangle = -1;
+    float t, u, v;
+    for(uint i = 0; i < getTriangleCount(); i++){
+        if(triangleDistance(i, ray, tMin, tMax, t, u, v)){
+            triangle = (int)i;
+            tMax = t;
+        }
+    }
+    //The instances are traced through their own BVH
+    int instance = -1;
+    HitRecord instanceHit;
+    for(uint i = 0; i < getInstanceCount(); i++){
+        HitRecord candidate;
+        if(intersectInstance(i, ray, tMin, tMax, candidate)){
+            instance = (int)i;
+            instanceHit = candidate;
+            tMax = candidate.t;
+        }
+    }
+    if(instance >= 0){
+        hit = instanceHit;
+        hit.primitiveId = (int)getFirstInstance() + instance;
+        return true;
+    }
+    if(triangle >= 0 && intersectTriangle((uint)triangle, ray, tMin, tLimit, hit)){
+        hit.primitiveId = (int)getFirstTriangle() + triangle;
+        return true;
+    }
+    if(quad >= 0 && intersectQuad((uint)quad, ray, tMin, tLimit, hit)){
+        hit.primitiveId = (int)getSphereCount() + quad;
+        return true;
+    }
+    if(sphere >= 0 && intersectSphere((uint)sphere, ray, tMin, tLimit, hit)){
+        hit.primitiveId = sphere;
+        return true;
+    }
+    return false;
+}
+
+bool CompiledScene::occluded(const Ray &ray, float tMin, float tMax) const {
+    const SimdKernels& kernels = SimdKernels::get();
+    const RayData rayData{ray.getOrigin().data(), ray.getDirection().data()};
+    if(kernels.anySphere(getSphereArrays(), rayData, tMin, tMax) || kernels.anyQuad(getQuadArrays(), rayData, tMin, tMax)) return true;
+    float t, u, v;
+    for(uint i = 0; i < getTriangleCount(); i++){
+        if(triangleDistance(i, ray, tMin, tMax, t, u, v)) return true;
+    }
+    for(uint i = 0; i < getInstanceCount(); i++){
+        if(instanceOccludes(i, ray, tMin, tMax)) return true;
+    }
+    return false;
+}
+
+Ray CompiledScene::toObject(uint instance, const float *origin, const float *direction) const {
+    const AffineTransform& transform = worldToInstance[instance];
+    return Ray(transform.transformPoint(origin[0], origin[1], origin[2]), transform.transformVector(direction[0], direction[1], direction[2]));
+}
+
+bool CompiledScene::intersectInstance(uint instance, const Ray &ray, float tMin, float tMax, HitRecord &hit) const {
+    //The direction keeps the scale of the transform, so the distances along the ray are the same in both spaces
+    const Ray objectRay = toObject(instance, ray.getOrigin().data(), ray.getDirection().data());
+    const uint object = instanceObjects[instance];
+    const BVH* bvh = objectBVHs[object];
+    if(!(bvh != nullptr ? bvh->intersect(objectRay, tMin, tMax, hit) : objects[object]->closestHit(objectRay, tMin, tMax, hit))) return false;
+    hit.normal = worldToInstance[instance].transformTransposed(hit.normal).normalized();
+    return true;
+}
+
+bool CompiledScene::instanceOccludes(uint instance, const Ray &ray, float tMin, float tMax) const {
+    const Ray objectRay = toObject(instance, ray.getOrigin().data(), ray.getDirection().data());
+    const uint object = instanceObjects[instance];
+    const BVH* bvh = objectBVHs[object];
+    return bvh != nullptr ? bvh->occluded(objectRay, tMin, tMax) : objects[object]->occluded(objectRay, tMin, tMax);
+}
+
+void CompiledScene::intersectInstance(RayPacket &packet, uint first, uint instance, float tMin) const {
+    const uint object = instanceObjects[instance];
+    const BVH* bvh = objectBVHs[object];
+    const int primitiveId = (int)(getFirstInstance() + instance);
+    RayPacket objectPacket;
+    for(uint i = first; i < packet.size; i++){
+        const float origin[3] = {packet.ox[i], packet.oy[i], packet.oz[i]};
+        const float direction[3] = {packet.dx[i], packet.dy[i], packet.dz[i]};
+        const Ray objectRay = toObject(instance, origin, direction);
+        if(bvh == nullptr){
+            HitRecord hit;
+            if(objects[object]->closestHit(objectRay, tMin, packet.tMax[i], hit)){
+                packet.tMax[i] = hit.t;
+                packet.primitiveId[i] = primitiveId;
+            }
+            continue;
+        }
+        objectPacket.setRay(objectPacket.size++, objectRay.getOrigin().data(), objectRay.getDirection().data(), packet.tMax[i]);
+    }
+    if(objectPacket.size == 0) return;
+    bvh->intersect(objectPacket, tMin);
+    for(uint i = 0; i < objectPacket.size; i++){
+        if(objectPacket.primitiveId[i] < 0) continue;
+        packet.tMax[first + i] = objectPacket.tMax[i];
+        packet.primitiveId[first + i] = primitiveId;
+    }
+}
+
+void CompiledScene::instanceOccludes(RayPacket &packet, uint first, uint instance, float tMin) const {
+    const uint object = instanceObjects[instance];
+    const BVH* bvh = objectBVHs[object];
+    const int primitiveId = (int)(getFirstInstance() + instance);
+    RayPacket objectPacket;
+    for(uint i = first; i < packet.size; i++){
+        const float origin[3] = {packet.ox[i], packet.oy[i], packet.oz[i]};
+        const float direction[3] = {packet.dx[i], packet.dy[i], packet.dz[i]};
+        const Ray objectRay = toObject(instance, origin, direction);
+        if(bvh == nullptr){
+            if(objects[object]->occluded(objectRay, tMin, packet.tMax[i])) packet.primitiveId[i] = primitiveId;
+            continue;
+        }
+        objectPacket.setRay(objectPacket.size++, objectRay.getOrigin().data(), objectRay.getDirection().data(), packet.tMax[i]);
+    }
+    if(objectPacket.size == 0) return;
+    bvh->occluded(objectPacket, tMin);
+    for(uint i = 0; i < objectPacket.size; i++){
+        if(objectPacket.primitiveId[i] >= 0) packet.primitiveId[first + i] = primitiveId;
+    }
+}
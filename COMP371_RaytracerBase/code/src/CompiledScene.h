@@ -0,0 +1,349 @@
+#pragma once
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <memory>
+#include <vector>
+#include "Eigen/Core"
+#include "AABB.h"
+#include "Animation.h"
+#include "CacheStream.h"
+#include "Geometry.h"
+#include "HitRecord.h"
+#include "Ray.h"
+#include "SimdKernels.h"
+
+//Surface parameters of a primitive, stored once per distinct material in the material table
+struct Material{
+    //Ambient, diffuse and specular reflection coefficient
+    float ka, kd, ks;
+    //Phong coefficient
+    float pc;
+    //Ambient, diffuse and specular reflection color
+    Eigen::Vector3f ac, dc, sc;
+    bool operator < (const Material& other) const;
+    void save(CacheWriter& writer) const{
+        writer.write(ka);
+        writer.write(kd);
+        writer.write(ks);
+        writer.write(pc);
+        for(const Eigen::Vector3f* color : {&ac, &dc, &sc}) writer.writeFloats(color->data(), 3);
+    }
+    bool load(CacheReader& reader){
+        return reader.read(ka) && reader.read(kd) && reader.read(ks) && reader.read(pc)
+               && reader.readFloats(ac.data(), 3) && reader.readFloats(dc.data(), 3) && reader.readFloats(sc.data(), 3);
+    }
+};
+
+//Structure of arrays holding the x, y and z components of a list of vectors
+struct Vector3Array{
+    std::vector<float> x, y, z;
+    void push_back(const Eigen::Vector3f& vector){
+        x.push_back(vector.x());
+        y.push_back(vector.y());
+        z.push_back(vector.z());
+    }
+    Eigen::Vector3f operator[](size_t i) const{return {x[i], y[i], z[i]};}
+    size_t size() const{return x.size();}
+    void save(CacheWriter& writer) const{
+        writer.writeArray(x);
+        writer.writeArray(y);
+        writer.writeArray(z);
+    }
+    bool load(CacheReader& reader){return reader.readArray(x) && reader.readArray(y) && reader.readArray(z);}
+};
+
+//Affine transform stored as the first three rows of its 4x4 matrix
+//The products are written out so that the packet and the scalar tests transform the rays with the same arithmetic
+struct AffineTransform{
+    float m[3][4];
+    static AffineTransform fromMatrix(const Eigen::Matrix4f& matrix){
+        AffineTransform transform{};
+        for(int row = 0; row < 3; row++){
+            for(int column = 0; column < 4; column++) transform.m[row][column] = matrix(row, column);
+        }
+        return transform;
+    }
+    Eigen::Matrix4f toMatrix() const{
+        Eigen::Matrix4f matrix = Eigen::Matrix4f::Identity();
+        for(int row = 0; row < 3; row++){
+            for(int column = 0; column < 4; column++) matrix(row, column) = m[row][column];
+        }
+        return matrix;
+    }
+    //m * (x, y, z, 1)
+    Eigen::Vector3f transformPoint(float x, float y, float z) const{
+        return {m[0][0] * x + m[0][1] * y + m[0][2] * z + m[0][3],
+                m[1][0] * x + m[1][1] * y + m[1][2] * z + m[1][3],
+                m[2][0] * x + m[2][1] * y + m[2][2] * z + m[2][3]};
+    }
+    //m * (x, y, z, 0)
+    Eigen::Vector3f transformVector(float x, float y, float z) const{
+        return {m[0][0] * x + m[0][1] * y + m[0][2] * z,
+                m[1][0] * x + m[1][1] * y + m[1][2] * z,
+                m[2][0] * x + m[2][1] * y + m[2][2] * z};
+    }
+    //Transpose of the 3x3 part times the vector, the normals are transformed by the transpose of the inverse transform
+    Eigen::Vector3f transformTransposed(const Eigen::Vector3f& vector) const{
+        return {m[0][0] * vector.x() + m[1][0] * vector.y() + m[2][0] * vector.z(),
+                m[0][1] * vector.x() + m[1][1] * vector.y() + m[2][1] * vector.z(),
+                m[0][2] * vector.x() + m[1][2] * vector.y() + m[2][2] * vector.z()};
+    }
+};
+
+class BVH;
+
+//Geometry of the scene compiled into contiguous arrays per primitive type, built once after parsing
+//or filled one primitive at a time by the streaming scene loader
+//Primitive ids --> spheres first, then rectangles (quads), then the triangles of the meshes, then the instances
+//The intersection loops stream through these arrays without virtual calls or casts
+//Instances (two level instancing) --> a transform and a material applied to an object, the objects are compiled scenes
+//of their own with their own BVH (bottom level), shared by all their instances; the BVH of this scene is the top level
+//A thousand copies of a mesh cost a thousand transforms, the mesh is stored and its BVH built once
+class CompiledScene{
+public:
+    CompiledScene() = default;
+    explicit CompiledScene(std::vector<Geometry*>& objects);
+    //Appends one primitive, identical materials are stored once
+    void addSphere(const Eigen::Vector3f& center, float radius, const Material& material);
+    void addQuad(Rectangle& rectangle, const Material& material);
+    //Appends the triangles of a mesh, three indices per triangle in its own vertices, with one material for the whole mesh
+    void addMesh(const Vector3Array& vertices, const std::vector<uint>& indices, const Material& material);
+    //Adds an object for the instances, the object must not have instances itself. Returns its index
+    uint addObject(std::unique_ptr<CompiledScene> object);
+    //Places an object in the scene, transform maps the object to the world and must be invertible
+    //The material replaces the ones of the primitives of the object
+    void addInstance(uint object, const Eigen::Matrix4f& transform, const Material& material);
+    //Moves an instance with keyframes applied after its transform, the instance is placed at frame 0
+    void animateInstance(uint instance, const std::vector<TransformKeyframe>& instanceKeyframes);
+    //Places the animated instances at a frame, the BVHs of the scene must then be refit
+    void setFrame(float frame);
+    uint getAnimatedInstanceCount() const{return (uint)animatedInstances.size();}
+    //Bottom level BVH of an object, without one the instances of the object test all its primitives
+    void setObjectBVH(uint object, const BVH* bvh){objectBVHs[object] = bvh;}
+    uint getObjectCount() const{return (uint)objects.size();}
+    const CompiledScene& getObject(uint object) const{return *objects[object];}
+    //Arrays of the compiled scene in the binary scene cache
+    void save(CacheWriter& writer) const;
+    //Returns false when the cache is truncated, primitives can not be added to a loaded scene
+    bool load(CacheReader& reader);
+    uint getPrimitiveCount() const{return getFirstInstance() + getInstanceCount();}
+    uint getSphereCount() const{return (uint)sphereRadii.size();}
+    uint getQuadCount() const{return (uint)quadCorners.size();}
+    uint getTriangleCount() const{return (uint)(triangleIndices.size() / 3);}
+    uint getMeshCount() const{return (uint)meshMaterials.size();}
+    //Id of the first triangle, after the spheres and quads
+    uint getFirstTriangle() const{return getSphereCount() + getQuadCount();}
+    uint getInstanceCount() const{return (uint)instanceObjects.size();}
+    uint getFirstInstance() const{return getFirstTriangle() + getTriangleCount();}
+    uint getMaterialCount() const{return (uint)materials.size();}
+    const Material& getMaterial(uint primitive) const{return materials[getMaterialIndex(primitive)];}
+    uint getMaterialIndex(uint primitive) const{
+        if(primitive < getSphereCount()) return sphereMaterials[primitive];
+        if(primitive < getFirstTriangle()) return quadMaterials[primitive - getSphereCount()];
+        if(primitive >= getFirstInstance()) return instanceMaterials[primitive - getFirstInstance()];
+        //Mesh holding the triangle, the meshes are few so that the triangles do not store their material
+        const uint triangle = primitive - getFirstTriangle();
+        return meshMaterials[std::upper_bound(meshFirstTriangles.begin(), meshFirstTriangles.end(), triangle) - meshFirstTriangles.begin() - 1];
+    }
+    AABB getBounds(uint primitive) const;
+    //Bounds of all the primitives, one pass over them
+    AABB getSceneBounds() const;
+    //Tests one primitive, fills hit (except its primitive id) when it is hit at a distance in [tMin, tMax]
+    bool intersect(uint primitive, const Ray& ray, float tMin, float tMax, HitRecord& hit) const{
+        if(primitive < getSphereCount()) return intersectSphere(primitive, ray, tMin, tMax, hit);
+        if(primitive < getFirstTriangle()) return intersectQuad(primitive - getSphereCount(), ray, tMin, tMax, hit);
+        if(primitive < getFirstInstance()) return intersectTriangle(primitive - getFirstTriangle(), ray, tMin, tMax, hit);
+        return intersectInstance(primitive - getFirstInstance(), ray, tMin, tMax, hit);
+    }
+    //Hit record of the primitive a packet traversal found closest at distance t, hit.primitiveId is set to the primitive
+    //An instance is searched without the bound t, the box tests of its object BVH can round the entry distance past t
+    bool fillPacketHit(int primitive, const Ray& ray, float tMin, float t, HitRecord& hit) const{
+        if(primitive < 0) return false;
+        const float tMax = (uint)primitive < getFirstInstance() ? t : std::numeric_limits<float>::infinity();
+        if(!intersect((uint)primitive, ray, tMin, tMax, hit)) return false;
+        hit.primitiveId = primitive;
+        return true;
+    }
+    bool intersectSphere(uint sphere, const Ray& ray, float tMin, float tMax, HitRecord& hit) const;
+    bool intersectQuad(uint quad, const Ray& ray, float tMin, float tMax, HitRecord& hit) const;
+    bool intersectTriangle(uint triangle, const Ray& ray, float tMin, float tMax, HitRecord& hit) const;
+    //Closest hit of the object of the instance, the normal is brought back to world space
+    bool intersectInstance(uint instance, const Ray& ray, float tMin, float tMax, HitRecord& hit) const;
+    bool instanceOccludes(uint instance, const Ray& ray, float tMin, float tMax) const;
+    //Packet test of an instance, the rays from first are transformed and traced through the BVH of its object
+    //Same contract as the packet kernels of SimdKernels
+    void intersectInstance(RayPacket& packet, uint first, uint instance, float tMin) const;
+    void instanceOccludes(RayPacket& packet, uint first, uint instance, float tMin) const;
+    //Tests one primitive for occlusion, only the distance of the hit is computed
+    bool occludes(uint primitive, const Ray& ray, float tMin, float tMax) const{
+        float t, u, v;
+        if(primitive < getSphereCount()) return sphereDistance(primitive, ray, tMin, tMax, t);
+        if(primitive < getFirstTriangle()) return quadDistance(primitive - getSphereCount(), ray, tMin, tMax, t, u, v);
+        if(primitive < getFirstInstance()) return triangleDistance(primitive - getFirstTriangle(), ray, tMin, tMax, t, u, v);
+        return instanceOccludes(primitive - getFirstInstance(), ray, tMin, tMax);
+    }
+    //Closest hit by testing every primitive with the SIMD kernels
+    bool closestHit(const Ray& ray, float tMin, float tMax, HitRecord& hit) const;
+    //Returns true as soon as one primitive is hit in [tMin, tMax]
+    bool occluded(const Ray& ray, float tMin, float tMax) const;
+    SphereArrays getSphereArrays() const;
+    QuadArrays getQuadArrays() const;
+    TriangleArrays getTriangleArrays() const;
+private:
+    //Distance t in [tMin, tMax] of the hit of one primitive, u and v are the coordinates of the hit on the quad
+    bool sphereDistance(uint sphere, const Ray& ray, float tMin, float tMax, float& t) const;
+    bool quadDistance(uint quad, const Ray& ray, float tMin, float tMax, float& t, float& u, float& v) const;
+    bool triangleDistance(uint triangle, const Ray& ray, float tMin, float tMax, float& t, float& u, float& v) const;
+    //Spheres
+    Vector3Array sphereCenters;
+    std::vector<float> sphereRadii;
+    //Quads : first corner, plane normal, unit normal and dual vectors of the edges (see Rectangle)
+    Vector3Array quadCorners, quadPlaneNormals, quadUnitNormals;
+    Vector3Array quadDu1, quadDv1, quadDu2, quadDv2;
+    //1 for parallelograms, 0 for quads tested as two triangles (float so that the SIMD kernels can load it)
+    std::vector<float> quadIsParallelogram;
+    std::vector<AABB> quadBounds;
+    //Triangles : vertices shared by the triangles of all the meshes and three vertex indices per triangle
+    Vector3Array meshVertices;
+    std::vector<uint> triangleIndices;
+    //First triangle (counted from the first triangle) and material of every mesh
+    std::vector<uint> meshFirstTriangles, meshMaterials;
+    //Material of every sphere and quad, index in the material table
+    std::vector<uint> sphereMaterials, quadMaterials;
+    std::vector<Material> materials;
+    std::map<Material, uint> materialTable;
+    //Objects of the instances, their bounds in their own space and their bottom level BVHs (not owned)
+    std::vector<std::unique_ptr<CompiledScene>> objects;
+    std::vector<AABB> objectBounds;
+    std::vector<const BVH*> objectBVHs;
+    //Instances : object, material, transforms from the object to the world and back, bounds in the world
+    std::vector<uint> instanceObjects, instanceMaterials;
+    std::vector<AffineTransform> instanceToWorld, worldToInstance;
+    std::vector<AABB> instanceBounds;
+    //Animated instances : instance, transform before the keyframes and range of their keyframes (offsets into keyframes)
+    std::vector<uint> animatedInstances;
+    std::vector<AffineTransform> animationBases;
+    std::vector<uint> animationKeyframeOffsets{0};
+    std::vector<TransformKeyframe> keyframes;
+    //Sets the transforms and the bounds of an instance
+    void setInstanceTransform(uint instance, const Eigen::Matrix4f& transform);
+    //Ray of the instance in the space of its object, the direction is not normalized so that the distances are the same
+    Ray toObject(uint instance, const float* origin, const float* direction) const;
+    uint getMaterialTableIndex(const Material& material);
+};
+
+inline bool CompiledScene::sphereDistance(uint sphere, const Ray &ray, float tMin, float tMax, float &t) const {
+    const Eigen::Vector3f& origin = ray.getOrigin();
+    const Eigen::Vector3f& direction = ray.getDirection();
+    const float dx = origin.x() - sphereCenters.x[sphere];
+    const float dy = origin.y() - sphereCenters.y[sphere];
+    const float dz = origin.z() - sphereCenters.z[sphere];
+    const float radius = sphereRadii[sphere];
+    const float a = direction.squaredNorm();
+    const float half_b = dx * direction.x() + dy * direction.y() + dz * direction.z();
+    const float c = dx * dx + dy * dy + dz * dz - radius * radius;
+    const float discriminant = half_b * half_b - a * c;
+    // no intersection
+    if (discriminant < 0) return false;
+    // the far root is used when the near one is out of the interval (ray starting inside the sphere)
+    const float root = std::sqrt(discriminant);
+    t = (-half_b - root) / a;
+    if (t < tMin || t > tMax) {
+        t = (-half_b + root) / a;
+        if (t < tMin || t > tMax) return false;
+    }
+    return true;
+}
+
+inline bool CompiledScene::intersectSphere(uint sphere, const Ray &ray, float tMin, float tMax, HitRecord &hit) const {
+    float t;
+    if (!sphereDistance(sphere, ray, tMin, tMax, t)) return false;
+    const Eigen::Vector3f& origin = ray.getOrigin();
+    const Eigen::Vector3f& direction = ray.getDirection();
+    hit.t = t;
+    hit.u = hit.v = 0;
+    hit.normal = Eigen::Vector3f(origin.x() - sphereCenters.x[sphere] + t * direction.x(), origin.y() - sphereCenters.y[sphere] + t * direction.y(),
+                                 origin.z() - sphereCenters.z[sphere] + t * direction.z()) / sphereRadii[sphere];
+    return true;
+}
+
+inline bool CompiledScene::quadDistance(uint quad, const Ray &ray, float tMin, float tMax, float &t, float &u, float &v) const {
+    const Eigen::Vector3f& origin = ray.getOrigin();
+    const Eigen::Vector3f& direction = ray.getDirection();
+    const float nx = quadPlaneNormals.x[quad], ny = quadPlaneNormals.y[quad], nz = quadPlaneNormals.z[quad];
+    // only the front face is hit
+    const float denominator = nx * direction.x() + ny * direction.y() + nz * direction.z();
+    if (-denominator < 0.0000000000001f) return false;
+    const float ox = quadCorners.x[quad] - origin.x();
+    const float oy = quadCorners.y[quad] - origin.y();
+    const float oz = quadCorners.z[quad] - origin.z();
+    // distance to the plane of the quad
+    t = (nx * ox + ny * oy + nz * oz) / denominator;
+    if (t < tMin || t > tMax) return false;
+    // hit point relative to the first corner
+    const float rx = t * direction.x() - ox;
+    const float ry = t * direction.y() - oy;
+    const float rz = t * direction.z() - oz;
+    u = rx * quadDu1.x[quad] + ry * quadDu1.y[quad] + rz * quadDu1.z[quad];
+    v = rx * quadDv1.x[quad] + ry * quadDv1.y[quad] + rz * quadDv1.z[quad];
+    if (quadIsParallelogram[quad] > 0.5f) {
+        if (u < 0 || u > 1 || v < 0 || v > 1) return false;
+    }
+    else if (u < 0 || v < 0 || u + v > 1) {
+        // second triangle of the quad
+        u = rx * quadDu2.x[quad] + ry * quadDu2.y[quad] + rz * quadDu2.z[quad];
+        v = rx * quadDv2.x[quad] + ry * quadDv2.y[quad] + rz * quadDv2.z[quad];
+        if (u < 0 || v < 0 || u + v > 1) return false;
+    }
+    return true;
+}
+
+inline bool CompiledScene::triangleDistance(uint triangle, const Ray &ray, float tMin, float tMax, float &t, float &u, float &v) const {
+    //Moller-Trumbore, both faces are hit, same arithmetic as the triangle kernels
+    const Eigen::Vector3f& origin = ray.getOrigin();
+    const Eigen::Vector3f& direction = ray.getDirection();
+    const uint a = triangleIndices[3 * triangle], b = triangleIndices[3 * triangle + 1], c = triangleIndices[3 * triangle + 2];
+    const float x0 = meshVertices.x[a], y0 = meshVertices.y[a], z0 = meshVertices.z[a];
+    const float e1x = meshVertices.x[b] - x0, e1y = meshVertices.y[b] - y0, e1z = meshVertices.z[b] - z0;
+    const float e2x = meshVertices.x[c] - x0, e2y = meshVertices.y[c] - y0, e2z = meshVertices.z[c] - z0;
+    const float px = direction.y() * e2z - direction.z() * e2y;
+    const float py = direction.z() * e2x - direction.x() * e2z;
+    const float pz = direction.x() * e2y - direction.y() * e2x;
+    const float determinant = e1x * px + e1y * py + e1z * pz;
+    // ray parallel to the plane of the triangle
+    if (!(1e-12f <= determinant || determinant <= -1e-12f)) return false;
+    const float inverse = 1 / determinant;
+    const float sx = origin.x() - x0, sy = origin.y() - y0, sz = origin.z() - z0;
+    u = (sx * px + sy * py + sz * pz) * inverse;
+    if (!(u >= 0)) return false;
+    const float qx = sy * e1z - sz * e1y;
+    const float qy = sz * e1x - sx * e1z;
+    const float qz = sx * e1y - sy * e1x;
+    v = (direction.x() * qx + direction.y() * qy + direction.z() * qz) * inverse;
+    if (!(v >= 0) || !(u + v <= 1)) return false;
+    t = (e2x * qx + e2y * qy + e2z * qz) * inverse;
+    return t >= tMin && t <= tMax;
+}
+
+inline bool CompiledScene::intersectTriangle(uint triangle, const Ray &ray, float tMin, float tMax, HitRecord &hit) const {
+    float t, u, v;
+    if (!triangleDistance(triangle, ray, tMin, tMax, t, u, v)) return false;
+    hit.t = t;
+    hit.u = u;
+    hit.v = v;
+    //Geometric normal, the shading turns it toward the ray
+    const uint a = triangleIndices[3 * triangle], b = triangleIndices[3 * triangle + 1], c = triangleIndices[3 * triangle + 2];
+    hit.normal = (meshVertices[b] - meshVertices[a]).cross(meshVertices[c] - meshVertices[a]).normalized();
+    return true;
+}
+
+inline bool CompiledScene::intersectQuad(uint quad, const Ray &ray, float tMin, float tMax, HitRecord &hit) const {
+    float t, u, v;
+    if (!quadDistance(quad, ray, tMin, tMax, t, u, v)) return false;
+    hit.t = t;
+    hit.u = u;
+    hit.v = v;
+    hit.normal = quadUnitNormals[quad];
+    return true;
+}
@@ -1,6 +1,8 @@
 #pragma once
 #include <Eigen/Core>
+#include <Eigen/Geometry>
 #include "Ray.h"
+#include "AABB.h"
 
 enum Type{RECTANGLE, TRIANGLE, SPHERE, GEOMETRY};
 
@@ -13,17 +15,22 @@ protected:
     float pc{};
     //Ambient, diffuse and specular reflection color of the surface of the rectangle
     Eigen::Vector3f ac{}, dc{}, sc{};
-    //Optional transform matrix
+    //Optional transform matrix, only used once transformed is set
     Eigen::Matrix4f transform;
+    bool transformed = false;
 public:
     Geometry() = default;
     Geometry(float ka, float kd, float ks, float pc, Eigen::Vector3f& ac, Eigen::Vector3f& dc, Eigen::Vector3f& sc):
             ka(ka), kd(kd), ks(ks), pc(pc), ac(ac), dc(dc), sc(sc){}
-    void setTransform(Eigen::Matrix4f& matrix){transform = matrix;}
-    virtual bool intersect(Ray& ray) {return false;}
+    void setTransform(Eigen::Matrix4f& matrix){
+        transform = matrix;
+        transformed = true;
+    }
+    bool hasTransform() const{return transformed;}
+    const Eigen::Matrix4f& getTransform() const{return transform;}
     virtual Type getType(){return GEOMETRY;}
-    virtual float getT()const{return -1.0;}
-    virtual void resetT(){}
+    //Bounding box of the geometry, used to build the acceleration structure
+    virtual AABB getBounds() const{return AABB();}
     float getKa() const{return ka;}
     float getKd() const{return kd;}
     float getKs() const{return ks;}
@@ -46,15 +53,14 @@ private:
     float radius;
     //Center of sphere
     Eigen::Vector3f center;
-    //Smallest t at which ray intersects with sphere
-    float t = -1;
 public:
     //Geometry of the sphere (containing all the mandatory members of a geometry)
     Sphere(float radius, Eigen::Vector3f& center): radius(radius), center(center){};
-    void resetT() override{t = -1;}
-    float getT() const override{return t;}
-    bool intersect(Ray& ray) override;
     Type getType() override{return Type::SPHERE;}
+    AABB getBounds() const override{
+        Eigen::Vector3f extent = Eigen::Vector3f::Constant(std::abs(radius));
+        return AABB(center - extent, center + extent);
+    }
     float getRadius() const{return radius;}
     Eigen::Vector3f& getCenter(){return center;}
     friend std::ostream& operator << (std::ostream& out, Sphere& sphere){
@@ -63,105 +69,63 @@ public:
     //Setting Geometry attributes
 };
 
-//Getting the smallest value of t
-inline bool Sphere::intersect(Ray& ray){
-    Eigen::Vector3f difference = ray.getOrigin()- center;
-    auto a = ray.getDirection().squaredNorm();
-    auto half_b = difference.dot(ray.getDirection());
-    auto c = difference.squaredNorm() - radius * radius;
-    auto discriminant = half_b * half_b - a * c;
-    // no intersection
-    if (discriminant < 0) return false;
-        // at least one intersection
-    else t = (float)(-half_b - sqrt(discriminant)) / a;
-    return true;
-}
-
 class Rectangle : public Geometry{
 private:
     //4 Corners of the Rectangle
     Eigen::Vector3f p1, p2, p3, p4;
     //Optional transform matrix
     Eigen::Matrix4f transform;
-    //Smallest t of intersection
-    float t = -1;
+    //Intersection data precomputed when the scene is parsed, copied into the quad arrays by CompiledScene::addQuad
+    //Plane normal (length = twice the area of triangle p1 p2 p3) and unit normal
+    Eigen::Vector3f planeNormal, unitNormal;
+    //Dual vectors of the edges : the barycentric coordinates of a point p of the plane are
+    //u = (p - p1).du and v = (p - p1).dv
+    //Parallelogram --> edges p2 - p1 and p4 - p1
+    //Any other quad --> triangle p1 p2 p3 (du1, dv1) and triangle p1 p3 p4 (du2, dv2)
+    Eigen::Vector3f du1, dv1, du2, dv2;
+    //True when p3 = p2 + p4 - p1, the quad is then tested with a single parallelogram
+    bool isParallelogram;
+    //Dual vectors of the edges a and b of a plane with normal n
+    static void computeDualVectors(const Eigen::Vector3f& a, const Eigen::Vector3f& b, const Eigen::Vector3f& n, Eigen::Vector3f& da, Eigen::Vector3f& db){
+        da = b.cross(n);
+        da /= a.dot(da);
+        db = n.cross(a);
+        db /= b.dot(db);
+    }
 public:
     //type (which will be always be RECTANGLE)
-    Rectangle(Eigen::Vector3f& p1, Eigen::Vector3f& p2, Eigen::Vector3f& p3 ,Eigen::Vector3f& p4): p1(p1), p2(p2), p3(p3), p4(p4){};
-    bool intersect(Ray& ray) override;
+    Rectangle(Eigen::Vector3f& p1, Eigen::Vector3f& p2, Eigen::Vector3f& p3 ,Eigen::Vector3f& p4): p1(p1), p2(p2), p3(p3), p4(p4){
+        planeNormal = (p2 - p1).cross(p3 - p1);
+        unitNormal = planeNormal.normalized();
+        const float size = std::max((p2 - p1).norm(), (p4 - p1).norm());
+        isParallelogram = (p3 - (p2 + p4 - p1)).norm() <= 1e-5f * size;
+        if(isParallelogram){
+            computeDualVectors(p2 - p1, p4 - p1, planeNormal, du1, dv1);
+            du2 = dv2 = Eigen::Vector3f::Zero();
+        }
+        else{
+            computeDualVectors(p2 - p1, p3 - p1, planeNormal, du1, dv1);
+            computeDualVectors(p3 - p1, p4 - p1, planeNormal, du2, dv2);
+        }
+    };
     Type getType() override{return Type::RECTANGLE;}
-    float getT() const override{return t;}
-    void resetT() override{t = -1;}
+    AABB getBounds() const override{
+        AABB bounds;
+        bounds.expand(p1);bounds.expand(p2);bounds.expand(p3);bounds.expand(p4);
+        return bounds;
+    }
     Eigen::Vector3f& getP1(){return p1;}
     Eigen::Vector3f& getP2(){return p2;}
     Eigen::Vector3f& getP3(){return p3;}
     Eigen::Vector3f& getP4(){return p4;}
+    const Eigen::Vector3f& getNormal() const{return unitNormal;}
+    const Eigen::Vector3f& getPlaneNormal() const{return planeNormal;}
+    bool getIsParallelogram() const{return isParallelogram;}
+    const Eigen::Vector3f& getDu1() const{return du1;}
+    const Eigen::Vector3f& getDv1() const{return dv1;}
+    const Eigen::Vector3f& getDu2() const{return du2;}
+    const Eigen::Vector3f& getDv2() const{return dv2;}
     friend std::ostream& operator << (std::ostream& out, Rectangle& rectangle){
         return out << "Rectangle of points p1 " << rectangle.p1 << ", p2 " << rectangle.p2 << ", p3 " << rectangle.p3 << " and p4 " << rectangle.p4;
     }
 };
-
-//Triangle used in intersection of rectangles
-struct Triangle : Geometry{
-private:
-    //Smallest t of intersection
-    float t = -1;
-    Eigen::Vector3f p1,p2,p3;
-public:
-    bool intersect(Ray& ray) override;
-    Triangle(Eigen::Vector3f& p1, Eigen::Vector3f& p2, Eigen::Vector3f& p3): p1(p1), p2(p2), p3(p3){};
-    float getT() const override{return t;}
-    Type getType() override{return Type::TRIANGLE;}
-};
-
-inline bool Rectangle::intersect(Ray &ray) {
-    //Breaking the rectangle into two triangles
-    Triangle triangle1(p1, p2, p3);
-    Triangle triangle2(p1, p3, p4);
-
-    triangle1.intersect(ray);
-    triangle2.intersect(ray);
-
-    if (triangle1.getT() > 0) {
-        t = triangle1.getT();return true;
-    }
-    if (triangle2.getT() > 0) {
-        t = triangle2.getT();return true;
-    }
-    // no intersection in either triangles
-    return false;
-}
-
-inline bool Triangle::intersect(Ray &ray) {
-    // vectors on the triangle
-    Eigen::Vector3f ab = p2 - p1;
-    Eigen::Vector3f ac = p3 - p1;
-
-    Eigen::Vector3f pvec = ray.getDirection().cross(ac);
-    float det = ab.dot(pvec);
-
-    // if the determinant is close to zero it doesn't intersect
-    if (det < 0.0000000000001) return false;
-
-    float inverseDet = 1 / det;
-
-    // distance vector from ray start to a
-    Eigen::Vector3f tvec = ray.getOrigin() - p1;
-
-    // (barycentric coordinate between a and b)
-    // if between 0 and 1 then it exists inside the triangle
-    float u = tvec.dot(pvec) * inverseDet;
-    if (u > 1 || u < 0) return false;
-
-    Eigen::Vector3f qvec = tvec.cross(ab);
-
-    // (barycentric coordinate between a and c)
-    // if between 0 and 1 then it exists inside the triangle
-    float v = ray.getDirection().dot(qvec) * inverseDet;
-    // if v is less than 0 or u and v sum to greater than one, it is not in the triangle
-    if (u + v > 1 || v < 0) return false;
-
-    // it does exist in the triangle, retrieve t
-    t = ac.dot(qvec) * inverseDet;
-    return true;
-}
@@ -0,0 +1,15 @@
+#pragma once
+#include <limits>
+#include "Eigen/Core"
+
+//Result of a ray query, filled by the intersection functions instead of storing state in the geometry
+struct HitRecord{
+    //Distance of the hit along the ray
+    float t = std::numeric_limits<float>::infinity();
+    //Index of the geometry in the scene objects, -1 when nothing was hit
+    int primitiveId = -1;
+    //Barycentric coordinates of the hit on a triangle or a rectangle
+    float u = 0, v = 0;
+    //Unit outward normal of the geometry at the hit
+    Eigen::Vector3f normal{0, 0, 0};
+};
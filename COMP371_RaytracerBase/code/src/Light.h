@@ -31,8 +31,21 @@ public:
     Eigen::Vector3f& getP3(){return p3;}
     Eigen::Vector3f& getP4(){return p4;}
     LightType getType() const override{return LightType::AREA;}
+    void setN(uint samples){n = samples;}
+    void setUseCenter(bool center){useCenter = center;}
+    uint getN() const{return n;}
+    bool getUseCenter() const{return useCenter;}
+    Eigen::Vector3f getCenter() const{return (p1 + p2 + p3 + p4) / 4;}
+    //Point of the light at coordinates (u, v) in [0, 1] x [0, 1], p1 --> (0, 0), p2 --> (1, 0), p3 --> (1, 1), p4 --> (0, 1)
+    Eigen::Vector3f samplePoint(float u, float v) const{
+        return (1 - v) * ((1 - u) * p1 + u * p2) + v * ((1 - u) * p4 + u * p3);
+    }
 private:
     Eigen::Vector3f p1, p2, p3, p4;
+    //N --> The light is sampled on a grid of n x n cells with one jittered sample per cell
+    uint n = 4;
+    //Usecenter --> When true the light is treated as a point light at its center
+    bool useCenter = false;
 };
 
 class Point : public Light{
@@ -0,0 +1,110 @@
+#include "LightBVH.h"
+#include <algorithm>
+#include <cmath>
+
+LightBVH::LightBVH(std::vector<Light *> &lights) {
+    const uint count = (uint)lights.size();
+    lightIndices.resize(count);
+    lightBounds.resize(count);
+    lightPowers.resize(count);
+    for(uint i = 0; i < count; i++){
+        lightIndices[i] = i;
+        lightBounds[i] = getBounds(lights[i]);
+        lightPowers[i] = getPower(lights[i]);
+    }
+    if(count == 0) return;
+    //A binary tree with N leaves has 2N - 1 nodes
+    nodes.reserve(2 * count - 1);
+    nodes.push_back(Node());
+    build(0, 0, count);
+}
+
+void LightBVH::build(uint nodeIndex, uint first, uint count) {
+    AABB bounds, centroidBounds;
+    float power = 0;
+    for(uint i = first; i < first + count; i++){
+        bounds.expand(lightBounds[lightIndices[i]]);
+        centroidBounds.expand(lightBounds[lightIndices[i]].getCentroid());
+        power += lightPowers[lightIndices[i]];
+    }
+    nodes[nodeIndex].bounds = bounds;
+    nodes[nodeIndex].power = power;
+    if(count == 1){
+        nodes[nodeIndex].leftFirst = first;
+        nodes[nodeIndex].leaf = true;
+        return;
+    }
+    //Median split of the centroids along the widest axis
+    const int axis = centroidBounds.getLargestAxis();
+    const uint middle = first + count / 2;
+    std::nth_element(lightIndices.begin() + first, lightIndices.begin() + middle, lightIndices.begin() + first + count, [&](uint a, uint b){
+        return lightBounds[a].getCentroid()[axis] < lightBounds[b].getCentroid()[axis];
+    });
+    const uint left = (uint)nodes.size();
+    nodes.push_back(Node());
+    nodes.push_back(Node());
+    nodes[nodeIndex].leftFirst = left;
+    nodes[nodeIndex].leaf = false;
+    build(left, first, middle - first);
+    build(left + 1, middle, first + count - middle);
+}
+
+int LightBVH::sample(const Eigen::Vector3f &point, const Eigen::Vector3f &normal, float u, float &pdf) const {
+    pdf = 1;
+    if(nodes.empty() || nodes[0].power <= 0) return -1;
+    uint nodeIndex = 0;
+    while(!nodes[nodeIndex].leaf){
+        const uint left = nodes[nodeIndex].leftFirst;
+        const float leftImportance = getImportance(nodes[left], point, normal);
+        const float rightImportance = getImportance(nodes[left + 1], point, normal);
+        if(leftImportance + rightImportance <= 0) return -1;
+        const float leftProbability = leftImportance / (leftImportance + rightImportance);
+        //The number is rescaled to the chosen interval so that it can be reused by the next level
+        if(u < leftProbability){
+            u = u / leftProbability;
+            pdf *= leftProbability;
+            nodeIndex = left;
+        }
+        else{
+            u = (u - leftProbability) / (1 - leftProbability);
+            pdf *= 1 - leftProbability;
+            nodeIndex = left + 1;
+        }
+        u = std::min(u, 0.99999994f);
+    }
+    return (int)lightIndices[nodes[nodeIndex].leftFirst];
+}
+
+float LightBVH::getImportance(const Node &node, const Eigen::Vector3f &point, const Eigen::Vector3f &normal) const {
+    if(node.power <= 0) return 0;
+    //Lights do not fall off with the distance in this renderer, only the orientation of the cluster matters
+    //The cluster is bounded by the sphere around its box, the cosine is bounded by the closest direction of the cone toward it
+    const Eigen::Vector3f toCenter = node.bounds.getCentroid() - point;
+    const float distance = toCenter.norm();
+    const float radius = 0.5f * node.bounds.getExtent().norm();
+    float cosBound = 1;
+    if(distance > radius){
+        const float cosCenter = std::max(-1.0f, std::min(1.0f, normal.dot(toCenter) / distance));
+        const float angle = std::acos(cosCenter) - std::asin(radius / distance);
+        cosBound = angle <= 0 ? 1 : std::cos(angle);
+    }
+    return node.power * (cosBound > MIN_ORIENTATION ? cosBound : MIN_ORIENTATION);
+}
+
+float LightBVH::getPower(Light *light) {
+    const Eigen::Vector3f intensity = light->getId() + light->getIs();
+    return std::max(0.0f, 0.2126f * intensity.x() + 0.7152f * intensity.y() + 0.0722f * intensity.z());
+}
+
+AABB LightBVH::getBounds(Light *light) {
+    AABB bounds;
+    if(light->getType() == LightType::AREA){
+        auto* area = static_cast<Area*>(light);
+        bounds.expand(area->getP1());
+        bounds.expand(area->getP2());
+        bounds.expand(area->getP3());
+        bounds.expand(area->getP4());
+    }
+    else if(light->getType() == LightType::POINT) bounds.expand(static_cast<Point*>(light)->getCenter());
+    return bounds;
+}
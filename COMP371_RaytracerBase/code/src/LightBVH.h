@@ -0,0 +1,41 @@
+#pragma once
+#include <vector>
+#include "Eigen/Core"
+#include "AABB.h"
+#include "Light.h"
+
+//Hierarchy over the lights of the scene used to pick a few important lights per shading point instead of shading all of them
+//Every node stores the bounds and the power of its lights. A light is picked by walking down from the root and choosing
+//each child with a probability proportional to its importance seen from the shading point
+//Used when the output has lightsamples set
+class LightBVH{
+public:
+    //Share of the importance of a cluster kept when it is behind the surface, so that every light keeps a non zero
+    //probability (the specular term of Blinn-Phong does not vanish behind the surface)
+    static constexpr float MIN_ORIENTATION = 0.05f;
+    explicit LightBVH(std::vector<Light*>& lights);
+    //Index in the scene lights of a light picked for the shading point with the uniform number u in [0, 1)
+    //pdf receives the probability of the pick, returns -1 when no light has any power
+    int sample(const Eigen::Vector3f& point, const Eigen::Vector3f& normal, float u, float& pdf) const;
+    uint getNodeCount() const{return (uint)nodes.size();}
+    //Luminance of the diffuse and specular intensities of a light
+    static float getPower(Light* light);
+    //Bounds of the surface of a light, a single point for point lights
+    static AABB getBounds(Light* light);
+private:
+    //Interior node --> children at leftFirst and leftFirst + 1
+    //Leaf node --> the light at index leftFirst in lightIndices
+    struct Node{
+        AABB bounds;
+        float power;
+        uint leftFirst;
+        bool leaf;
+    };
+    std::vector<Node> nodes;
+    std::vector<uint> lightIndices;
+    std::vector<AABB> lightBounds;
+    std::vector<float> lightPowers;
+    void build(uint nodeIndex, uint first, uint count);
+    //Power of the node weighted by an upper bound of the cosine between the normal and the directions toward its bounds
+    float getImportance(const Node& node, const Eigen::Vector3f& point, const Eigen::Vector3f& normal) const;
+};
@@ -0,0 +1,142 @@
+#include "ObjLoader.h"
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+
+void ObjLoader::load(const std::string &fileName) {
+    this->fileName = fileName;
+    FILE* file = std::fopen(fileName.c_str(), "rb");
+    if(file == nullptr){
+        std::cout << "Exiting program: could not open the mesh file " << fileName << std::endl;
+        exit(1);
+    }
+    std::string text;
+    std::fseek(file, 0, SEEK_END);
+    const long fileSize = std::ftell(file);
+    std::fseek(file, 0, SEEK_SET);
+    if(fileSize > 0){
+        text.resize((size_t)fileSize);
+        text.resize(std::fread(&text[0], 1, (size_t)fileSize, file));
+    }
+    std::fclose(file);
+    //About one face per vertex line is the usual ratio, reserving for it avoids most reallocations
+    const size_t lineEstimate = text.size() / 32;
+    vertices.x.reserve(lineEstimate / 2);
+    vertices.y.reserve(lineEstimate / 2);
+    vertices.z.reserve(lineEstimate / 2);
+    indices.reserve(lineEstimate * 3 / 2);
+    const char* position = text.data();
+    const char* end = position + text.size();
+    while(position < end){
+        line++;
+        skipSpaces(position, end);
+        if(end - position > 1 && (position[1] == ' ' || position[1] == '\t')){
+            if(*position == 'v') readVertex(++position, end);
+            else if(*position == 'f') readFace(++position, end);
+        }
+        //Rest of the line, including the keywords that are skipped
+        while(position < end && *position != '\n') position++;
+        position++;
+    }
+    if(indices.empty()) std::cout << "Warning: the mesh file " << fileName << " has no faces" << std::endl;
+}
+
+void ObjLoader::readVertex(const char *&position, const char *end) {
+    float coordinates[3];
+    for(float& coordinate : coordinates){
+        skipSpaces(position, end);
+        if(!readFloat(position, end, coordinate)) invalidLine("a vertex needs three coordinates");
+    }
+    vertices.x.push_back(coordinates[0]);
+    vertices.y.push_back(coordinates[1]);
+    vertices.z.push_back(coordinates[2]);
+}
+
+void ObjLoader::readFace(const char *&position, const char *end) {
+    face.clear();
+    while(true){
+        skipSpaces(position, end);
+        long index;
+        if(!readInteger(position, end, index)) break;
+        //Indices start at 1, negative ones are relative to the vertices read so far
+        const long vertex = index < 0 ? (long)vertices.size() + index : index - 1;
+        if(index == 0 || vertex < 0 || vertex >= (long)vertices.size()) invalidLine("a face uses a vertex that does not exist");
+        face.push_back((uint)vertex);
+        //Texture coordinate and normal indices are skipped
+        while(position < end && *position != ' ' && *position != '\t' && *position != '\r' && *position != '\n') position++;
+    }
+    if(position < end && *position != '\r' && *position != '\n' && *position != '#') invalidLine("a face should only contain vertex indices");
+    if(face.size() < 3) invalidLine("a face needs at least three vertices");
+    for(size_t i = 2; i < face.size(); i++){
+        indices.push_back(face[0]);
+        indices.push_back(face[i - 1]);
+        indices.push_back(face[i]);
+    }
+}
+
+bool ObjLoader::readFloat(const char *&position, const char *end, float &value) {
+    //Exact powers of ten of a double
+    static const double powers[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    const char* start = position;
+    bool negative = false;
+    if(position < end && (*position == '-' || *position == '+')) negative = *position++ == '-';
+    //Digits after the 19th do not fit the mantissa, they only move the decimal exponent
+    uint64_t mantissa = 0;
+    int digits = 0, exponent = 0;
+    bool any = false;
+    for(; position < end && *position >= '0' && *position <= '9'; position++, any = true){
+        if(digits < 19){
+            mantissa = mantissa * 10 + (uint64_t)(*position - '0');
+            if(mantissa != 0) digits++;
+        }
+        else exponent++;
+    }
+    if(position < end && *position == '.'){
+        for(position++; position < end && *position >= '0' && *position <= '9'; position++, any = true){
+            if(digits < 19){
+                mantissa = mantissa * 10 + (uint64_t)(*position - '0');
+                if(mantissa != 0) digits++;
+                exponent--;
+            }
+        }
+    }
+    if(!any){
+        position = start;
+        return false;
+    }
+    if(position < end && (*position == 'e' || *position == 'E')){
+        const char* exponentStart = position++;
+        long written;
+        if(readInteger(position, end, written)) exponent += (int)(written > 400 ? 400 : written < -400 ? -400 : written);
+        else position = exponentStart;
+    }
+    double result = (double)mantissa;
+    if(exponent < 0) result = -exponent <= 22 ? result / powers[-exponent] : result * std::pow(10.0, exponent);
+    else if(exponent > 0) result = exponent <= 22 ? result * powers[exponent] : result * std::pow(10.0, exponent);
+    value = (float)(negative ? -result : result);
+    return true;
+}
+
+bool ObjLoader::readInteger(const char *&position, const char *end, long &value) {
+    const char* start = position;
+    bool negative = false;
+    if(position < end && (*position == '-' || *position == '+')) negative = *position++ == '-';
+    if(position == end || *position < '0' || *position > '9'){
+        position = start;
+        return false;
+    }
+    long result = 0;
+    for(; position < end && *position >= '0' && *position <= '9'; position++){
+        //Larger values are not valid indices anyway
+        if(result < 100000000000L) result = result * 10 + (*position - '0');
+    }
+    value = negative ? -result : result;
+    return true;
+}
+
+void ObjLoader::invalidLine(const char *reason) const {
+    std::cout << "Exiting program: line " << line << " of the mesh file " << fileName << " is not valid, " << reason << std::endl;
+    exit(1);
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "CompiledScene.h"
+
+//Reads the geometry of a Wavefront OBJ file into an indexed triangle mesh
+//v --> vertex position, f --> polygon given by vertex indices (v, v/vt, v//vn or v/vt/vn, negative indices count back
+//from the last vertex), split into a fan of triangles
+//Normals, texture coordinates, groups and materials are skipped, the mesh gets the material of its geometry entry
+//The whole file is read at once and parsed in place, without streams or strtof, so that meshes of millions of
+//triangles load in a few seconds
+class ObjLoader{
+public:
+    //Exits the program when the file can not be read or a face uses a vertex that does not exist
+    void load(const std::string& fileName);
+    const Vector3Array& getVertices() const{return vertices;}
+    //Three vertex indices per triangle, counted from 0
+    const std::vector<uint>& getIndices() const{return indices;}
+    uint getTriangleCount() const{return (uint)(indices.size() / 3);}
+private:
+    Vector3Array vertices;
+    std::vector<uint> indices;
+    std::string fileName;
+    //Line being parsed, for the error messages
+    uint line = 0;
+    //Vertex indices of the face being read
+    std::vector<uint> face;
+    void readVertex(const char*& position, const char* end);
+    void readFace(const char*& position, const char* end);
+    //Parses a number and moves past it, false when there is none
+    static bool readFloat(const char*& position, const char* end, float& value);
+    static bool readInteger(const char*& position, const char* end, long& value);
+    static void skipSpaces(const char*& position, const char* end){
+        while(position < end && (*position == ' ' || *position == '\t')) position++;
+    }
+    [[noreturn]] void invalidLine(const char* reason) const;
+};
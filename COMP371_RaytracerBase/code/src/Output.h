@@ -3,6 +3,9 @@
 #include <array>
 #include <vector>
 #include "Eigen/Core"
+#include "Animation.h"
+#include "BVH.h"
+#include "Sampler.h"
 
 class Output{
 private:
@@ -27,16 +30,47 @@ private:
     //If it has only one value --> value represents number of rays per pixel
     //If it has two --> Represents grid dimensions for stratified sampling
     std::vector<uint> raysPerPixel;
-    //Speedup --> 0 for no accelerating structure,1 for accelerating structure
-    //TODO: Reject values more than 1
-    uint speedUp;
+    //Speedup --> Accelerating structure : 0 for none (every geometry is tested), 1 for a BVH, 2 for a uniform grid
+    uint speedUp = 0;
     //Antialiasing boolean --> Whether to use if or not
     bool antiAliasing = false;
     //TwoSideRender
     //When true --> Light bounces same way
-    bool twoSideRender;
+    bool twoSideRender = false;
     //Globalillum --> When true, render with global illumination
-    bool globalIllum;
+    bool globalIllum = false;
+    //Maxbounces --> Maximum number of diffuse bounces of the paths of global illumination
+    uint maxBounces = 3;
+    //Probterminate --> Probability of Russian roulette to end a path at each bounce
+    float probTerminate = 0.3333f;
+    //Wavefront --> When true, the paths of global illumination are traced in sorted queues, one stage at a time, instead of one by one
+    bool wavefront = false;
+    //Sampler --> "random" (PCG), "sobol" (default, scrambled Sobol) or "bluenoise", numbers of all the stochastic parts of the render
+    SamplerType sampler = SamplerType::SOBOL;
+    //Seed --> Seed of the sampler, the same seed always gives the same image
+    uint seed = 0;
+    //Lightsamples --> Number of lights picked per shading point by the light BVH, 0 (default) shades every light
+    uint lightSamples = 0;
+    //Threads --> Number of worker threads rendering the tiles of the image, 0 for one per hardware thread
+    uint threads = 0;
+    //Bvhbuilder --> "sah" (default) for a binned surface area heuristic build, "median" for the cheaper median split
+    BVHBuilder bvhBuilder = BVHBuilder::SAH;
+    //Sahbins --> Number of bins per axis of the SAH builder, more bins give a better tree but a slower build
+    uint sahBins = 16;
+    //Bvhwidth --> Children per node of the BVH traversed by the rays (2, 4 or 8), 4 and 8 test the child boxes of a node together with SIMD
+    uint bvhWidth = 2;
+    //Bvhquantization --> Bits per plane of the child boxes of the wide BVH nodes (0 for floats, 8 or 16), less memory for a slightly slower traversal
+    uint bvhQuantization = 0;
+    //Packetsize --> Primary rays of packetsize x packetsize pixels traverse the BVH together (1, 2, 4 or 8), 1 traces them one by one
+    uint packetSize = 8;
+    //Griddensity --> Cells per geometry of the uniform grid (speedup 2), more cells skip more geometries but visit more empty cells
+    float gridDensity = 4;
+    //Adaptivethreshold --> With antialiasing, pixels get more samples while the 95% confidence interval of their luminance is wider than it, 0 disables it
+    float adaptiveThreshold = 0;
+    //Maxspp --> Maximum samples per pixel of adaptive sampling, 0 for 4 times the samples given by raysperpixel
+    uint maxSamples = 0;
+    //Keyframes --> Centre, lookat and up of the camera at some frames of the animation, empty for a still camera
+    std::vector<CameraKeyframe> cameraKeyframes;
 public:
     //Constructor of output containing all the mandatory members
     Output(std::string fileName, std::array<uint,2>& size, float fov, Eigen::Vector3f& up, Eigen::Vector3f& lookAt, Eigen::Vector3f& ai, Eigen::Vector3f& bkc, Eigen::Vector3f& center):
@@ -57,6 +91,62 @@ public:
     void setGlobalIllum(bool global){
         globalIllum = global;
     }
+    void setMaxBounces(uint bounces){
+        maxBounces = bounces;
+    }
+    void setProbTerminate(float probability){
+        probTerminate = probability;
+    }
+    void setWavefront(bool useWavefront){
+        wavefront = useWavefront;
+    }
+    void setSampler(SamplerType type){
+        sampler = type;
+    }
+    void setSeed(uint samplerSeed){
+        seed = samplerSeed;
+    }
+    void setLightSamples(uint samples){
+        lightSamples = samples;
+    }
+    void setThreads(uint threadCount){
+        threads = threadCount;
+    }
+    void setBVHBuilder(BVHBuilder builder){
+        bvhBuilder = builder;
+    }
+    void setSAHBins(uint bins){
+        sahBins = bins;
+    }
+    void setBVHWidth(uint width){
+        bvhWidth = width;
+    }
+    void setBVHQuantization(uint bits){
+        bvhQuantization = bits;
+    }
+    void setPacketSize(uint size){
+        packetSize = size;
+    }
+    void setGridDensity(float density){
+        gridDensity = density;
+    }
+    void setAdaptiveThreshold(float threshold){
+        adaptiveThreshold = threshold;
+    }
+    void setMaxSamples(uint samples){
+        maxSamples = samples;
+    }
+    void setCameraKeyframes(std::vector<CameraKeyframe> keyframes){
+        cameraKeyframes = std::move(keyframes);
+    }
+    //Moves the camera to its position at a frame of the animation
+    void setFrame(float frame){
+        if(cameraKeyframes.empty()) return;
+        const CameraKeyframe camera = CameraKeyframe::evaluate(cameraKeyframes, frame);
+        center = camera.centre;
+        lookAt = camera.lookAt;
+        up = camera.up;
+    }
     //Getters for all members
     std::string getFileName(){return fileName;}
     std::array<uint, 2> & getSize() {return size;}
@@ -71,4 +161,20 @@ public:
     bool getAntiAliasing() const{return antiAliasing;}
     bool getTwoSideRender()const{return twoSideRender;}
     bool getGlobalIllum()const{return globalIllum;}
+    uint getMaxBounces()const{return maxBounces;}
+    float getProbTerminate()const{return probTerminate;}
+    bool getWavefront()const{return wavefront;}
+    SamplerType getSampler()const{return sampler;}
+    uint getSeed()const{return seed;}
+    uint getLightSamples()const{return lightSamples;}
+    uint getThreads()const{return threads;}
+    BVHBuilder getBVHBuilder()const{return bvhBuilder;}
+    uint getSAHBins()const{return sahBins;}
+    uint getBVHWidth()const{return bvhWidth;}
+    uint getBVHQuantization()const{return bvhQuantization;}
+    uint getPacketSize()const{return packetSize;}
+    float getGridDensity()const{return gridDensity;}
+    float getAdaptiveThreshold()const{return adaptiveThreshold;}
+    uint getMaxSamples()const{return maxSamples;}
+    bool isAnimated()const{return !cameraKeyframes.empty();}
 };
\ No newline at end of file
@@ -10,8 +10,10 @@ public:
     Ray(Eigen::Vector3f  origin, Eigen::Vector3f  direction): rayOrigin(std::move(origin)), rayDirection(std::move(direction)){};
     Eigen::Vector3f& getOrigin(){return rayOrigin;}
     Eigen::Vector3f& getDirection(){return rayDirection;}
+    const Eigen::Vector3f& getOrigin() const{return rayOrigin;}
+    const Eigen::Vector3f& getDirection() const{return rayDirection;}
     //P(t) = A + tb where A is the ray origin and b is the ray direction
-    Eigen::Vector3f at(float t){
+    Eigen::Vector3f at(float t) const{
         return rayOrigin + t * rayDirection;
     }
 };
\ No newline at end of file
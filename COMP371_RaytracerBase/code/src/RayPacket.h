@@ -0,0 +1,41 @@
+#pragma once
+#include <limits>
+#include <sys/types.h>
+
+//Rays of a block of pixels traced together through the BVH, stored as arrays so that the SIMD kernels hold one ray per lane
+//Like SimdKernels.h this header must not pull in Eigen
+struct RayPacket{
+    //An 8x8 block of pixels
+    static const uint MAX_SIZE = 64;
+    //Rays are processed in groups of this many lanes, the widest SIMD level
+    static const uint LANE_GROUP = 8;
+    float ox[MAX_SIZE], oy[MAX_SIZE], oz[MAX_SIZE];
+    float dx[MAX_SIZE], dy[MAX_SIZE], dz[MAX_SIZE];
+    float invX[MAX_SIZE], invY[MAX_SIZE], invZ[MAX_SIZE];
+    //Distance of the closest hit so far of every ray
+    float tMax[MAX_SIZE];
+    //Primitive id of the closest hit so far, -1 when nothing was hit
+    int primitiveId[MAX_SIZE];
+    uint size = 0;
+    void setRay(uint i, const float* origin, const float* direction, float rayTMax){
+        ox[i] = origin[0];
+        oy[i] = origin[1];
+        oz[i] = origin[2];
+        dx[i] = direction[0];
+        dy[i] = direction[1];
+        dz[i] = direction[2];
+        invX[i] = 1 / direction[0];
+        invY[i] = 1 / direction[1];
+        invZ[i] = 1 / direction[2];
+        tMax[i] = rayTMax;
+        primitiveId[i] = -1;
+    }
+    //Fills the lanes past the last ray up to a multiple of LANE_GROUP with copies of the first ray that can never hit anything
+    void pad(){
+        for(uint i = size; i % LANE_GROUP != 0; i++){
+            const float origin[3] = {ox[0], oy[0], oz[0]};
+            const float direction[3] = {dx[0], dy[0], dz[0]};
+            setRay(i, origin, direction, -std::numeric_limits<float>::infinity());
+        }
+    }
+};
@@ -1,6 +1,15 @@
 #include "RayTracer.h"
+#include "WavefrontIntegrator.h"
 
-RayTracer::RayTracer(nlohmann::json &j) : json(j) {}
+RayTracer::RayTracer(nlohmann::json &j, uint threads) : json(j), threads(threads) {}
+
+RayTracer::RayTracer(SceneLoader &loader, uint threads) : json(loader.getSettings()), threads(threads), compiledScene(loader.takeCompiledScene()),
+                                                        cache(loader.takeCache()) {}
+
+//Defined here where the integrators are complete types
+RayTracer::RenderJob::RenderJob(Output *output) : output(output), camera(*output) {}
+
+RayTracer::RenderJob::~RenderJob() = default;
 
 void Parser::parseGeometry(Scene &scene, nlohmann::json &json) {
     for (auto itr = json["geometry"].begin(); itr!= json["geometry"].end(); itr++){
@@ -46,10 +55,28 @@ void Parser::parseGeometry(Scene &scene, nlohmann::json &json) {
             std::cout << "Exiting program : geometry should always have ambient, diffuse and specular reflection color (ac, dc and sc) " << std::endl;
             exit(1);
         }
-        Eigen::Matrix4f transform;
-        //TODO TRANSFORM MATRIX AND INITIALISE GEOMETRY
+        if(itr->contains("keyframes")) std::cout << "Warning : keyframes of geometries are only read by the streaming loader, the geometry is not animated" << std::endl;
+        //Optional transform, a 4x4 matrix by rows, the geometry is then placed by an instance
+        Eigen::Matrix4f transform = Eigen::Matrix4f::Identity();
+        bool transformed = false;
         if(itr->contains("transform")){
-            //setTransform(transform);
+            int i = 0;
+            for(auto& itr2 : (*itr)["transform"]){
+                if(i < 16){
+                    transform(i / 4, i % 4) = itr2.get<float>();
+                    i++;
+                }
+                else std::cout << "Warning : Too many entries in transform" << std::endl;
+            }
+            if(i < 16){
+                std::cout << "Exiting program: the transform should have 16 values (a 4x4 matrix by rows)" << std::endl;
+                exit(1);
+            }
+            if(transform.topLeftCorner<3, 3>().determinant() == 0){
+                std::cout << "Exiting program: the transform is not invertible" << std::endl;
+                exit(1);
+            }
+            transformed = true;
         }
         if(type =="sphere"){
             Eigen::Vector3f center(0,0,0);
@@ -64,6 +91,7 @@ void Parser::parseGeometry(Scene &scene, nlohmann::json &json) {
             auto* sphere = new Sphere(radius, center);
             auto* geometry = (Geometry*) sphere;
             geometry->setGeometryAttributes(ka, kd, ks, pc, ac, dc, sc);
+            if(transformed) geometry->setTransform(transform);
             scene.addObject(geometry);
         }
         else if(type == "rectangle"){
@@ -111,8 +139,12 @@ void Parser::parseGeometry(Scene &scene, nlohmann::json &json) {
             auto* rectangle = new Rectangle(p1, p2, p3, p4);
             auto* geometry = (Geometry*) rectangle;
             geometry->setGeometryAttributes(ka, kd, ks, pc, ac, dc, sc);
+            if(transformed) geometry->setTransform(transform);
             scene.addObject(geometry);
         }
+        else if(type == "mesh"){
+            std::cout << "Warning: meshes are only read by the streaming scene loader, the mesh was skipped" << std::endl;
+        }
     }
 }
 
@@ -148,6 +180,11 @@ void Parser::parseLight(Scene &scene, nlohmann::json &json) {
             std::cout<<"Exiting program: light should always contain a specular intensity (is)"<< std::endl;
             exit(1);
         }
+        //Lights with use set to false are kept in the file but ignored
+        if(itr->contains("use") && !(*itr)["use"].get<bool>()){
+            std::cout << "Light not used" << std::endl;
+            continue;
+        }
         //Creating super class Light
         std::string type = (*itr)["type"].get<std::string>();
         if(type=="point"){
@@ -203,6 +240,15 @@ void Parser::parseLight(Scene &scene, nlohmann::json &json) {
                 }
             }
             auto* areaLight = new Area(p1, p2, p3, p4);
+            if(itr->contains("n")){
+                uint n = (*itr)["n"].get<uint>();
+                if(n == 0){
+                    std::cout << "Exiting program: light n should be at least 1" << std::endl;
+                    exit(1);
+                }
+                areaLight->setN(n);
+            }
+            if(itr->contains("usecenter")) areaLight->setUseCenter((*itr)["usecenter"].get<bool>());
             auto* light = (Light*) areaLight;
             light->setId(id);
             light->setIs(is);
@@ -306,8 +352,8 @@ void Parser::parseOutput(Scene &scene, nlohmann::json &json) {
         }
         if(itr->contains("speedup")){
             uint speedUp = (*itr)["speedup"].get<uint>();
-            if(speedUp > 1){
-                std::cout << "Exiting program: output Speedup value greater than 1" << std::endl;
+            if(speedUp > 2){
+                std::cout << "Exiting program: output speedup should be 0, 1 or 2" << std::endl;
                 exit(1);
             }
             output->setSpeedUp(speedUp);
@@ -324,160 +370,631 @@ void Parser::parseOutput(Scene &scene, nlohmann::json &json) {
             bool globalillum = (*itr)["globalillum"].get<bool>();
             output->setGlobalIllum(globalillum);
         }
+        if(itr->contains("maxbounces")){
+            output->setMaxBounces((*itr)["maxbounces"].get<uint>());
+        }
+        if(itr->contains("probterminate")){
+            float probTerminate = (*itr)["probterminate"].get<float>();
+            if(probTerminate < 0 || probTerminate >= 1){
+                std::cout << "Exiting program: output probterminate should be in [0, 1)" << std::endl;
+                exit(1);
+            }
+            output->setProbTerminate(probTerminate);
+        }
+        if(itr->contains("wavefront")){
+            output->setWavefront((*itr)["wavefront"].get<bool>());
+        }
+        if(itr->contains("sampler")){
+            SamplerType sampler;
+            if(!Sampler::parseType((*itr)["sampler"].get<std::string>(), sampler)){
+                std::cout << "Exiting program: output sampler should be random, sobol or bluenoise" << std::endl;
+                exit(1);
+            }
+            output->setSampler(sampler);
+        }
+        if(itr->contains("seed")){
+            output->setSeed((*itr)["seed"].get<uint>());
+        }
+        if(itr->contains("lightsamples")){
+            output->setLightSamples((*itr)["lightsamples"].get<uint>());
+        }
+        if(itr->contains("threads")){
+            uint threadCount = (*itr)["threads"].get<uint>();
+            output->setThreads(threadCount);
+        }
+        if(itr->contains("bvhbuilder")){
+            std::string builder = (*itr)["bvhbuilder"].get<std::string>();
+            if(builder == "sah") output->setBVHBuilder(BVHBuilder::SAH);
+            else if(builder == "median") output->setBVHBuilder(BVHBuilder::MEDIAN);
+            else{
+                std::cout << "Exiting program: output bvhbuilder should be sah or median" << std::endl;
+                exit(1);
+            }
+        }
+        if(itr->contains("sahbins")){
+            uint bins = (*itr)["sahbins"].get<uint>();
+            if(bins < 2){
+                std::cout << "Exiting program: output sahbins should be at least 2" << std::endl;
+                exit(1);
+            }
+            output->setSAHBins(bins);
+        }
+        if(itr->contains("bvhwidth")){
+            uint width = (*itr)["bvhwidth"].get<uint>();
+            if(width != 2 && width != 4 && width != 8){
+                std::cout << "Exiting program: output bvhwidth should be 2, 4 or 8" << std::endl;
+                exit(1);
+            }
+            output->setBVHWidth(width);
+        }
+        if(itr->contains("bvhquantization")){
+            uint quantization = (*itr)["bvhquantization"].get<uint>();
+            if(quantization != 0 && quantization != 8 && quantization != 16){
+                std::cout << "Exiting program: output bvhquantization should be 0, 8 or 16" << std::endl;
+                exit(1);
+            }
+            if(quantization != 0 && output->getBVHWidth() == BVH::BINARY_WIDTH){
+                std::cout << "Exiting program: output bvhquantization needs a bvhwidth of 4 or 8" << std::endl;
+                exit(1);
+            }
+            output->setBVHQuantization(quantization);
+        }
+        if(itr->contains("packetsize")){
+            uint packetSize = (*itr)["packetsize"].get<uint>();
+            if(packetSize != 1 && packetSize != 2 && packetSize != 4 && packetSize != 8){
+                std::cout << "Exiting program: output packetsize should be 1, 2, 4 or 8" << std::endl;
+                exit(1);
+            }
+            output->setPacketSize(packetSize);
+        }
+        if(itr->contains("griddensity")){
+            float density = (*itr)["griddensity"].get<float>();
+            if(!(density > 0)){
+                std::cout << "Exiting program: output griddensity should be positive" << std::endl;
+                exit(1);
+            }
+            output->setGridDensity(density);
+        }
+        if(itr->contains("adaptivethreshold")){
+            float threshold = (*itr)["adaptivethreshold"].get<float>();
+            if(threshold < 0){
+                std::cout << "Exiting program: output adaptivethreshold is negative" << std::endl;
+                exit(1);
+            }
+            output->setAdaptiveThreshold(threshold);
+        }
+        if(itr->contains("maxspp")){
+            output->setMaxSamples((*itr)["maxspp"].get<uint>());
+        }
+        if(itr->contains("keyframes")){
+            CameraKeyframe initial;
+            initial.centre = centre;
+            initial.lookAt = lookAt;
+            initial.up = up;
+            output->setCameraKeyframes(CameraKeyframe::parse((*itr)["keyframes"], initial, "output " + fileName));
+            output->setFrame(0);
+        }
         scene.addOutput(output);
     }
 }
 
-void RayTracer::run(){
-    std::cout << "Loading the scene" << std::endl;
-    Parser parser;
-    std::cout << "Parsing geometry" << std::endl;
-    parser.parseGeometry(scene, json);
-    std::cout << "Parsing geometry completed!" << std::endl;
-    std::cout << "Parsing light" << std::endl;
-    parser.parseLight(scene, json);
-    std::cout << "Parsing light completed!" << std::endl;
-    std::cout << "Parsing output" << std::endl;
-    parser.parseOutput(scene, json);
-    std::cout << "Parsing output completed!" << std::endl;
+void Parser::parseAnimation(Scene &scene, nlohmann::json &json) {
+    if(!json.contains("animation")) return;
+    nlohmann::json& animation = json["animation"];
+    if(animation.contains("frames")){
+        int frames = animation["frames"].get<int>();
+        if(frames < 1){
+            std::cout << "Exiting program: animation frames should be at least 1" << std::endl;
+            exit(1);
+        }
+        scene.setFrameCount((uint)frames);
+    }
+    if(animation.contains("rebuildthreshold")){
+        float threshold = animation["rebuildthreshold"].get<float>();
+        if(threshold < 1){
+            std::cout << "Exiting program: animation rebuildthreshold should be at least 1" << std::endl;
+            exit(1);
+        }
+        scene.setRebuildThreshold(threshold);
+    }
+}
 
-    std::cout << "Generating image...." << std::endl;
-    //For each output
+void RayTracer::buildAccelerationStructures(ThreadPool &pool) {
+    bool built = false;
+    //The objects are built first, the instances trace their rays through them
+    uint objectNodes = 0;
+    for(uint i = 0; i < compiledScene->getObjectCount(); i++){
+        const CompiledScene& object = compiledScene->getObject(i);
+        BVH* bvh = cache ? cache->loadBVH(object, pool, BVHBuilder::SAH, OBJECT_BVH_BINS, i) : nullptr;
+        if(bvh == nullptr){
+            bvh = new BVH(object, pool, BVHBuilder::SAH, OBJECT_BVH_BINS);
+            built = true;
+        }
+        objectBVHs.emplace_back(bvh);
+        compiledScene->setObjectBVH(i, bvh);
+        objectNodes += bvh->getNodeCount();
+    }
+    if(!objectBVHs.empty()){
+        std::cout << "Object BVHs " << (built ? "built" : "read from the cache") << " for " << objectBVHs.size() << " object(s) with "
+                  << objectNodes << " nodes, " << compiledScene->getInstanceCount() << " instance(s)" << std::endl;
+    }
     for(auto output : scene.getOutput()){
-        //Image size
-        const uint imgWidth = output->getSize()[0];
-        const uint imgHeight = output->getSize()[1];
-        //Buffer that holds image
-        std::vector<double> buffer(3 * imgWidth * imgHeight);
-        std::string fileName = output->getFileName();
-        //Pixel color
-        Color color(0.0,0.0,0.0);
-        const auto origin = output->getCenter();
-        //Normalising lookAt, up and rightVec
-        const auto lookAt = output->getLookAt().normalized();
-        const auto up = output->getUp().normalized();
-        const auto rightVec = lookAt.cross(up).normalized();
-        const float PI = M_PI;
-        const float fov = output->getFOV() * PI/180;
-        const auto A = origin + lookAt;
-        const auto B = A + tan(fov/2) * up;
-        const float delta = 2 * tan(fov/2) / imgHeight;
-        auto C = B - ((imgWidth/2) * delta * rightVec);
-        for(auto it: scene.getSceneObjects()){
-            if(it == nullptr){
-                std::cout << "NULL" << std::endl;
-            }
-        }
-        for(int w = 0; w < imgWidth;w++){
-            for(int h = 0; h < imgHeight; h++) {
-                //Pixel we are looking at
-                Eigen::Vector3f pixel = C + (w * delta + delta / 2) * rightVec - (h * delta + delta / 2) * up;
-                Ray ray(origin, pixel - origin);
-                bool intersected = false;
-                bool isInShadow = false;
-                //Current value of t is infinity
-                float closestT = std::numeric_limits<float>::infinity();
-                int closestGeometryPosition = -1;
-                for (int k = 0; k < scene.getSceneObjects().size(); k++) {
-                    auto* geometry = scene.getSceneObjects().at(k);
-                    if (geometry->intersect(ray) && geometry->getT() < closestT) {
-                        intersected = true;
-                        //updating t to its smallest value
-                        closestT = geometry->getT();
-                        closestGeometryPosition = k;
-                    }
-                }
-
-                //Determining color of pixel
-                if (intersected) {
-                    Eigen::Vector3f intersectionPoint = ray.at(closestT);
-                    auto* closestGeometry = scene.getSceneObjects().at(closestGeometryPosition);
-                    //Finding normal of closest geometry
-                    Eigen::Vector3f outwardNormal;
-                    if(closestGeometry->getType() == Type::SPHERE){
-                        auto* sphere = dynamic_cast<Sphere*>(closestGeometry);
-                        outwardNormal = (ray.at(closestT) - sphere->getCenter()).normalized();
-                    }
-                    else if(closestGeometry->getType() == Type::RECTANGLE){
-                        auto* rectangle = dynamic_cast<Rectangle*>(closestGeometry);
-                        outwardNormal = ((rectangle->getP2() - rectangle->getP1()).cross(rectangle->getP3() - rectangle->getP1())).normalized();
-                    }
-                    else{
-                        std::cout << "Exiting program: Error at line 396 RayTracer.h" << std::endl;
-                        exit(1);
-                    }
-                    //Reversing normal if its not facing away from the ray
-                    auto normal = (ray.getDirection().dot(outwardNormal) < 0)? outwardNormal : -outwardNormal;
-                    //Ambient light
-                    Eigen::Vector3f colorVector = closestGeometry->getAc().cwiseProduct(output->getAI()) * closestGeometry->getKa();
-                    color = Color(colorVector);
-                    //Blinn-Phong light calculation
-                    for(auto* light: scene.getSceneLights()){
-                        isInShadow = false;
-                        if(light->getType() == LightType::POINT){
-                            auto* pointLight = dynamic_cast<Point*>(light);
-                            Ray shadowRay(intersectionPoint, (pointLight->getCenter() - intersectionPoint).normalized());
-                            for (auto geometry : scene.getSceneObjects()) {
-                                if(geometry->intersect(shadowRay) && geometry->getT() >= 0){
-                                    isInShadow = true;
-                                    break;
-                                }
-                            }
-                        }
-                        if(!isInShadow){
-                            Eigen::Vector3f newColorVector = color.getColorVector() + calculateColorChangeUsingPhong(ray, output, intersectionPoint, light, normal, closestGeometry);
-                            color = Color(newColorVector);
-                        }
-                    }
-                }
-                //If ray does not intersect, pixel colour = background colour
-                else color = Color(output->getBKC());
-                //Update buffer
-                color.write(buffer, 3 * h * imgWidth + 3 * w);
-            }
+        if(output->getSpeedUp() != 1) continue;
+        //Outputs sharing the same builder settings and layout share the same BVH
+        const auto key = getBVHKey(output);
+        if(bvhs.count(key) > 0) continue;
+        const BVHBuilder builder = std::get<0>(key);
+        //The layouts of the same builder settings have the same binary nodes, they are built or read once and copied
+        const BVH* tree = nullptr;
+        for(auto& entry : bvhs){
+            if(std::get<0>(entry.first) != builder || std::get<1>(entry.first) != std::get<1>(key)) continue;
+            tree = entry.second.get();
+            break;
+        }
+        BVH* bvh = tree != nullptr ? new BVH(*tree) : nullptr;
+        if(bvh == nullptr && cache) bvh = cache->loadBVH(*compiledScene, pool, builder, std::get<1>(key));
+        if(tree != nullptr){
+            std::cout << "BVH (" << BVH::builderName(builder) << ") copied from the BVH of another output with " << bvh->getNodeCount() << " nodes" << std::endl;
+        }
+        else if(bvh != nullptr){
+            std::cout << "BVH (" << BVH::builderName(builder) << ") read from the cache with " << bvh->getNodeCount() << " nodes" << std::endl;
         }
-        //Saving image to ppm file
-        std::cout << "Saving image to ppm file" << std::endl;
-        save_ppm(fileName, buffer, imgWidth, imgHeight);
+        else{
+            std::cout << "Building BVH (" << BVH::builderName(builder) << ")" << std::endl;
+            bvh = new BVH(*compiledScene, pool, builder, std::get<1>(key));
+            std::cout << "BVH built with " << bvh->getNodeCount() << " nodes, " << bvh->getLeafCount() << " leaves and depth " << bvh->getDepth()
+                      << " in " << bvh->getBuildTime() << " second(s), expected traversal cost " << bvh->getTraversalCost() << std::endl;
+            built = true;
+        }
+        bvhs[key].reset(bvh);
+        if(std::get<2>(key) == BVH::BINARY_WIDTH) continue;
+        bvh->setWidth(std::get<2>(key), std::get<3>(key));
+        std::cout << "BVH collapsed to width " << bvh->getWidth();
+        if(bvh->getQuantization() != 0) std::cout << " (" << bvh->getQuantization() << " bit bounds)";
+        std::cout << " with " << bvh->getTraversalNodeCount() << " nodes (" << bvh->getTraversalNodeBytes() / 1024
+                  << " KB), expected traversal cost " << bvh->getWideTraversalCost();
+        if(bvh->getQuantization() != 0){
+            //Penalty of the quantization : the decoded boxes are larger so more of them are hit
+            std::cout << ", " << bvh->getQuantizedTraversalCost() << " with the quantized bounds (+"
+                      << 100 * (bvh->getQuantizedTraversalCost() / bvh->getWideTraversalCost() - 1) << "%)";
+        }
+        std::cout << std::endl;
+    }
+    for(auto output : scene.getOutput()){
+        if(output->getSpeedUp() != 2 || grids.count(output->getGridDensity()) > 0) continue;
+        //Outputs with the same density share the same grid, the primitives are in the cells their boxes overlap
+        UniformGrid* grid = new UniformGrid(*compiledScene, pool, output->getGridDensity());
+        const uint* resolution = grid->getResolution();
+        std::cout << "Grid built with " << resolution[0] << "x" << resolution[1] << "x" << resolution[2] << " cells ("
+                  << grid->getEmptyCellCount() << " empty), " << grid->getReferenceCount() << " references (" << grid->getBytes() / 1024
+                  << " KB) in " << grid->getBuildTime() << " second(s)" << std::endl;
+        grids[output->getGridDensity()].reset(grid);
+    }
+    if(cache && !(cache->isOpen() && !built)) saveCache();
+    //The BVHs of a scene without animation are never refitted, the wide ones no longer need their binary nodes
+    if(compiledScene->getAnimatedInstanceCount() == 0){
+        for(auto& entry : bvhs) entry.second->releaseBinaryNodes();
     }
 }
 
+void RayTracer::saveCache() {
+    //The cache keeps every BVH built so far, including the ones read from the previous cache
+    std::vector<const BVH*> cachedBVHs, cachedObjectBVHs;
+    //The BVHs differing only by their layout have the same binary nodes, the cache keeps one of them
+    std::set<std::pair<BVHBuilder, uint>> cachedKeys;
+    for(auto& entry : bvhs){
+        if(cachedKeys.insert(std::make_pair(std::get<0>(entry.first), std::get<1>(entry.first))).second) cachedBVHs.push_back(entry.second.get());
+    }
+    for(auto& bvh : objectBVHs) cachedObjectBVHs.push_back(bvh.get());
+    if(cache->save(*compiledScene, json, cachedBVHs, cachedObjectBVHs)) std::cout << "Scene cache written to " << cache->getPath() << std::endl;
+    else std::cout << "Warning : the scene cache " << cache->getPath() << " could not be written" << std::endl;
+}
 
+const AccelerationStructure *RayTracer::getAccelerationStructure(Output *output) {
+    if(output->getSpeedUp() == 1) return bvhs.at(getBVHKey(output)).get();
+    if(output->getSpeedUp() == 2) return grids.at(output->getGridDensity()).get();
+    return nullptr;
+}
 
+std::tuple<BVHBuilder, uint, uint, uint> RayTracer::getBVHKey(Output *output) {
+    return std::make_tuple(output->getBVHBuilder(), output->getBVHBuilder() == BVHBuilder::SAH ? output->getSAHBins() : 0u,
+                           output->getBVHWidth(), output->getBVHQuantization());
+}
 
+bool RayTracer::closestHit(const AccelerationStructure *structure, const Ray &ray, float tMin, float tMax, HitRecord &hit) {
+    if(structure != nullptr) return structure->intersect(ray, tMin, tMax, hit);
+    return compiledScene->closestHit(ray, tMin, tMax, hit);
+}
 
+bool RayTracer::inShadow(const AccelerationStructure *structure, const Ray &shadowRay, float tMin, float tMax) {
+    if(structure != nullptr) return structure->occluded(shadowRay, tMin, tMax);
+    return compiledScene->occluded(shadowRay, tMin, tMax);
+}
 
+void RayTracer::inShadow(const AccelerationStructure *structure, RayPacket &shadowRays, float tMin) {
+    if(structure != nullptr){
+        structure->occluded(shadowRays, tMin);
+        return;
+    }
+    for(uint i = 0; i < shadowRays.size; i++){
+        Ray shadowRay(Eigen::Vector3f(shadowRays.ox[i], shadowRays.oy[i], shadowRays.oz[i]),
+                      Eigen::Vector3f(shadowRays.dx[i], shadowRays.dy[i], shadowRays.dz[i]));
+        if(compiledScene->occluded(shadowRay, tMin, shadowRays.tMax[i])) shadowRays.primitiveId[i] = 0;
+    }
+}
 
+RayTracer::SamplePattern RayTracer::getSamplePattern(Output *output) {
+    SamplePattern pattern;
+    std::vector<uint>& raysPerPixel = output->getRPP();
+    //Without antialiasing or global illumination a single ray goes through the center of the pixel
+    if(!output->getAntiAliasing() && !output->getGlobalIllum()) return pattern;
+    pattern.jitter = true;
+    //One value --> that many jittered rays anywhere in the pixel, two values --> grid of a x b cells with one jittered ray each
+    if(raysPerPixel.size() == 1) pattern.perCell = std::max(1u, raysPerPixel[0]);
+    else if(raysPerPixel.size() >= 2){
+        pattern.gridX = std::max(1u, raysPerPixel[0]);
+        pattern.gridY = std::max(1u, raysPerPixel[1]);
+    }
+    else pattern.gridX = pattern.gridY = DEFAULT_GRID_SIZE;
+    return pattern;
+}
 
+void RayTracer::getSampleOffset(const SamplePattern &pattern, uint sample, Sampler &sampler, float &dx, float &dy) {
+    if(!pattern.jitter){
+        dx = dy = 0.5f;
+        return;
+    }
+    float u, v;
+    sampler.get2D(u, v);
+    //Samples past the count of the pattern, added by adaptive sampling, go through the cells again
+    const uint cell = (sample / pattern.perCell) % (pattern.gridX * pattern.gridY);
+    dx = (cell % pattern.gridX + u) / pattern.gridX;
+    dy = (cell / pattern.gridX + v) / pattern.gridY;
+}
 
+Color RayTracer::tracePixel(Output *output, const AccelerationStructure *structure, const Camera &camera, const SamplePattern &pattern, uint w, uint h, uint sample) {
+    Sampler sampler(output->getSampler(), output->getSeed());
+    sampler.startSample(w, h, sample);
+    float dx, dy;
+    getSampleOffset(pattern, sample, sampler, dx, dy);
+    Ray ray = camera.generateRay(w, h, dx, dy);
+    HitRecord hit;
+    //If ray does not intersect, pixel colour = background colour
+    if (!closestHit(structure, ray, 0, std::numeric_limits<float>::infinity(), hit)) return Color(output->getBKC());
+    return output->getGlobalIllum() ? tracePath(output, structure, ray, hit, sampler) : shade(output, structure, ray, hit, sampler);
+}
 
+void RayTracer::traceBlock(Output *output, const AccelerationStructure *structure, const Camera &camera, const SamplePattern &pattern, uint startW, uint startH,
+                           uint endW, uint endH, uint sample, SampleAccumulator &accumulator) {
+    RayPacket packet;
+    //Sampler of every pixel of the block, used for its ray and then for its shading
+    Sampler samplers[RayPacket::MAX_SIZE];
+    for(uint h = startH; h < endH; h++){
+        for(uint w = startW; w < endW; w++){
+            Sampler& sampler = samplers[packet.size];
+            sampler = Sampler(output->getSampler(), output->getSeed());
+            sampler.startSample(w, h, sample);
+            float dx, dy;
+            getSampleOffset(pattern, sample, sampler, dx, dy);
+            Ray ray = camera.generateRay(w, h, dx, dy);
+            packet.setRay(packet.size++, ray.getOrigin().data(), ray.getDirection().data(), std::numeric_limits<float>::infinity());
+        }
+    }
+    structure->intersect(packet, 0);
+    uint i = 0;
+    for(uint h = startH; h < endH; h++){
+        for(uint w = startW; w < endW; w++, i++){
+            Ray ray(Eigen::Vector3f(packet.ox[i], packet.oy[i], packet.oz[i]), Eigen::Vector3f(packet.dx[i], packet.dy[i], packet.dz[i]));
+            HitRecord hit;
+            Color color = Color(output->getBKC());
+            //The packet only keeps the closest primitive and its distance, the scalar test fills the hit record
+            if(compiledScene->fillPacketHit(packet.primitiveId[i], ray, 0, packet.tMax[i], hit)){
+                color = output->getGlobalIllum() ? tracePath(output, structure, ray, hit, samplers[i]) : shade(output, structure, ray, hit, samplers[i]);
+            }
+            accumulator.add(w, h, color);
+        }
+    }
+}
 
+Color RayTracer::shade(Output *output, const AccelerationStructure *structure, Ray &ray, const HitRecord &hit, Sampler &sampler) {
+    //Determining color of pixel
+    Eigen::Vector3f intersectionPoint = ray.at(hit.t);
+    const Material& material = compiledScene->getMaterial(hit.primitiveId);
+    const Eigen::Vector3f& outwardNormal = hit.normal;
+    //Reversing normal if its not facing away from the ray
+    auto normal = (ray.getDirection().dot(outwardNormal) < 0)? outwardNormal : -outwardNormal;
+    //Ambient light
+    Eigen::Vector3f colorVector = material.ac.cwiseProduct(output->getAI()) * material.ka;
+    Color color = Color(colorVector);
+    //Blinn-Phong light calculation
+    forEachLight(output, intersectionPoint, normal, sampler, [&](Light* light, float weight){
+        Eigen::Vector3f newColorVector = color.getColorVector() + shadeLight(output, structure, ray, intersectionPoint, light, normal, material, sampler) * weight;
+        color = Color(newColorVector);
+    });
+    return color;
+}
 
+Eigen::Vector3f RayTracer::shadeLight(Output *output, const AccelerationStructure *structure, Ray &ray, const Eigen::Vector3f &intersectionPoint, Light *light,
+                                      Eigen::Vector3f &normal, const Material &material, Sampler &sampler) {
+    if(light->getType() == LightType::AREA) return shadeAreaLight(output, structure, ray, intersectionPoint, static_cast<Area*>(light), normal, material, sampler);
+    if(light->getType() != LightType::POINT) return Eigen::Vector3f(0, 0, 0);
+    auto* pointLight = static_cast<Point*>(light);
+    const Eigen::Vector3f toLight = pointLight->getCenter() - intersectionPoint;
+    const float lightDistance = toLight.norm();
+    //The shadow ray leaves from just above the side of the surface facing the light so that the rounding
+    //error of the hit point cannot make the surface shadow itself, only geometries before the light occlude it
+    const Eigen::Vector3f offset = (normal.dot(toLight) < 0 ? -normal : normal) * getShadowOffset(intersectionPoint);
+    Ray shadowRay(intersectionPoint + offset, toLight / lightDistance);
+    if(inShadow(structure, shadowRay, SHADOW_EPSILON, lightDistance)) return Eigen::Vector3f(0, 0, 0);
+    return calculateColorChangeUsingPhong(ray, output, intersectionPoint, pointLight->getCenter(), light->getId(), light->getIs(), normal, material);
+}
 
+Color RayTracer::tracePath(Output *output, const AccelerationStructure *structure, Ray &ray, const HitRecord &hit, Sampler &sampler) {
+    const float probTerminate = output->getProbTerminate();
+    Eigen::Vector3f radiance(0, 0, 0);
+    //Product of the reflectances of the surfaces met by the path so far
+    Eigen::Vector3f throughput(1, 1, 1);
+    Ray pathRay = ray;
+    HitRecord pathHit = hit;
+    for(uint bounce = 0; ; bounce++){
+        const Eigen::Vector3f intersectionPoint = pathRay.at(pathHit.t);
+        const Material& material = compiledScene->getMaterial(pathHit.primitiveId);
+        Eigen::Vector3f normal = (pathRay.getDirection().dot(pathHit.normal) < 0) ? pathHit.normal : -pathHit.normal;
+        //Next event estimation : the light reaching the hit point straight from the lights
+        forEachLight(output, intersectionPoint, normal, sampler, [&](Light* light, float weight){
+            radiance += (throughput * weight).cwiseProduct(shadeLight(output, structure, pathRay, intersectionPoint, light, normal, material, sampler));
+        });
+        if(bounce >= output->getMaxBounces()) break;
+        //Russian roulette, the surviving paths carry the light of the terminated ones
+        if(sampler.get1D() < probTerminate) break;
+        //With cosine weighted directions the cosine and the pdf cancel out, only the diffuse reflectance is left
+        throughput = throughput.cwiseProduct(material.dc) * (material.kd / (1 - probTerminate));
+        if(throughput.maxCoeff() <= 0) break;
+        //The light coming from the lights themselves is already counted by the next event estimation
+        float u1, u2;
+        sampler.get2D(u1, u2);
+        const Eigen::Vector3f direction = sampleCosineHemisphere(normal, u1, u2);
+        pathRay = Ray(intersectionPoint + normal * getShadowOffset(intersectionPoint), direction);
+        if(!closestHit(structure, pathRay, 0, std::numeric_limits<float>::infinity(), pathHit)) break;
+    }
+    return Color(radiance);
+}
 
+Eigen::Vector3f RayTracer::sampleCosineHemisphere(const Eigen::Vector3f &normal, float u1, float u2) {
+    //Orthonormal basis around the normal (Duff et al., Building an Orthonormal Basis, Revisited)
+    const float sign = std::copysign(1.0f, normal.z());
+    const float a = -1.0f / (sign + normal.z());
+    const float b = normal.x() * normal.y() * a;
+    const Eigen::Vector3f tangent(1.0f + sign * normal.x() * normal.x() * a, sign * b, -sign * normal.x());
+    const Eigen::Vector3f bitangent(b, sign + normal.y() * normal.y() * a, -normal.y());
+    //Uniform point on the unit disk projected up to the hemisphere
+    const float radius = std::sqrt(u1);
+    const float phi = 2 * (float)M_PI * u2;
+    const float x = radius * std::cos(phi);
+    const float y = radius * std::sin(phi);
+    const float z = std::sqrt(std::max(0.0f, 1 - u1));
+    return (x * tangent + y * bitangent + z * normal).normalized();
+}
 
+Eigen::Vector3f RayTracer::shadeAreaLight(Output *output, const AccelerationStructure *structure, Ray &ray, const Eigen::Vector3f &intersectionPoint, Area *light,
+                                          Eigen::Vector3f &normal, const Material &material, Sampler &sampler) {
+    //One sample in the middle of each cell of the n x n grid, or a single one at the center of the light
+    const uint n = light->getUseCenter() ? 1 : light->getN();
+    const uint sampleCount = n * n;
+    //The intensity of the light is shared between its samples
+    const Eigen::Vector3f id = light->getId() / (float)sampleCount;
+    const Eigen::Vector3f is = light->getIs() / (float)sampleCount;
+    const float offsetLength = getShadowOffset(intersectionPoint);
+    Eigen::Vector3f colorVector(0, 0, 0);
+    RayPacket shadowRays;
+    Eigen::Vector3f samples[RayPacket::MAX_SIZE];
+    //The shadow rays of the samples are tested together, one packet at a time
+    for(uint first = 0; first < sampleCount; first += RayPacket::MAX_SIZE){
+        shadowRays.size = 0;
+        for(uint sample = first; sample < std::min(first + RayPacket::MAX_SIZE, sampleCount); sample++){
+            Eigen::Vector3f& samplePoint = samples[shadowRays.size];
+            if(light->getUseCenter()) samplePoint = light->getCenter();
+            else{
+                float u, v;
+                sampler.get2D(u, v);
+                samplePoint = light->samplePoint((sample % n + u) / n, (sample / n + v) / n);
+            }
+            const Eigen::Vector3f toLight = samplePoint - intersectionPoint;
+            const float lightDistance = toLight.norm();
+            const Eigen::Vector3f origin = intersectionPoint + (normal.dot(toLight) < 0 ? -normal : normal) * offsetLength;
+            const Eigen::Vector3f direction = toLight / lightDistance;
+            shadowRays.setRay(shadowRays.size++, origin.data(), direction.data(), lightDistance);
+        }
+        inShadow(structure, shadowRays, SHADOW_EPSILON);
+        for(uint i = 0; i < shadowRays.size; i++){
+            if(shadowRays.primitiveId[i] < 0) colorVector += calculateColorChangeUsingPhong(ray, output, intersectionPoint, samples[i], id, is, normal, material);
+        }
+    }
+    return colorVector;
+}
 
+void RayTracer::run(){
+    std::cout << "Loading the scene" << std::endl;
+    Parser parser;
+    //The streaming loader already compiled the geometry
+    if(!compiledScene){
+        std::cout << "Parsing geometry" << std::endl;
+        parser.parseGeometry(scene, json);
+        std::cout << "Parsing geometry completed!" << std::endl;
+        compiledScene.reset(new CompiledScene(scene.getSceneObjects()));
+    }
+    std::cout << "Parsing light" << std::endl;
+    parser.parseLight(scene, json);
+    std::cout << "Parsing light completed!" << std::endl;
+    std::cout << "Parsing output" << std::endl;
+    parser.parseOutput(scene, json);
+    std::cout << "Parsing output completed!" << std::endl;
+    parser.parseAnimation(scene, json);
+
+    std::cout << "Compiled " << compiledScene->getSphereCount() << " sphere(s), " << compiledScene->getQuadCount() << " rectangle(s), "
+              << compiledScene->getTriangleCount() << " triangle(s) in " << compiledScene->getMeshCount() << " mesh(es), "
+              << compiledScene->getInstanceCount() << " instance(s) of " << compiledScene->getObjectCount() << " object(s) and "
+              << compiledScene->getMaterialCount() << " material(s)" << std::endl;
+    std::cout << "Intersection kernels: " << SimdKernels::levelName(SimdKernels::get().level) << std::endl;
+    //The BVHs are built and all the outputs are rendered on the same pool
+    ThreadPool pool(getThreadCount());
+    buildAccelerationStructures(pool);
+    for(auto output : scene.getOutput()){
+        if(output->getLightSamples() == 0 || lightBVH) continue;
+        lightBVH.reset(new LightBVH(scene.getSceneLights()));
+        std::cout << "Light BVH built over " << scene.getSceneLights().size() << " light(s) with " << lightBVH->getNodeCount() << " nodes" << std::endl;
+    }
+    for(auto output : scene.getOutput()){
+        if(!output->getGlobalIllum() || !output->getWavefront()) continue;
+        sceneBounds = compiledScene->getSceneBounds();
+        sceneBounds.pad();
+        break;
+    }
 
+    std::cout << "Generating image...." << std::endl;
+    //One job per output, their tiles are numbered one job after the other
+    std::vector<std::unique_ptr<RenderJob>> jobs;
+    uint tileCount = 0;
+    for(auto output : scene.getOutput()){
+        jobs.emplace_back(new RenderJob(output));
+        RenderJob& job = *jobs.back();
+        //Image size
+        job.width = output->getSize()[0];
+        job.height = output->getSize()[1];
+        //Sum of the samples of every pixel
+        job.accumulator.reset(new SampleAccumulator(job.width, job.height));
+        job.pattern = getSamplePattern(output);
+        job.sampleCount = job.pattern.getCount();
+        //Adaptive sampling keeps adding samples to the pixels whose confidence interval is wider than the threshold
+        job.adaptive = job.pattern.jitter && output->getAdaptiveThreshold() > 0;
+        job.maxSamples = std::max(job.sampleCount, output->getMaxSamples() != 0 ? output->getMaxSamples() : DEFAULT_MAX_SAMPLE_FACTOR * job.sampleCount);
+        job.structure = getAccelerationStructure(output);
+        //Packets of primary rays only traverse the BVH, without it the SIMD kernels already test several primitives per ray
+        //and the grid traces the rays of a packet one by one
+        job.packetSize = output->getSpeedUp() == 1 ? output->getPacketSize() : 1;
+        //Splitting the image into tiles, each tile is rendered by one worker
+        //Every pixel only depends on its own coordinates so the image does not depend on the scheduling
+        job.tilesX = (job.width + TILE_SIZE - 1) / TILE_SIZE;
+        job.firstTile = tileCount;
+        tileCount += job.tilesX * ((job.height + TILE_SIZE - 1) / TILE_SIZE);
+        std::cout << output->getFileName() << ": " << tileCount - job.firstTile << " tiles with " << job.sampleCount
+                  << " sample(s) per pixel (" << Sampler::typeName(output->getSampler()) << " sampler)";
+        if(job.adaptive) std::cout << ", up to " << job.maxSamples << " where the confidence interval is wider than " << output->getAdaptiveThreshold();
+        std::cout << std::endl;
+        //Wavefront path tracing of global illumination, one integrator per worker
+        if(output->getGlobalIllum() && output->getWavefront()){
+            for(uint i = 0; i < pool.getThreadCount(); i++) job.integrators.emplace_back(new WavefrontIntegrator(*this, output, job.structure, job.camera, sceneBounds));
+        }
+    }
+    const uint frameCount = scene.getFrameCount();
+    if(frameCount > 1) std::cout << "Animation of " << frameCount << " frames with " << compiledScene->getAnimatedInstanceCount() << " animated instance(s)" << std::endl;
+    for(uint frame = 0; frame < frameCount; frame++){
+        auto start = std::chrono::steady_clock::now();
+        //The first frame is the pose the scene was loaded and its BVHs built with
+        if(frame > 0) setFrame(frame, jobs);
+        auto rendering = std::chrono::steady_clock::now();
+        std::cout << "Rendering " << tileCount << " tiles of " << jobs.size() << " output(s) on " << pool.getThreadCount() << " thread(s)" << std::endl;
+        //The tiles of all the outputs share the pool, so the workers stay busy until the last tile of the last image
+        pool.parallelFor(tileCount, [&](uint tile, uint worker){
+            uint index = 0;
+            while(index + 1 < jobs.size() && jobs[index + 1]->firstTile <= tile) index++;
+            renderTile(*jobs[index], tile - jobs[index]->firstTile, worker);
+        });
+        if(frameCount > 1){
+            std::chrono::duration<double> setupTime = rendering - start, renderTime = std::chrono::steady_clock::now() - rendering;
+            std::cout << "Frame " << frame << ": setup " << setupTime.count() << " second(s), rendering " << renderTime.count() << " second(s)" << std::endl;
+        }
+        for(auto& job : jobs){
+            //Average of the samples of every pixel
+            std::vector<double> buffer(3 * job->width * job->height);
+            job->accumulator->write(buffer);
+            if(job->adaptive) std::cout << job->output->getFileName() << ": average samples per pixel: " << job->accumulator->getAverageCount()
+                                        << " (fixed sampling: " << job->maxSamples << ")" << std::endl;
+            //Saving image to ppm file
+            const std::string fileName = frameCount > 1 ? getFrameFileName(job->output->getFileName(), frame) : job->output->getFileName();
+            std::cout << "Saving image to ppm file " << fileName << std::endl;
+            save_ppm(fileName, buffer, job->width, job->height);
+        }
+    }
+}
 
+void RayTracer::setFrame(uint frame, std::vector<std::unique_ptr<RenderJob>> &jobs) {
+    //The objects are rigid, only the transforms of the instances and the top level BVHs over them change
+    if(compiledScene->getAnimatedInstanceCount() > 0){
+        compiledScene->setFrame((float)frame);
+        for(auto& entry : bvhs){
+            const uint rebuilt = entry.second->refit(scene.getRebuildThreshold());
+            if(rebuilt > 0) std::cout << "BVH (" << BVH::builderName(std::get<0>(entry.first)) << ") refitted, " << rebuilt << " subtree(s) rebuilt" << std::endl;
+        }
+        //Building a grid costs about as much as refitting it
+        for(auto& entry : grids) entry.second->build();
+        //Only computed for the wavefront integrators, assigned in place as they keep a reference to them
+        if(!sceneBounds.isEmpty()){
+            sceneBounds = compiledScene->getSceneBounds();
+            sceneBounds.pad();
+        }
+    }
+    for(auto& job : jobs){
+        job->output->setFrame((float)frame);
+        //Assigned in place, the wavefront integrators keep a reference to the camera
+        job->camera = Camera(*job->output);
+        job->accumulator.reset(new SampleAccumulator(job->width, job->height));
+    }
+}
 
+std::string RayTracer::getFrameFileName(const std::string &fileName, uint frame) {
+    const std::string number = std::to_string(frame);
+    const std::string suffix = "_" + std::string(number.size() < 4 ? 4 - number.size() : 0, '0') + number;
+    const size_t extension = fileName.find_last_of('.');
+    const size_t separator = fileName.find_last_of('/');
+    if(extension == std::string::npos || (separator != std::string::npos && extension < separator)) return fileName + suffix;
+    return fileName.substr(0, extension) + suffix + fileName.substr(extension);
+}
 
+void RayTracer::renderTile(RenderJob &job, uint tile, uint worker) {
+    Output* output = job.output;
+    SampleAccumulator& accumulator = *job.accumulator;
+    const uint startW = (tile % job.tilesX) * TILE_SIZE;
+    const uint startH = (tile / job.tilesX) * TILE_SIZE;
+    const uint endW = std::min(startW + TILE_SIZE, job.width);
+    const uint endH = std::min(startH + TILE_SIZE, job.height);
+    if(!job.integrators.empty()) job.integrators[worker]->renderTile(job.pattern, startW, startH, endW, endH, job.sampleCount, accumulator);
+    //The worker traces every sample of its tile, one pass over the tile per sample so that the rays of a pass stay coherent
+    for(uint sample = 0; sample < job.sampleCount && job.integrators.empty(); sample++){
+        if(job.packetSize > 1){
+            for(uint h = startH; h < endH; h += job.packetSize){
+                for(uint w = startW; w < endW; w += job.packetSize){
+                    traceBlock(output, job.structure, job.camera, job.pattern, w, h, std::min(w + job.packetSize, endW), std::min(h + job.packetSize, endH),
+                               sample, accumulator);
+                }
+            }
+            continue;
+        }
+        for(uint h = startH; h < endH; h++){
+            for(uint w = startW; w < endW; w++){
+                accumulator.add(w, h, tracePixel(output, job.structure, job.camera, job.pattern, w, h, sample));
+            }
+        }
+    }
+    if(!job.adaptive) return;
+    //Noisy pixels, like shadow edges, get more samples one at a time until they converge
+    for(uint h = startH; h < endH; h++){
+        for(uint w = startW; w < endW; w++){
+            for(uint sample = accumulator.getCount(w, h); sample < job.maxSamples && accumulator.getConfidence(w, h) > output->getAdaptiveThreshold(); sample++){
+                accumulator.add(w, h, tracePixel(output, job.structure, job.camera, job.pattern, w, h, sample));
+            }
+        }
+    }
+}
 
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
+uint RayTracer::getThreadCount() {
+    //Command line value takes precedence over the values of the outputs
+    if(threads != 0) return threads;
+    uint count = 0;
+    for(auto output : scene.getOutput()){
+        //0 --> one per hardware thread
+        if(output->getThreads() == 0) return 0;
+        count = std::max(count, output->getThreads());
+    }
+    return count;
+}
@@ -1,6 +1,7 @@
 #pragma once
 #include "../external/json.hpp"
 #include "../external/simpleppm.h"
+#include <chrono>
 #include <cmath>
 #include <iostream>
 #include <fstream>
@@ -8,62 +9,200 @@
 #include "Scene.h"
 #include "Color.h"
 #include "Geometry.h"
+#include "Camera.h"
+#include "ThreadPool.h"
+#include "BVH.h"
+#include "UniformGrid.h"
+#include "CompiledScene.h"
+#include "SampleAccumulator.h"
+#include "LightBVH.h"
+#include <map>
+#include <memory>
+#include <set>
+#include <tuple>
+#include "Sampler.h"
+#include "SceneLoader.h"
+
+class WavefrontIntegrator;
 
 class RayTracer{
 public:
-    explicit RayTracer(nlohmann::json& j);
+    //threads --> Number of worker threads given on the command line, 0 to use the values of the outputs
+    explicit RayTracer(nlohmann::json& j, uint threads = 0);
+    //Scene read by the streaming loader : its compiled geometry, the json of its lights and outputs and its binary cache
+    explicit RayTracer(SceneLoader& loader, uint threads = 0);
     void run();
+    //Width and height in pixels of the tiles handed to the worker threads
+    static const uint TILE_SIZE = 16;
+    //Minimum distance of a shadow ray hit, so that a surface does not shadow itself
+    static constexpr float SHADOW_EPSILON = 1e-4f;
+    //Grid of samples per pixel when antialiasing is enabled without raysperpixel
+    static const uint DEFAULT_GRID_SIZE = 4;
+    //Maximum samples per pixel of adaptive sampling without maxspp, as a multiple of the samples of the pattern
+    static const uint DEFAULT_MAX_SAMPLE_FACTOR = 4;
+    //Bins of the SAH builder of the BVHs of the objects of the instances
+    static const uint OBJECT_BVH_BINS = 16;
+    //Distance between a hit point and the origin of its shadow rays, grows with the coordinates like their rounding error
+    static float getShadowOffset(const Eigen::Vector3f& point){return SHADOW_EPSILON * (1 + point.cwiseAbs().maxCoeff());}
 private:
+    friend class WavefrontIntegrator;
     Scene scene;
     nlohmann::json& json;
+    uint threads;
+    //Geometry of the scene compiled into contiguous arrays once the scene is parsed
+    std::unique_ptr<CompiledScene> compiledScene;
+    //Binary cache of the scene file, nullptr when the scene was not read by the loader or caching is off
+    std::unique_ptr<SceneCache> cache;
+    //Acceleration structures over the scene objects, one per builder, bins, width and quantization used by the outputs with speedup set to 1
+    std::map<std::tuple<BVHBuilder, uint, uint, uint>, std::unique_ptr<BVH>> bvhs;
+    //Uniform grids over the scene objects, one per density used by the outputs with speedup set to 2
+    std::map<float, std::unique_ptr<UniformGrid>> grids;
+    //Bottom level BVH of every object of the instances, used whatever the speedup of the outputs
+    std::vector<std::unique_ptr<BVH>> objectBVHs;
+    //Hierarchy over the lights, built when an output has lightsamples set
+    std::unique_ptr<LightBVH> lightBVH;
+    //Padded bounds of the scene, computed when an output is path traced in waves and updated every frame of an animation
+    //The wavefront integrators keep a reference to them to quantize the ray origins of their sort keys
+    AABB sceneBounds;
+    //Builds the BVH of every object and of every output with speedup set to 1, or reads them from the cache
+    //The cache is rewritten when it was missing or a BVH had to be built, then the wide BVHs of a scene without
+    //animation free their binary nodes. The grids of the outputs with speedup set to 2 are built every run, they are not cached
+    void buildAccelerationStructures(ThreadPool& pool);
+    //Writes the compiled scene and its BVHs to the cache
+    void saveCache();
+    //BVH or grid used by the output, nullptr when the geometries are tested one by one
+    const AccelerationStructure* getAccelerationStructure(Output* output);
+    //Builder, bins of the SAH builder (0 for the median builder), width and quantization of the BVH of an output
+    static std::tuple<BVHBuilder, uint, uint, uint> getBVHKey(Output* output);
+    //Closest primitive hit by the ray in [tMin, tMax], searched with the structure or by testing every primitive when it is nullptr
+    bool closestHit(const AccelerationStructure* structure, const Ray& ray, float tMin, float tMax, HitRecord& hit);
+    //Returns true if any primitive is hit by the shadow ray in [tMin, tMax]
+    bool inShadow(const AccelerationStructure* structure, const Ray& shadowRay, float tMin, float tMax);
+    //Tests all the shadow rays of the packet in [tMin, tMax of the ray], the primitive id of the occluded rays is set to a value >= 0
+    void inShadow(const AccelerationStructure* structure, RayPacket& shadowRays, float tMin);
+    //Positions of the samples of a pixel : gridX x gridY cells, each with perCell samples
+    //Without jitter the only sample is at the center of the pixel
+    struct SamplePattern{
+        uint gridX = 1, gridY = 1, perCell = 1;
+        bool jitter = false;
+        uint getCount() const{return gridX * gridY * perCell;}
+    };
+    //Everything the workers need to render the tiles of one output
+    struct RenderJob{
+        Output* output;
+        Camera camera;
+        uint width = 0, height = 0;
+        SamplePattern pattern;
+        uint sampleCount = 0;
+        //Adaptive sampling and its maximum samples per pixel
+        bool adaptive = false;
+        uint maxSamples = 0;
+        const AccelerationStructure* structure = nullptr;
+        uint packetSize = 1;
+        uint tilesX = 0;
+        //Index of the first tile of the job among the tiles of all the jobs
+        uint firstTile = 0;
+        std::unique_ptr<SampleAccumulator> accumulator;
+        //Integrator of every worker when the output is path traced in waves
+        std::vector<std::unique_ptr<WavefrontIntegrator>> integrators;
+        explicit RenderJob(Output* output);
+        ~RenderJob();
+    };
+    //Moves the animated instances and cameras to a frame, then refits the BVHs and rebuilds the grids over the instances that moved
+    void setFrame(uint frame, std::vector<std::unique_ptr<RenderJob>>& jobs);
+    //File of an output for one frame of an animation, name_0007.ppm for frame 7
+    static std::string getFrameFileName(const std::string& fileName, uint frame);
+    //Renders one tile of the job with the worker
+    void renderTile(RenderJob& job, uint tile, uint worker);
+    //Workers of the pool : the command line value, or the largest value of the outputs (0 when one of them uses every hardware thread)
+    uint getThreadCount();
+    //Sample pattern given by the antialiasing and raysperpixel members of the output
+    static SamplePattern getSamplePattern(Output* output);
+    //Position (dx, dy) in the pixel of a sample, stratified in the cells of the pattern and jittered with the sampler
+    static void getSampleOffset(const SamplePattern& pattern, uint sample, Sampler& sampler, float& dx, float& dy);
+    //Color of one sample of pixel (w, h) seen by the camera of the output
+    Color tracePixel(Output* output, const AccelerationStructure* structure, const Camera& camera, const SamplePattern& pattern, uint w, uint h, uint sample);
+    //One sample of the pixels [startW, endW) x [startH, endH) added to the accumulator, their primary rays traverse the BVH as one packet
+    void traceBlock(Output* output, const AccelerationStructure* structure, const Camera& camera, const SamplePattern& pattern, uint startW, uint startH,
+                    uint endW, uint endH, uint sample, SampleAccumulator& accumulator);
+    //Color seen along the ray at its closest hit
+    //sampler --> Sampler of the pixel sample, drives the position of the light samples
+    Color shade(Output* output, const AccelerationStructure* structure, Ray& ray, const HitRecord& hit, Sampler& sampler);
+    //Calls shadeWith(light, weight) for the lights shading a point : every light with a weight of 1 or, when the output has fewer
+    //lightsamples than there are lights, that many lights picked by the light BVH with a weight of 1 / (pdf * lightsamples)
+    template<typename F>
+    void forEachLight(Output* output, const Eigen::Vector3f& point, const Eigen::Vector3f& normal, Sampler& sampler, F shadeWith);
+    //Light received from one light source, zero when it is in shadow
+    Eigen::Vector3f shadeLight(Output* output, const AccelerationStructure* structure, Ray& ray, const Eigen::Vector3f& intersectionPoint, Light* light,
+                               Eigen::Vector3f& normal, const Material& material, Sampler& sampler);
+    //Color seen along the ray with global illumination : path traced from its closest hit with cosine weighted diffuse bounces,
+    //next event estimation toward the lights at every bounce and Russian roulette termination
+    Color tracePath(Output* output, const AccelerationStructure* structure, Ray& ray, const HitRecord& hit, Sampler& sampler);
+    //Direction of the hemisphere around the normal with a density proportional to its cosine, from two uniform numbers in [0, 1)
+    static Eigen::Vector3f sampleCosineHemisphere(const Eigen::Vector3f& normal, float u1, float u2);
+    //Light received from an area light, averaged over stratified samples of its surface
+    Eigen::Vector3f shadeAreaLight(Output* output, const AccelerationStructure* structure, Ray& ray, const Eigen::Vector3f& intersectionPoint, Area* light,
+                                   Eigen::Vector3f& normal, const Material& material, Sampler& sampler);
     //static void save_ppm(const std::string &file_name, const std::vector<float> &buffer, uint dimx, uint dimy);
-    Color sendRay(Output* output);
-    static Eigen::Vector3f calculateColorChangeUsingPhong(Ray& ray,Output* output, const Eigen::Vector3f& intersectionPoint, Light* light, Eigen::Vector3f& normal, Geometry* closestGeometry);
+    //Blinn-Phong light of a light source at lightPosition with diffuse and specular intensity id and is
+    //ray --> ray reaching the shaded point, the camera ray or the last segment of a path, the surface is seen from its origin side
+    static Eigen::Vector3f calculateColorChangeUsingPhong(const Ray& ray,Output* output, const Eigen::Vector3f& intersectionPoint, const Eigen::Vector3f& lightPosition,
+                                                          const Eigen::Vector3f& id, const Eigen::Vector3f& is, Eigen::Vector3f& normal, const Material& material);
 };
 
 struct Parser{
     static void parseGeometry(Scene& scene, nlohmann::json& json);
     static void parseLight(Scene& scene, nlohmann::json& json);
     static void parseOutput(Scene& scene, nlohmann::json& json);
+    //Optional animation member : number of frames and rebuild threshold of the BVHs
+    static void parseAnimation(Scene& scene, nlohmann::json& json);
 };
 
-inline Eigen::Vector3f RayTracer::calculateColorChangeUsingPhong(Ray &ray,Output* output, const Eigen::Vector3f& intersectionPoint, Light *light, Eigen::Vector3f &normal, Geometry* closestGeometry) {
-    if(light->getType() == LightType::POINT){
-        auto* pointLight = dynamic_cast<Point*>(light);
-        // unit vector representing point of incidence to the camera object
-        Eigen::Vector3f vdir = (output->getCenter() - intersectionPoint).normalized();
-
-        // unit vector representing the point of incidence to the light object
-        Eigen::Vector3f ldir = (pointLight->getCenter() - intersectionPoint).normalized();
+inline Eigen::Vector3f RayTracer::calculateColorChangeUsingPhong(const Ray &ray,Output* output, const Eigen::Vector3f& intersectionPoint, const Eigen::Vector3f& lightPosition,
+                                                                 const Eigen::Vector3f& id, const Eigen::Vector3f& is, Eigen::Vector3f &normal, const Material& material) {
+    // unit vector representing point of incidence to the viewer, the camera or the previous vertex of a path
+    Eigen::Vector3f vdir = -ray.getDirection().normalized();
 
-        // 'half-way' vector (unit) halfway between ldir and vdir
-        Eigen::Vector3f hdir = (ldir + vdir).normalized();
+    // unit vector representing the point of incidence to the light object
+    Eigen::Vector3f ldir = (lightPosition - intersectionPoint).normalized();
 
-        // angle NL
-        float thetaNL = normal.dot(ldir);
-        // light intensity
-        float blinn = normal.dot(hdir);
+    // 'half-way' vector (unit) halfway between ldir and vdir
+    Eigen::Vector3f hdir = (ldir + vdir).normalized();
 
-        // clamp value of blinn btw/ 0 and 1
-        if (blinn > 1) blinn = 1;
-        else if (blinn < 0) blinn = 0;
+    // angle NL
+    float thetaNL = normal.dot(ldir);
+    // a light behind the surface would take light away from a path of global illumination
+    if (output->getGlobalIllum() && thetaNL < 0) thetaNL = 0;
+    // light intensity
+    float blinn = normal.dot(hdir);
 
-        // specular phong
-        float blinnPhong = pow(blinn, closestGeometry->getPc());
+    // clamp value of blinn btw/ 0 and 1
+    if (blinn > 1) blinn = 1;
+    else if (blinn < 0) blinn = 0;
 
-        // diffuse and specular I
-        Eigen::Vector3f Idd = light->getId().cwiseProduct(closestGeometry->getDc()) * closestGeometry->getKd() * thetaNL;
-        Color colorIDD = Color(Idd);
-        Eigen::Vector3f Ids = light->getIs().cwiseProduct(closestGeometry->getSc()) * closestGeometry->getKs()* blinnPhong;
-        Color colorIds = Color(Ids);
-        // diffuse and specular
-        return colorIDD.getColorVector() + colorIds.getColorVector();
-    }
+    // specular phong
+    float blinnPhong = pow(blinn, material.pc);
 
-    return Eigen::Vector3f{0,0,0};
-//    else{
-//        std::cout << "Exiting program: Light type not accepted as of right now" << std::endl;
-//        exit(1);
-//    }
+    // diffuse and specular I
+    Eigen::Vector3f Idd = id.cwiseProduct(material.dc) * material.kd * thetaNL;
+    Color colorIDD = Color(Idd);
+    Eigen::Vector3f Ids = is.cwiseProduct(material.sc) * material.ks * blinnPhong;
+    Color colorIds = Color(Ids);
+    // diffuse and specular
+    return colorIDD.getColorVector() + colorIds.getColorVector();
 }
 
+template<typename F>
+void RayTracer::forEachLight(Output *output, const Eigen::Vector3f &point, const Eigen::Vector3f &normal, Sampler &sampler, F shadeWith) {
+    std::vector<Light*>& lights = scene.getSceneLights();
+    const uint lightSamples = output->getLightSamples();
+    if(lightSamples == 0 || lightSamples >= lights.size()){
+        for(auto* light : lights) shadeWith(light, 1.0f);
+        return;
+    }
+    for(uint i = 0; i < lightSamples; i++){
+        float pdf;
+        const int light = lightBVH->sample(point, normal, sampler.get1D(), pdf);
+        if(light >= 0) shadeWith(lights[light], 1 / (pdf * lightSamples));
+    }
+}
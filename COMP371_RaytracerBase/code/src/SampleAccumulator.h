@@ -0,0 +1,50 @@
+#pragma once
+#include <vector>
+#include <cmath>
+#include <limits>
+#include "Color.h"
+
+//Sum of the samples of every pixel of an image, with the running mean and variance of their luminance (Welford)
+//A pixel is only updated by the worker rendering its tile, so no synchronisation is needed
+class SampleAccumulator{
+private:
+    uint width;
+    std::vector<float> sum;
+    std::vector<uint> count;
+    //Mean of the luminance of the samples and sum of the squared differences to the mean
+    std::vector<float> mean;
+    std::vector<float> m2;
+public:
+    SampleAccumulator(uint width, uint height) : width(width), sum(3 * width * height, 0.0f), count(width * height, 0),
+                                                  mean(width * height, 0.0f), m2(width * height, 0.0f){};
+    void add(uint w, uint h, const Color& color){
+        const uint pixel = h * width + w;
+        color.accumulate(sum, 3 * pixel);
+        const float luminance = 0.2126f * std::min(std::max(color.getRed(), 0.0f), 1.0f)
+                              + 0.7152f * std::min(std::max(color.getGreen(), 0.0f), 1.0f)
+                              + 0.0722f * std::min(std::max(color.getBlue(), 0.0f), 1.0f);
+        const uint n = ++count[pixel];
+        const float delta = luminance - mean[pixel];
+        mean[pixel] += delta / n;
+        m2[pixel] += delta * (luminance - mean[pixel]);
+    }
+    uint getCount(uint w, uint h) const{return count[h * width + w];}
+    //Half width of the 95% confidence interval of the mean luminance of the pixel, infinite with less than 2 samples
+    float getConfidence(uint w, uint h) const{
+        const uint pixel = h * width + w;
+        const uint n = count[pixel];
+        if(n < 2) return std::numeric_limits<float>::infinity();
+        return 1.96f * std::sqrt(m2[pixel] / ((n - 1) * (float)n));
+    }
+    //Average of the samples of every pixel
+    void write(std::vector<double>& buffer) const{
+        for(size_t pixel = 0; pixel < count.size(); pixel++){
+            for(uint i = 0; i < 3; i++) buffer[3 * pixel + i] = count[pixel] != 0 ? sum[3 * pixel + i] / count[pixel] : 0;
+        }
+    }
+    double getAverageCount() const{
+        double total = 0;
+        for(uint n : count) total += n;
+        return count.empty() ? 0 : total / count.size();
+    }
+};
@@ -0,0 +1,200 @@
+#include "Sampler.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+uint32_t reverseBits(uint32_t x){
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00FF00FFu) << 8) | ((x & 0xFF00FF00u) >> 8);
+    x = ((x & 0x0F0F0F0Fu) << 4) | ((x & 0xF0F0F0F0u) >> 4);
+    x = ((x & 0x33333333u) << 2) | ((x & 0xCCCCCCCCu) >> 2);
+    x = ((x & 0x55555555u) << 1) | ((x & 0xAAAAAAAAu) >> 1);
+    return x;
+}
+
+//Hash based nested uniform scrambling of the bits of x (Burley, Practical Hash-based Owen Scrambling)
+uint32_t owenScramble(uint32_t x, uint32_t seed){
+    x = reverseBits(x);
+    x += seed;
+    x ^= x * 0x6C50B47Cu;
+    x ^= x * 0xB82F1E52u;
+    x ^= x * 0xC7AFE638u;
+    x ^= x * 0x8D22F6E6u;
+    return reverseBits(x);
+}
+
+//First two dimensions of the Sobol sequence, the first one is the van der Corput sequence
+uint32_t sobolX(uint32_t index){return reverseBits(index);}
+
+uint32_t sobolY(uint32_t index){
+    //Direction numbers of the polynomial x + 1 : v0 = 1 << 31, vk = vk-1 ^ (vk-1 >> 1)
+    uint32_t result = 0;
+    for(uint32_t direction = 0x80000000u; index != 0; index >>= 1, direction ^= direction >> 1){
+        if(index & 1) result ^= direction;
+    }
+    return result;
+}
+
+}
+
+void Sampler::startSample(uint pixelW, uint pixelH, uint sampleIndex) {
+    w = pixelW;
+    h = pixelH;
+    sample = sampleIndex;
+    dimension = 0;
+    pixelSeed = hash(hashCombine(hashCombine(hash(seed), pixelW), pixelH));
+    if(type == SamplerType::RANDOM){
+        //One PCG stream per sample of the pixel
+        state = 0;
+        increment = ((uint64_t)hashCombine(pixelSeed, sampleIndex) << 1) | 1;
+        nextRandom();
+        state += pixelSeed;
+        nextRandom();
+    }
+}
+
+uint32_t Sampler::nextRandom() {
+    const uint64_t oldState = state;
+    state = oldState * 6364136223846793005ULL + increment;
+    const uint32_t shifted = (uint32_t)(((oldState >> 18u) ^ oldState) >> 27u);
+    const uint32_t rotation = (uint32_t)(oldState >> 59u);
+    return (shifted >> rotation) | (shifted << ((-rotation) & 31));
+}
+
+float Sampler::get1D() {
+    if(type == SamplerType::RANDOM) return toFloat(nextRandom());
+    float u, v;
+    get2D(u, v);
+    return u;
+}
+
+void Sampler::get2D(float &u, float &v) {
+    if(type == SamplerType::RANDOM){
+        u = toFloat(nextRandom());
+        v = toFloat(nextRandom());
+        return;
+    }
+    //Every dimension of the sample is a fresh scrambled 2D Sobol sequence (padding), so dimensions are not correlated
+    if(type == SamplerType::SOBOL) sobol2D(hashCombine(pixelSeed, dimension), u, v);
+    else{
+        //Same sequence in all the pixels, the blue noise shifts (Cranley-Patterson rotation) make neighbouring pixels differ
+        sobol2D(hash(hashCombine(seed, dimension)), u, v);
+        u += getMaskShift(0);
+        v += getMaskShift(1);
+        if(u >= 1) u -= 1;
+        if(v >= 1) v -= 1;
+        //The rounding of the sums could give exactly 1
+        u = std::min(u, 0.99999994f);
+        v = std::min(v, 0.99999994f);
+    }
+    dimension++;
+}
+
+void Sampler::sobol2D(uint32_t dimensionSeed, float &u, float &v) const {
+    //The index is shuffled with the same seed for both components so that the point keeps its 2D stratification
+    const uint32_t index = owenScramble(sample, dimensionSeed);
+    u = toFloat(owenScramble(sobolX(index), hashCombine(dimensionSeed, 1)));
+    v = toFloat(owenScramble(sobolY(index), hashCombine(dimensionSeed, 2)));
+}
+
+float Sampler::getMaskShift(uint component) const {
+    //Each dimension and component reads the mask at its own toroidal offset
+    const uint32_t offset = hash(hashCombine(hashCombine(seed, dimension), component));
+    const uint x = (w + offset) % MASK_SIZE;
+    const uint y = (h + (offset >> 16)) % MASK_SIZE;
+    return getBlueNoiseMask()[y * MASK_SIZE + x];
+}
+
+const std::vector<float> &Sampler::getBlueNoiseMask() {
+    static const std::vector<float> mask = []{
+        const uint size = MASK_SIZE * MASK_SIZE;
+        //Toroidal gaussian energy of a point on the others (sigma 1.5)
+        std::vector<float> kernel(size);
+        for(uint y = 0; y < MASK_SIZE; y++){
+            for(uint x = 0; x < MASK_SIZE; x++){
+                const float dx = (float)std::min(x, MASK_SIZE - x), dy = (float)std::min(y, MASK_SIZE - y);
+                kernel[y * MASK_SIZE + x] = std::exp(-(dx * dx + dy * dy) / (2 * 1.5f * 1.5f));
+            }
+        }
+        std::vector<char> points(size, 0);
+        std::vector<float> energy(size, 0.0f);
+        auto update = [&](uint point, float sign){
+            const uint px = point % MASK_SIZE, py = point / MASK_SIZE;
+            for(uint y = 0; y < MASK_SIZE; y++){
+                const uint ky = ((y - py) & (MASK_SIZE - 1)) * MASK_SIZE;
+                for(uint x = 0; x < MASK_SIZE; x++) energy[y * MASK_SIZE + x] += sign * kernel[ky + ((x - px) & (MASK_SIZE - 1))];
+            }
+        };
+        //Tightest cluster --> point with the highest energy, largest void --> empty cell with the lowest energy
+        auto find = [&](char value, bool highest){
+            uint best = 0;
+            bool found = false;
+            for(uint i = 0; i < size; i++){
+                if(points[i] != value) continue;
+                if(!found || (highest ? energy[i] > energy[best] : energy[i] < energy[best])) best = i;
+                found = true;
+            }
+            return best;
+        };
+        //Initial pattern of 10% random points, relaxed by moving the tightest cluster into the largest void
+        Sampler random(SamplerType::RANDOM, 0);
+        random.startSample(0, 0, 0);
+        uint initialCount = 0;
+        while(initialCount < size / 10){
+            const uint point = random.nextRandom() % size;
+            if(points[point]) continue;
+            points[point] = 1;
+            update(point, 1);
+            initialCount++;
+        }
+        for(uint iteration = 0; iteration < size; iteration++){
+            const uint cluster = find(1, true);
+            points[cluster] = 0;
+            update(cluster, -1);
+            const uint largestVoid = find(0, false);
+            points[largestVoid] = 1;
+            update(largestVoid, 1);
+            if(largestVoid == cluster) break;
+        }
+        std::vector<uint> rank(size);
+        const std::vector<char> prototype = points;
+        const std::vector<float> prototypeEnergy = energy;
+        //Ranks of the initial points, removing the tightest cluster first
+        for(uint count = initialCount; count > 0; count--){
+            const uint cluster = find(1, true);
+            rank[cluster] = count - 1;
+            points[cluster] = 0;
+            update(cluster, -1);
+        }
+        //Ranks of the other cells, filling the largest void first
+        points = prototype;
+        energy = prototypeEnergy;
+        for(uint count = initialCount; count < size; count++){
+            const uint largestVoid = find(0, false);
+            rank[largestVoid] = count;
+            points[largestVoid] = 1;
+            update(largestVoid, 1);
+        }
+        std::vector<float> values(size);
+        for(uint i = 0; i < size; i++) values[i] = (rank[i] + 0.5f) / size;
+        return values;
+    }();
+    return mask;
+}
+
+const char *Sampler::typeName(SamplerType type) {
+    switch(type){
+        case SamplerType::RANDOM: return "random";
+        case SamplerType::BLUENOISE: return "bluenoise";
+        default: return "sobol";
+    }
+}
+
+bool Sampler::parseType(const std::string &name, SamplerType &type) {
+    if(name == "random") type = SamplerType::RANDOM;
+    else if(name == "sobol") type = SamplerType::SOBOL;
+    else if(name == "bluenoise") type = SamplerType::BLUENOISE;
+    else return false;
+    return true;
+}
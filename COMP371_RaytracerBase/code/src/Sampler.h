@@ -0,0 +1,58 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+//Sequence of the numbers drawn by the samples
+//RANDOM --> independent PCG32 stream per sample of every pixel
+//SOBOL --> Sobol points with hash based Owen scrambling, decorrelated per pixel and per dimension
+//BLUENOISE --> the same scrambled Sobol points in every pixel, shifted per pixel by a blue noise mask so that the error is blue noise
+enum class SamplerType{RANDOM, SOBOL, BLUENOISE};
+
+//Numbers in [0, 1) of one sample of one pixel, drawn one dimension at a time (pixel position, light samples, bounces...)
+//A sampler is a small value owned by the code tracing the sample, threads never share one
+//The numbers only depend on the seed, the pixel, the index of the sample and the dimension, so images are deterministic
+class Sampler{
+public:
+    //Width and height of the tiled blue noise mask
+    static const uint MASK_SIZE = 64;
+    explicit Sampler(SamplerType type = SamplerType::SOBOL, uint seed = 0): type(type), seed(seed){};
+    //Restarts at dimension 0 of the sample of index sample of pixel (w, h)
+    void startSample(uint w, uint h, uint sample);
+    float get1D();
+    //Two dimensions of one point, stratified together by the low discrepancy samplers
+    void get2D(float& u, float& v);
+    SamplerType getType() const{return type;}
+    static const char* typeName(SamplerType type);
+    //Parses "random", "sobol" or "bluenoise", returns false for any other name
+    static bool parseType(const std::string& name, SamplerType& type);
+    //Integer hash with good avalanche, used to derive the seeds of the streams
+    static uint32_t hash(uint32_t x){
+        x ^= x >> 16;
+        x *= 0x7FEB352Du;
+        x ^= x >> 15;
+        x *= 0x846CA68Bu;
+        x ^= x >> 16;
+        return x;
+    }
+    static uint32_t hashCombine(uint32_t seed, uint32_t value){return seed ^ (value + 0x9E3779B9u + (seed << 6) + (seed >> 2));}
+private:
+    SamplerType type;
+    uint seed;
+    uint w = 0, h = 0;
+    uint sample = 0;
+    uint dimension = 0;
+    //Seed of the pixel, combination of the seed of the sampler and the pixel coordinates
+    uint32_t pixelSeed = 0;
+    //PCG32 state and stream
+    uint64_t state = 0, increment = 1;
+    uint32_t nextRandom();
+    //Scrambled Sobol point of the current sample in the current dimension, components x and y of the Sobol sequence
+    void sobol2D(uint32_t dimensionSeed, float& u, float& v) const;
+    //Shift of the current pixel in [0, 1) for one component of the current dimension
+    float getMaskShift(uint component) const;
+    static float toFloat(uint32_t x){return (float)(x >> 8) * (1.0f / 16777216.0f);}
+    //Blue noise mask computed once with the void and cluster method, values (rank + 0.5) / MASK_SIZE^2
+    static const std::vector<float>& getBlueNoiseMask();
+};
@@ -10,6 +10,10 @@ private:
     std::vector<Geometry*>& sceneObjects = *new std::vector<Geometry*>();
     std::vector<Light*>& sceneLights = *new std::vector<Light*>();
     std::vector<Output*>& outputList = *new std::vector<Output*>();
+    //Number of frames of the animation, each output is saved once per frame when there is more than one
+    uint frameCount = 1;
+    //A subtree of a BVH is rebuilt between two frames once its expected cost grows past this many times its cost when it was built
+    float rebuildThreshold = 1.5f;
 public:
     Scene() = default;
     void addObject(Geometry* shape){
@@ -30,4 +34,12 @@ public:
     std::vector<Output*>& getOutput(){
         return outputList;
     }
+    void setFrameCount(uint frames){
+        frameCount = frames;
+    }
+    void setRebuildThreshold(float threshold){
+        rebuildThreshold = threshold;
+    }
+    uint getFrameCount() const{return frameCount;}
+    float getRebuildThreshold() const{return rebuildThreshold;}
 };
\ No newline at end of file
@@ -0,0 +1,216 @@
+#include "SceneCache.h"
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+//The files are memory mapped on POSIX systems and read into memory elsewhere
+#if defined(__unix__) || defined(__APPLE__)
+#define RAYTRACER_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+//Identifies a scene cache, followed by the version
+const char MAGIC[8] = {'R', 'T', 'S', 'C', 'E', 'N', 'E', '\0'};
+
+}
+
+SceneCache::SceneCache(const std::string &sceneFile) : sceneFile(sceneFile), path(sceneFile + ".cache") {}
+
+SceneCache::~SceneCache() {
+    if(data != nullptr) unmapFile(data, size);
+}
+
+bool SceneCache::open() {
+    if(!hashSource() || !mapFile(path, data, size)) return false;
+    CacheReader reader(data, size);
+    Header header{};
+    const bool valid = reader.read(header) && std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) == 0 && header.version == VERSION
+                       && header.sourceHash == sourceHash && header.sourceSize == sourceSize;
+    //The meshes are hashed again, the cache is stale when one of them changed
+    uint32_t dependencyCount = 0;
+    bool current = valid && reader.read(dependencyCount);
+    for(uint32_t i = 0; current && i < dependencyCount; i++){
+        std::vector<char> fileName;
+        Dependency dependency;
+        uint64_t fileHash, fileSize;
+        current = reader.readArray(fileName) && reader.read(dependency.hash) && reader.read(dependency.size);
+        if(!current) break;
+        dependency.fileName.assign(fileName.begin(), fileName.end());
+        current = hashFile(dependency.fileName, fileHash, fileSize) && fileHash == dependency.hash && fileSize == dependency.size;
+        dependencies.push_back(dependency);
+    }
+    if(!current){
+        unmapFile(data, size);
+        data = nullptr;
+        dependencies.clear();
+        return false;
+    }
+    bvhCount = header.bvhCount;
+    sceneOffset = size - reader.getRemaining();
+    return true;
+}
+
+bool SceneCache::loadScene(CompiledScene &scene, nlohmann::json &settings) {
+    if(!isOpen()) return false;
+    CacheReader reader(data + sceneOffset, size - sceneOffset);
+    std::vector<uint8_t> cbor;
+    if(!reader.readArray(cbor) || !scene.load(reader)) return false;
+    //The settings are the only part that is decoded, they are small
+    settings = nlohmann::json::from_cbor(cbor, true, false);
+    if(settings.is_discarded()) return false;
+    bvhOffset = size - reader.getRemaining();
+    return true;
+}
+
+BVH *SceneCache::loadBVH(const CompiledScene &scene, ThreadPool &pool, BVHBuilder builder, uint bins, uint32_t object) {
+    if(!isOpen() || bvhOffset == 0) return nullptr;
+    CacheReader reader(data + bvhOffset, size - bvhOffset);
+    //Every BVH is preceded by its builder settings, its object and its size so that the others are skipped without reading them
+    for(uint32_t i = 0; i < bvhCount; i++){
+        uint32_t bvhBuilder, bvhBins, bvhObject;
+        uint64_t bytes;
+        if(!reader.read(bvhBuilder) || !reader.read(bvhBins) || !reader.read(bvhObject) || !reader.read(bytes) || bytes > reader.getRemaining()) return nullptr;
+        if((BVHBuilder)bvhBuilder == builder && bvhBins == bins && bvhObject == object){
+            CacheReader bvhReader(reader.getPosition(), (size_t)bytes);
+            return BVH::load(scene, pool, bvhReader);
+        }
+        reader.skip((size_t)bytes);
+    }
+    return nullptr;
+}
+
+bool SceneCache::save(const CompiledScene &scene, const nlohmann::json &settings, const std::vector<const BVH*>& bvhs,
+                      const std::vector<const BVH*>& objectBVHs) {
+    if(!hashSource()) return false;
+    //Written next to the cache then renamed, so that a reader never sees a partial cache and the current mapping stays valid
+    const std::string temporaryPath = path + ".tmp";
+    {
+        std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+        CacheWriter writer(file);
+        Header header{};
+        std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = VERSION;
+        header.bvhCount = (uint32_t)(bvhs.size() + objectBVHs.size());
+        header.sourceHash = sourceHash;
+        header.sourceSize = sourceSize;
+        writer.write(header);
+        writer.write((uint32_t)dependencies.size());
+        for(const Dependency& dependency : dependencies){
+            writer.writeArray(std::vector<char>(dependency.fileName.begin(), dependency.fileName.end()));
+            writer.write(dependency.hash);
+            writer.write(dependency.size);
+        }
+        writer.writeArray(nlohmann::json::to_cbor(settings));
+        scene.save(writer);
+        for(size_t i = 0; i < bvhs.size() + objectBVHs.size(); i++){
+            const BVH* bvh = i < bvhs.size() ? bvhs[i] : objectBVHs[i - bvhs.size()];
+            std::ostringstream stream;
+            CacheWriter bvhWriter(stream);
+            bvh->save(bvhWriter);
+            const std::string bytes = stream.str();
+            writer.write((uint32_t)bvh->getBuilder());
+            writer.write((uint32_t)bvh->getBinCount());
+            writer.write(i < bvhs.size() ? TOP_LEVEL : (uint32_t)(i - bvhs.size()));
+            writer.write((uint64_t)bytes.size());
+            file.write(bytes.data(), (std::streamsize)bytes.size());
+        }
+        if(!writer.isGood()){
+            std::remove(temporaryPath.c_str());
+            return false;
+        }
+    }
+#ifndef RAYTRACER_MMAP
+    //rename does not replace an existing file on Windows, the cache is not held open since it was read into memory
+    std::remove(path.c_str());
+#endif
+    return std::rename(temporaryPath.c_str(), path.c_str()) == 0;
+}
+
+void SceneCache::addDependency(const std::string &fileName) {
+    Dependency dependency{fileName, 0, 0};
+    //A file that can not be hashed never matches, the cache is then rebuilt every time
+    hashFile(fileName, dependency.hash, dependency.size);
+    dependencies.push_back(dependency);
+}
+
+bool SceneCache::hashSource() {
+    if(hashed) return true;
+    if(!hashFile(sceneFile, sourceHash, sourceSize)) return false;
+    hashed = true;
+    return true;
+}
+
+bool SceneCache::hashFile(const std::string &fileName, uint64_t &fileHash, uint64_t &fileSize) {
+    const char* content;
+    size_t bytes;
+    if(!mapFile(fileName, content, bytes)) return false;
+    fileHash = hash(content, bytes);
+    fileSize = bytes;
+    unmapFile(content, bytes);
+    return true;
+}
+
+uint64_t SceneCache::hash(const char *bytes, size_t count) {
+    //Eight bytes at a time with a multiply and xor-shift mix, then the remaining bytes
+    uint64_t result = 0x9E3779B97F4A7C15ULL ^ count;
+    size_t i = 0;
+    for(; i + 8 <= count; i += 8){
+        uint64_t word;
+        std::memcpy(&word, bytes + i, 8);
+        result = (result ^ word) * 0xFF51AFD7ED558CCDULL;
+        result ^= result >> 32;
+    }
+    for(; i < count; i++) result = (result ^ (uint8_t)bytes[i]) * 0x100000001B3ULL;
+    result ^= result >> 33;
+    result *= 0xC4CEB9FE1A85EC53ULL;
+    result ^= result >> 33;
+    return result;
+}
+
+#ifdef RAYTRACER_MMAP
+bool SceneCache::mapFile(const std::string &fileName, const char *&mapping, size_t &mappingSize) {
+    const int descriptor = ::open(fileName.c_str(), O_RDONLY);
+    if(descriptor < 0) return false;
+    struct stat status{};
+    if(fstat(descriptor, &status) != 0 || status.st_size == 0){
+        close(descriptor);
+        return false;
+    }
+    void* address = mmap(nullptr, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    //The mapping stays valid once the descriptor is closed
+    close(descriptor);
+    if(address == MAP_FAILED) return false;
+    mapping = static_cast<const char*>(address);
+    mappingSize = (size_t)status.st_size;
+    return true;
+}
+
+void SceneCache::unmapFile(const char *mapping, size_t mappingSize) {
+    munmap(const_cast<char*>(mapping), mappingSize);
+}
+#else
+bool SceneCache::mapFile(const std::string &fileName, const char *&mapping, size_t &mappingSize) {
+    std::ifstream file(fileName, std::ios::binary | std::ios::ate);
+    if(!file) return false;
+    const std::streamoff fileSize = file.tellg();
+    if(fileSize <= 0) return false;
+    char* content = new char[(size_t)fileSize];
+    file.seekg(0);
+    if(!file.read(content, fileSize)){
+        delete[] content;
+        return false;
+    }
+    mapping = content;
+    mappingSize = (size_t)fileSize;
+    return true;
+}
+
+void SceneCache::unmapFile(const char *mapping, size_t) {
+    delete[] mapping;
+}
+#endif
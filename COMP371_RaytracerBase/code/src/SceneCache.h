@@ -0,0 +1,75 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "../external/json.hpp"
+#include "BVH.h"
+#include "CacheStream.h"
+#include "CompiledScene.h"
+
+//Binary cache of a scene file, written next to it as <scene file>.cache
+//Holds the compiled geometry, the lights and outputs (as CBOR), the BVHs built for the scene and the BVHs of its objects
+//The cache is memory mapped (read into memory on systems without mmap) and its arrays of plain values are copied out
+//in single blocks, no text is parsed
+//It is only used while the hash of the content of the scene file, and of the mesh files it reads, matches the hash
+//it was written for, and it is not portable between machines of different byte order
+class SceneCache{
+public:
+    //Version of the layout, a cache of another version is rebuilt
+    static const uint32_t VERSION = 3;
+    //Object of the BVHs of the scene itself (top level)
+    static const uint32_t TOP_LEVEL = 0xFFFFFFFF;
+    explicit SceneCache(const std::string& sceneFile);
+    ~SceneCache();
+    SceneCache(const SceneCache&) = delete;
+    SceneCache& operator = (const SceneCache&) = delete;
+    //Maps the cache, returns false when it is missing or was written for another content of the scene file
+    bool open();
+    bool isOpen() const{return data != nullptr;}
+    //Compiled geometry and json of the lights and outputs of an opened cache, false when the cache is damaged
+    bool loadScene(CompiledScene& scene, nlohmann::json& settings);
+    //BVH of an opened cache built with these settings, nullptr if the cache has none
+    //object --> index of the object whose BVH is read (scene is then that object), TOP_LEVEL for the scene
+    BVH* loadBVH(const CompiledScene& scene, ThreadPool& pool, BVHBuilder builder, uint bins, uint32_t object = TOP_LEVEL);
+    //Writes the cache for the current content of the scene file, replacing the previous one
+    //objectBVHs --> BVH of every object of the scene, in the order of the objects
+    bool save(const CompiledScene& scene, const nlohmann::json& settings, const std::vector<const BVH*>& bvhs,
+              const std::vector<const BVH*>& objectBVHs);
+    //File read while loading the scene (a mesh), the cache is rebuilt when its content changes
+    void addDependency(const std::string& fileName);
+    const std::string& getPath() const{return path;}
+private:
+    struct Header{
+        char magic[8];
+        uint32_t version;
+        uint32_t bvhCount;
+        uint64_t sourceHash;
+        uint64_t sourceSize;
+    };
+    //Hash and size of a file the scene depends on
+    struct Dependency{
+        std::string fileName;
+        uint64_t hash, size;
+    };
+    std::string sceneFile, path;
+    std::vector<Dependency> dependencies;
+    //Hash and size of the scene file, computed once
+    bool hashed = false;
+    uint64_t sourceHash = 0, sourceSize = 0;
+    //Mapping of the opened cache
+    const char* data = nullptr;
+    size_t size = 0;
+    //Offset of the scene and of the first BVH in the mapping
+    size_t sceneOffset = 0, bvhOffset = 0;
+    uint32_t bvhCount = 0;
+    //Hashes the scene file, false when it can not be read
+    bool hashSource();
+    //Hash and size of the content of a file, false when it can not be read
+    static bool hashFile(const std::string& fileName, uint64_t& fileHash, uint64_t& fileSize);
+    static uint64_t hash(const char* bytes, size_t count);
+    //Maps a whole file read only, false when it can not be opened or is empty
+    //Without mmap the file is read into a block allocated with new[]
+    static bool mapFile(const std::string& fileName, const char*& mapping, size_t& mappingSize);
+    //Releases a mapping of mapFile
+    static void unmapFile(const char* mapping, size_t mappingSize);
+};
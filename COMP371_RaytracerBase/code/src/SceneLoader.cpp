@@ -0,0 +1,332 @@
+#include "SceneLoader.h"
+#include <fstream>
+#include <iostream>
+#include <Eigen/LU>
+#include "ObjLoader.h"
+
+void SceneLoader::load(const std::string &fileName, bool useCache) {
+    std::ifstream file(fileName, std::ios::binary);
+    if(!file){
+        std::cout << "Exiting program: could not open the scene file " << fileName << std::endl;
+        exit(1);
+    }
+    compiledScene.reset(new CompiledScene());
+    const size_t separator = fileName.find_last_of('/');
+    directory = separator == std::string::npos ? "" : fileName.substr(0, separator + 1);
+    if(useCache){
+        cache.reset(new SceneCache(fileName));
+        if(cache->open()){
+            if(cache->loadScene(*compiledScene, settings)){
+                std::cout << "Scene read from the cache " << cache->getPath() << std::endl;
+                return;
+            }
+            //Damaged cache, the file is parsed and the cache rewritten
+            cache.reset(new SceneCache(fileName));
+            compiledScene.reset(new CompiledScene());
+            settings = nlohmann::json();
+        }
+    }
+    nlohmann::json::sax_parse(file, this);
+}
+
+bool SceneLoader::null() {
+    if(memberParser) return memberParser->null() && endMemberValue();
+    if(inGeometry) readGeometryValue(nullptr, nullptr);
+    else invalidScene();
+    return true;
+}
+
+bool SceneLoader::boolean(bool value) {
+    if(memberParser) return memberParser->boolean(value) && endMemberValue();
+    if(inGeometry) readGeometryValue(nullptr, nullptr);
+    else invalidScene();
+    return true;
+}
+
+bool SceneLoader::number(double value) {
+    //The settings keep the exact json number type, only the geometry is read as floats
+    if(inGeometry) readGeometryValue(&value, nullptr);
+    else invalidScene();
+    return true;
+}
+
+bool SceneLoader::number_integer(number_integer_t value) {
+    if(memberParser) return memberParser->number_integer(value) && endMemberValue();
+    return number((double)value);
+}
+
+bool SceneLoader::number_unsigned(number_unsigned_t value) {
+    if(memberParser) return memberParser->number_unsigned(value) && endMemberValue();
+    return number((double)value);
+}
+
+bool SceneLoader::number_float(number_float_t value, const string_t &text) {
+    if(memberParser) return memberParser->number_float(value, text) && endMemberValue();
+    return number(value);
+}
+
+bool SceneLoader::string(string_t &value) {
+    if(memberParser) return memberParser->string(value) && endMemberValue();
+    if(inGeometry) readGeometryValue(nullptr, &value);
+    else invalidScene();
+    return true;
+}
+
+bool SceneLoader::binary(binary_t &) {
+    //Text json has no binary values
+    invalidScene();
+}
+
+bool SceneLoader::start_object(std::size_t elements) {
+    if(memberParser){
+        depth++;
+        return memberParser->start_object(elements);
+    }
+    if(inGeometry){
+        if(depth == 1) geometryNotArray();
+        if(depth == 2){
+            //Start of a geometry
+            record = GeometryRecord();
+            field = Field::NONE;
+        }
+        else if(field != Field::NONE) invalidValue("an array of numbers");
+    }
+    else if(depth != 0) invalidScene();
+    depth++;
+    return true;
+}
+
+bool SceneLoader::key(string_t &value) {
+    if(memberParser) return memberParser->key(value);
+    if(depth == 1){
+        inGeometry = value == "geometry";
+        if(!inGeometry){
+            memberParser.reset(new nlohmann::detail::json_sax_dom_parser<nlohmann::json>(settings[value]));
+            memberDepth = 1;
+        }
+    }
+    else if(inGeometry && depth == 3 && value == "keyframes"){
+        memberParser.reset(new nlohmann::detail::json_sax_dom_parser<nlohmann::json>(record.keyframes));
+        memberDepth = 3;
+    }
+    //Keys of the objects nested in a skipped member do not change the member being read
+    else if(inGeometry && depth == 3) field = getField(value);
+    return true;
+}
+
+bool SceneLoader::end_object() {
+    depth--;
+    if(memberParser) return memberParser->end_object() && endMemberValue();
+    if(inGeometry && depth == 2) addGeometry();
+    return true;
+}
+
+bool SceneLoader::start_array(std::size_t elements) {
+    if(memberParser){
+        depth++;
+        return memberParser->start_array(elements);
+    }
+    if(!inGeometry) invalidScene();
+    if(depth == 2){
+        std::cout << "Exiting program: geometry should always contain a type!!!" << std::endl;
+        exit(1);
+    }
+    if(depth >= 3 && field != Field::NONE && (depth > 3 || !isArrayField(field))) invalidValue(isArrayField(field) ? "an array of numbers" : "a single value");
+    depth++;
+    return true;
+}
+
+bool SceneLoader::end_array() {
+    depth--;
+    if(memberParser) return memberParser->end_array() && endMemberValue();
+    if(depth == 1) inGeometry = false;
+    return true;
+}
+
+bool SceneLoader::parse_error(std::size_t, const std::string &, const nlohmann::detail::exception &exception) {
+    std::cout << "Exiting program: the scene file is not valid json (" << exception.what() << ")" << std::endl;
+    exit(1);
+}
+
+bool SceneLoader::endMemberValue() {
+    //The member is complete once the parser is back in the object that holds it
+    if(depth == memberDepth) memberParser.reset();
+    return true;
+}
+
+void SceneLoader::readGeometryValue(const double *number, const std::string *text) {
+    if(depth == 1) geometryNotArray();
+    if(depth == 2){
+        std::cout << "Exiting program: geometry should always contain a type!!!" << std::endl;
+        exit(1);
+    }
+    //Values of unknown members are skipped
+    if(field == Field::NONE) return;
+    uint& count = record.counts[(uint)field];
+    if(depth == 3){
+        if(field == Field::TYPE || field == Field::FILE){
+            if(text == nullptr) invalidValue("a string");
+            (field == Field::TYPE ? record.type : record.file) = *text;
+            count = 1;
+            return;
+        }
+        if(isArrayField(field)) invalidValue("an array of numbers");
+        if(number == nullptr) invalidValue("a number");
+        const float value = (float)*number;
+        switch(field){
+            case Field::KA: record.ka = value; break;
+            case Field::KD: record.kd = value; break;
+            case Field::KS: record.ks = value; break;
+            case Field::PC: record.pc = value; break;
+            default: record.radius = value; break;
+        }
+        count = 1;
+        return;
+    }
+    if(depth > 4 || !isArrayField(field) || number == nullptr) invalidValue(isArrayField(field) ? "an array of numbers" : "a single value");
+    const uint size = field == Field::TRANSFORM ? 16 : 3;
+    if(count < size) (field == Field::TRANSFORM ? record.transform[count] : record.vectors[getVectorIndex(field)][count]) = (float)*number;
+    else if(count == size) std::cout << "Warning : Too many entries in " << getFieldName(field) << std::endl;
+    count++;
+}
+
+void SceneLoader::addGeometry() {
+    geometryCount++;
+    const uint* counts = record.counts;
+    if(counts[(uint)Field::TYPE] == 0){
+        std::cout << "Exiting program: geometry should always contain a type!!!" << std::endl;
+        exit(1);
+    }
+    if(counts[(uint)Field::KA] == 0 || counts[(uint)Field::KD] == 0 || counts[(uint)Field::KS] == 0){
+        std::cout << "Exiting program : geometry should always have ambient, diffuse and specular reflection coefficients (ka, kd and ks) " << std::endl;
+        exit(1);
+    }
+    if(counts[(uint)Field::PC] == 0){
+        std::cout << "Exiting program : geometry should contain phong coefficient (pc) " << std::endl;
+        exit(1);
+    }
+    if(counts[(uint)Field::AC] == 0 || counts[(uint)Field::DC] == 0 || counts[(uint)Field::SC] == 0){
+        std::cout << "Exiting program : geometry should always have ambient, diffuse and specular reflection color (ac, dc and sc) " << std::endl;
+        exit(1);
+    }
+    for(Field color : {Field::AC, Field::DC, Field::SC}){
+        if(counts[(uint)color] < 3) std::cout << "Too few arguments provided in " << getFieldName(color) << ", the rest were assumed to be 0" << std::endl;
+    }
+    const Material material{record.ka, record.kd, record.ks, record.pc, record.vectors[getVectorIndex(Field::AC)],
+                            record.vectors[getVectorIndex(Field::DC)], record.vectors[getVectorIndex(Field::SC)]};
+    //Shape of the geometry, the transformed geometries of the same shape are instances of the same object
+    std::string key = record.type;
+    const auto appendToKey = [&key](const float* values, size_t count){key.append(reinterpret_cast<const char*>(values), count * sizeof(float));};
+    Eigen::Vector3f* corners = record.vectors + getVectorIndex(Field::P1);
+    std::string meshFile;
+    if(record.type == "sphere"){
+        if(counts[(uint)Field::RADIUS] == 0) std::cout << "Radius of sphere was not given, so it was assumed to be 1.0f" << std::endl;
+        appendToKey(record.vectors[getVectorIndex(Field::CENTRE)].data(), 3);
+        appendToKey(&record.radius, 1);
+    }
+    else if(record.type == "rectangle"){
+        for(Field corner : {Field::P1, Field::P2, Field::P3, Field::P4}){
+            if(counts[(uint)corner] == 0){
+                std::cout << "Exiting program: All 4 points of the rectangle must be given" << std::endl;
+                exit(1);
+            }
+        }
+        for(Field corner : {Field::P1, Field::P2, Field::P3, Field::P4}){
+            if(counts[(uint)corner] < 3){
+                std::cout << "Exiting program : Too few arguments were provided for " << getFieldName(corner) << std::endl;
+                exit(1);
+            }
+            appendToKey(corners[(uint)corner - (uint)Field::P1].data(), 3);
+        }
+    }
+    else if(record.type == "mesh"){
+        if(counts[(uint)Field::FILE] == 0){
+            std::cout << "Exiting program: a mesh must give its OBJ file (file)" << std::endl;
+            exit(1);
+        }
+        meshFile = record.file[0] == '/' ? record.file : directory + record.file;
+        key += meshFile;
+    }
+    else return;
+    const bool animated = !record.keyframes.is_null();
+    const bool transformed = counts[(uint)Field::TRANSFORM] > 0 || animated;
+    Eigen::Matrix4f transform = Eigen::Matrix4f::Identity();
+    std::unique_ptr<CompiledScene> object;
+    CompiledScene* target = compiledScene.get();
+    if(transformed){
+        if(counts[(uint)Field::TRANSFORM] > 0) transform = getTransform();
+        auto entry = objectIndices.find(key);
+        if(entry != objectIndices.end()){
+            addInstance(entry->second, transform, material);
+            return;
+        }
+        object.reset(new CompiledScene());
+        target = object.get();
+    }
+    if(record.type == "sphere") target->addSphere(record.vectors[getVectorIndex(Field::CENTRE)], record.radius, material);
+    else if(record.type == "rectangle"){
+        Rectangle rectangle(corners[0], corners[1], corners[2], corners[3]);
+        target->addQuad(rectangle, material);
+    }
+    else{
+        ObjLoader obj;
+        obj.load(meshFile);
+        target->addMesh(obj.getVertices(), obj.getIndices(), material);
+        //The cache is only valid while the mesh file is unchanged
+        if(cache) cache->addDependency(meshFile);
+    }
+    if(transformed){
+        const uint index = compiledScene->addObject(std::move(object));
+        objectIndices[key] = index;
+        addInstance(index, transform, material);
+    }
+}
+
+void SceneLoader::addInstance(uint object, const Eigen::Matrix4f &transform, const Material &material) {
+    compiledScene->addInstance(object, transform, material);
+    if(!record.keyframes.is_null()){
+        const uint instance = compiledScene->getInstanceCount() - 1;
+        compiledScene->animateInstance(instance, TransformKeyframe::parse(record.keyframes, "geometry " + std::to_string(geometryCount)));
+    }
+}
+
+Eigen::Matrix4f SceneLoader::getTransform() const {
+    if(record.counts[(uint)Field::TRANSFORM] < 16){
+        std::cout << "Exiting program: the transform of geometry " << geometryCount << " should have 16 values (a 4x4 matrix by rows)" << std::endl;
+        exit(1);
+    }
+    const Eigen::Matrix4f transform = Eigen::Map<const Eigen::Matrix<float, 4, 4, Eigen::RowMajor>>(record.transform);
+    if(transform.row(3) != Eigen::RowVector4f(0, 0, 0, 1)) std::cout << "Warning : the last row of the transform of geometry " << geometryCount << " is not 0 0 0 1, it was ignored" << std::endl;
+    if(transform.topLeftCorner<3, 3>().determinant() == 0){
+        std::cout << "Exiting program: the transform of geometry " << geometryCount << " is not invertible" << std::endl;
+        exit(1);
+    }
+    return transform;
+}
+
+SceneLoader::Field SceneLoader::getField(const std::string &name) {
+    for(uint i = 1; i < FIELD_COUNT; i++){
+        if(name == getFieldName((Field)i)) return (Field)i;
+    }
+    return Field::NONE;
+}
+
+const char *SceneLoader::getFieldName(Field field) {
+    static const char* const names[FIELD_COUNT] = {"", "type", "file", "ka", "kd", "ks", "pc", "radius", "transform", "ac", "dc", "sc", "centre", "p1", "p2", "p3", "p4"};
+    return names[(uint)field];
+}
+
+void SceneLoader::invalidValue(const char *expected) {
+    std::cout << "Exiting program: " << getFieldName(field) << " of geometry " << geometryCount + 1 << " should be " << expected << std::endl;
+    exit(1);
+}
+
+void SceneLoader::geometryNotArray() {
+    std::cout << "Exiting program: geometry should be an array" << std::endl;
+    exit(1);
+}
+
+void SceneLoader::invalidScene() {
+    std::cout << "Exiting program: the scene file should contain a json object" << std::endl;
+    exit(1);
+}
@@ -0,0 +1,105 @@
+#pragma once
+#include <map>
+#include <memory>
+#include <string>
+#include "../external/json.hpp"
+#include "Eigen/Core"
+#include "CompiledScene.h"
+#include "SceneCache.h"
+
+//Loads a scene file with the SAX interface of nlohmann::json instead of building the whole document
+//geometry --> every primitive is read field by field and written straight into the arrays of the compiled scene,
+//             no json value is built for it
+//any other member (light, output...) --> small enough to be kept as json and parsed by Parser like before
+//The memory used is the compiled scene plus the json of the lights and outputs, whatever the size of the file
+//When the binary cache of the file is up to date the scene is read from it instead, without parsing the file
+//A geometry of type mesh reads the triangles of the OBJ file given by its member file, relative to the scene file
+//A geometry with a transform (16 numbers, a 4x4 matrix by rows) becomes an instance of an object, the transformed
+//geometries of the same shape (same mesh file, or same sphere or rectangle) share one object
+//A geometry with keyframes is an animated instance, its keyframes are kept as json and parsed by TransformKeyframe
+class SceneLoader : public nlohmann::json_sax<nlohmann::json>{
+public:
+    //Reads the file or its cache, exits the program when it can not be opened or is not valid json
+    //useCache --> false to always parse the file, the cache is then neither read nor written
+    void load(const std::string& fileName, bool useCache = true);
+    //Every top level member except geometry
+    nlohmann::json& getSettings(){return settings;}
+    //Geometry of the file, the loader gives up its ownership
+    std::unique_ptr<CompiledScene> takeCompiledScene(){return std::move(compiledScene);}
+    //Cache of the file, opened when the scene was read from it, nullptr when caching is off
+    std::unique_ptr<SceneCache> takeCache(){return std::move(cache);}
+    uint getGeometryCount() const{return geometryCount;}
+
+    //SAX events
+    bool null() override;
+    bool boolean(bool value) override;
+    bool number_integer(number_integer_t value) override;
+    bool number_unsigned(number_unsigned_t value) override;
+    bool number_float(number_float_t value, const string_t& text) override;
+    bool string(string_t& value) override;
+    bool binary(binary_t& value) override;
+    bool start_object(std::size_t elements) override;
+    bool key(string_t& value) override;
+    bool end_object() override;
+    bool start_array(std::size_t elements) override;
+    bool end_array() override;
+    bool parse_error(std::size_t position, const std::string& lastToken, const nlohmann::detail::exception& exception) override;
+private:
+    //Members of a geometry read by the loader, any other member is skipped
+    //The array fields come last, transform then the vector fields
+    enum class Field{NONE, TYPE, FILE, KA, KD, KS, PC, RADIUS, TRANSFORM, AC, DC, SC, CENTRE, P1, P2, P3, P4};
+    static const uint FIELD_COUNT = (uint)Field::P4 + 1;
+    //Geometry being read, reset at the start of every geometry
+    struct GeometryRecord{
+        std::string type, file;
+        //Scalars ka, kd, ks, pc and radius (1 when not given)
+        float ka = 0, kd = 0, ks = 0, pc = 0, radius = 1;
+        //Vectors ac, dc, sc, centre, p1, p2, p3 and p4
+        Eigen::Vector3f vectors[8];
+        //Matrix of the transform by rows
+        float transform[16] = {};
+        nlohmann::json keyframes;
+        //Number of values read for every field, a scalar field counts 1 once given
+        uint counts[FIELD_COUNT] = {};
+        GeometryRecord(){for(auto& vector : vectors) vector.setZero();}
+    };
+    nlohmann::json settings;
+    std::unique_ptr<CompiledScene> compiledScene;
+    std::unique_ptr<SceneCache> cache;
+    //Directory of the scene file with its separator, the mesh files are relative to it
+    std::string directory;
+    //Object of every shape of transformed geometry (see addGeometry)
+    std::map<std::string, uint> objectIndices;
+    //Builds the json of the top level member being read when it is not the geometry, or of the keyframes of a geometry
+    std::unique_ptr<nlohmann::detail::json_sax_dom_parser<nlohmann::json>> memberParser;
+    //Depth of the member built by memberParser, 1 for a top level member and 3 for keyframes
+    uint memberDepth = 1;
+    //Depth of the current value, 1 inside the top level object
+    uint depth = 0;
+    bool inGeometry = false;
+    //Member of the current geometry being read, NONE while an unknown member is skipped
+    Field field = Field::NONE;
+    GeometryRecord record;
+    uint geometryCount = 0;
+    bool number(double value);
+    //Ends the member being built once the parser is back at its depth
+    bool endMemberValue();
+    //Number, string (text) or any other scalar (both nullptr) read inside the geometry
+    void readGeometryValue(const double* number, const std::string* text);
+    //Validates the geometry that was just read and adds it to the compiled scene
+    void addGeometry();
+    //Adds an instance of the geometry that was just read, animated when it has keyframes
+    void addInstance(uint object, const Eigen::Matrix4f& transform, const Material& material);
+    //Validated transform of the geometry that was just read
+    Eigen::Matrix4f getTransform() const;
+    static Field getField(const std::string& name);
+    static const char* getFieldName(Field field);
+    static bool isArrayField(Field field){return field >= Field::TRANSFORM;}
+    static bool isVectorField(Field field){return field >= Field::AC;}
+    //Index of a vector field in GeometryRecord::vectors
+    static uint getVectorIndex(Field field){return (uint)field - (uint)Field::AC;}
+    //Exits the program when a value of a geometry has the wrong type
+    [[noreturn]] void invalidValue(const char* expected);
+    [[noreturn]] static void geometryNotArray();
+    [[noreturn]] static void invalidScene();
+};
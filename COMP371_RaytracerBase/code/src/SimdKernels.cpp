@@ -0,0 +1,88 @@
+#include "SimdKernelsImpl.h"
+#include <cstdlib>
+#include <cstring>
+
+#ifdef RAYTRACER_X86
+//AVX2 kernels, compiled with -mavx2 in SimdKernelsAVX2.cpp, nullptr when the compiler could not build them
+const SimdKernels* getAVX2Kernels();
+#endif
+
+namespace {
+
+const SimdKernels scalarKernels{SimdLevel::SCALAR, closestSphere<ScalarLanes>, anySphere<ScalarLanes>,
+                                closestQuad<ScalarLanes>, anyQuad<ScalarLanes>,
+                                packetBox<ScalarLanes>, packetSphere<ScalarLanes>, packetQuad<ScalarLanes>,
+                                packetTriangle<ScalarLanes>, wideBox<ScalarLanes, 4>, wideBox<ScalarLanes, 8>,
+                                quantizedBox<ScalarLanes, 4, uint8_t>, quantizedBox<ScalarLanes, 8, uint8_t>,
+                                quantizedBox<ScalarLanes, 4, uint16_t>, quantizedBox<ScalarLanes, 8, uint16_t>,
+                                decodeBounds<ScalarLanes, uint8_t>, decodeBounds<ScalarLanes, uint16_t>};
+#ifdef RAYTRACER_X86
+const SimdKernels sseKernels{SimdLevel::SSE, closestSphere<SSELanes>, anySphere<SSELanes>,
+                             closestQuad<SSELanes>, anyQuad<SSELanes>,
+                             packetBox<SSELanes>, packetSphere<SSELanes>, packetQuad<SSELanes>,
+                             packetTriangle<SSELanes>, wideBox<SSELanes, 4>, wideBox<SSELanes, 8>,
+                             quantizedBox<SSELanes, 4, uint8_t>, quantizedBox<SSELanes, 8, uint8_t>,
+                             quantizedBox<SSELanes, 4, uint16_t>, quantizedBox<SSELanes, 8, uint16_t>,
+                             decodeBounds<SSELanes, uint8_t>, decodeBounds<SSELanes, uint16_t>};
+#endif
+
+#ifdef RAYTRACER_X86
+//True when the CPU has AVX2 and the operating system saves the AVX registers
+bool cpuSupportsAVX2(){
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if(info[0] < 7) return false;
+    //OSXSAVE and AVX, then the XMM and YMM states enabled in XCR0
+    __cpuid(info, 1);
+    if((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0 || (_xgetbv(0) & 6) != 6) return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+SimdLevel getSupportedLevel(){
+#ifdef RAYTRACER_X86
+    if(getAVX2Kernels() != nullptr && cpuSupportsAVX2()) return SimdLevel::AVX2;
+    return SimdLevel::SSE;
+#else
+    return SimdLevel::SCALAR;
+#endif
+}
+
+SimdLevel getRequestedLevel(){
+    SimdLevel level = getSupportedLevel();
+    const char* requested = std::getenv("RAYTRACER_SIMD");
+    if(requested == nullptr) return level;
+    if(std::strcmp(requested, "scalar") == 0) return SimdLevel::SCALAR;
+    if(std::strcmp(requested, "sse") == 0 && level >= SimdLevel::SSE) return SimdLevel::SSE;
+    return level;
+}
+
+}
+
+const SimdKernels &SimdKernels::get() {
+    static const SimdKernels& kernels = get(getRequestedLevel());
+    return kernels;
+}
+
+const SimdKernels &SimdKernels::get(SimdLevel level) {
+    const SimdLevel supported = getSupportedLevel();
+    if(level > supported) level = supported;
+#ifdef RAYTRACER_X86
+    if(level == SimdLevel::AVX2) return *getAVX2Kernels();
+    if(level == SimdLevel::SSE) return sseKernels;
+#endif
+    return scalarKernels;
+}
+
+const char *SimdKernels::levelName(SimdLevel level) {
+    switch(level){
+        case SimdLevel::AVX2: return "avx2";
+        case SimdLevel::SSE: return "sse";
+        default: return "scalar";
+    }
+}
@@ -0,0 +1,93 @@
+#pragma once
+#include <cstdint>
+#include <sys/types.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#include "RayPacket.h"
+
+//Kernels testing one ray against several spheres or quads of the compiled scene at once, or a packet of rays against one primitive
+//This header is also used by the AVX2 translation unit, so it must not pull in Eigen or other inline code
+
+//Instruction set used by the kernels
+//SCALAR --> one primitive at a time, SSE --> 4 primitives per instruction, AVX2 --> 8 primitives per instruction
+enum class SimdLevel{SCALAR, SSE, AVX2};
+
+//Raw pointers to the sphere arrays of the compiled scene
+struct SphereArrays{
+    const float *x, *y, *z, *radius;
+    uint count;
+};
+
+//Raw pointers to the quad arrays of the compiled scene
+//parallelogram is 1 for parallelograms and 0 for quads tested as two triangles
+struct QuadArrays{
+    const float *px, *py, *pz;
+    const float *nx, *ny, *nz;
+    const float *du1x, *du1y, *du1z, *dv1x, *dv1y, *dv1z;
+    const float *du2x, *du2y, *du2z, *dv2x, *dv2y, *dv2z;
+    const float *parallelogram;
+    uint count;
+};
+
+//Raw pointers to the shared vertices and the index buffer of the triangles of the compiled scene
+//Triangle i has the vertices indices[3 * i], indices[3 * i + 1] and indices[3 * i + 2]
+struct TriangleArrays{
+    const float *x, *y, *z;
+    const uint* indices;
+    uint count;
+};
+
+//Index of the lowest bit set in a mask that is not 0
+//static so that the AVX2 translation unit keeps its own copy
+static inline uint lowestBit(uint mask){
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (uint)index;
+#else
+    return (uint)__builtin_ctz(mask);
+#endif
+}
+
+//Origin and direction of a ray as plain floats
+struct RayData{
+    const float* origin;
+    const float* direction;
+};
+
+//closest* --> index of the closest primitive hit at a distance in [tMin, tMax] or -1, tMax shrinks to the distance of the hit
+//any* --> true as soon as one primitive is hit at a distance in [tMin, tMax]
+struct SimdKernels{
+    SimdLevel level;
+    int (*closestSphere)(const SphereArrays& spheres, const RayData& ray, float tMin, float& tMax);
+    bool (*anySphere)(const SphereArrays& spheres, const RayData& ray, float tMin, float tMax);
+    int (*closestQuad)(const QuadArrays& quads, const RayData& ray, float tMin, float& tMax);
+    bool (*anyQuad)(const QuadArrays& quads, const RayData& ray, float tMin, float tMax);
+    //Packet kernels, one ray per lane, the rays before first are skipped
+    //packetBox --> index of the first ray from first that hits the box in [tMin, tMax of the ray], size of the packet when none does
+    uint (*packetBox)(const RayPacket& packet, uint first, const float* boxMin, const float* boxMax, float tMin);
+    //packetSphere/packetQuad/packetTriangle --> the rays from first that hit the primitive get its distance and primitive id
+    void (*packetSphere)(RayPacket& packet, uint first, const SphereArrays& spheres, uint sphere, int primitiveId, float tMin);
+    void (*packetQuad)(RayPacket& packet, uint first, const QuadArrays& quads, uint quad, int primitiveId, float tMin);
+    void (*packetTriangle)(RayPacket& packet, uint first, const TriangleArrays& triangles, uint triangle, int primitiveId, float tMin);
+    //Wide node kernels, one child box per lane : bounds holds min x, min y, min z, max x, max y and max z of the 4 or 8 children
+    //(see BVH::WideNode), returns the bit mask of the boxes hit in [tMin, tMax] and writes the entry distance of every box
+    uint (*wideBox4)(const float* bounds, const float* origin, const float* inverseDirection, float tMin, float tMax, float* entries);
+    uint (*wideBox8)(const float* bounds, const float* origin, const float* inverseDirection, float tMin, float tMax, float* entries);
+    //Wide node kernels on child boxes quantized to 8 or 16 bits (see BVH::QuantizedNode), the planes are decoded in the lanes
+    //frame --> origin then scale of the node on x, y and z, a plane is origin + q * scale on its axis
+    uint (*quantizedBox4x8)(const uint8_t* bounds, const float* frame, const float* origin, const float* inverseDirection, float tMin, float tMax, float* entries);
+    uint (*quantizedBox8x8)(const uint8_t* bounds, const float* frame, const float* origin, const float* inverseDirection, float tMin, float tMax, float* entries);
+    uint (*quantizedBox4x16)(const uint16_t* bounds, const float* frame, const float* origin, const float* inverseDirection, float tMin, float tMax, float* entries);
+    uint (*quantizedBox8x16)(const uint16_t* bounds, const float* frame, const float* origin, const float* inverseDirection, float tMin, float tMax, float* entries);
+    //Decodes the quantized child boxes of a wide node of width 4 or 8 to the float layout of wideBox, for the packets
+    void (*decodeBounds8)(const uint8_t* bounds, const float* frame, uint width, float* decoded);
+    void (*decodeBounds16)(const uint16_t* bounds, const float* frame, uint width, float* decoded);
+    //Kernels of the widest level supported by the CPU, selected once at startup
+    //The RAYTRACER_SIMD environment variable (scalar, sse or avx2) can lower the level for benchmarks
+    static const SimdKernels& get();
+    //Kernels of a given level, falls back to the widest supported level below it
+    static const SimdKernels& get(SimdLevel level);
+    static const char* levelName(SimdLevel level);
+};
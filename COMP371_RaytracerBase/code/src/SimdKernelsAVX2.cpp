@@ -0,0 +1,60 @@
+//Only this translation unit is compiled with -mavx2 (see CMakeLists.txt)
+//It must not include Eigen or any header whose inline functions are also used elsewhere, otherwise the linker
+//could keep the AVX2 copy of such a function for the whole program
+#include "SimdKernelsImpl.h"
+
+#ifdef RAYTRACER_X86
+#ifdef __AVX2__
+#include <immintrin.h>
+
+namespace {
+
+//Eight floats of AVX with the arithmetic of the kernels
+struct AVX2Float{
+    __m256 value;
+    AVX2Float() = default;
+    AVX2Float(__m256 value): value(value){}
+    operator __m256() const{return value;}
+};
+inline AVX2Float operator + (AVX2Float a, AVX2Float b){return _mm256_add_ps(a, b);}
+inline AVX2Float operator - (AVX2Float a, AVX2Float b){return _mm256_sub_ps(a, b);}
+inline AVX2Float operator * (AVX2Float a, AVX2Float b){return _mm256_mul_ps(a, b);}
+inline AVX2Float operator / (AVX2Float a, AVX2Float b){return _mm256_div_ps(a, b);}
+
+//Eight lanes of AVX
+struct AVX2Lanes{
+    typedef AVX2Float Float;
+    typedef __m256 Mask;
+    static const uint WIDTH = 8;
+    static Float load(const float* pointer){return _mm256_loadu_ps(pointer);}
+    static Float convert(const uint8_t* pointer){return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)pointer)));}
+    static Float convert(const uint16_t* pointer){return _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)pointer)));}
+    static Float set(float value){return _mm256_set1_ps(value);}
+    static Float sqrt(Float a){return _mm256_sqrt_ps(a);}
+    static Float min(Float a, Float b){return _mm256_min_ps(a, b);}
+    static Float max(Float a, Float b){return _mm256_max_ps(a, b);}
+    static Mask lessEqual(Float a, Float b){return _mm256_cmp_ps(a, b, _CMP_LE_OQ);}
+    static Mask greaterEqual(Float a, Float b){return _mm256_cmp_ps(a, b, _CMP_GE_OQ);}
+    static Mask both(Mask a, Mask b){return _mm256_and_ps(a, b);}
+    static Mask either(Mask a, Mask b){return _mm256_or_ps(a, b);}
+    static Mask notMask(Mask a){return _mm256_xor_ps(a, _mm256_castsi256_ps(_mm256_set1_epi32(-1)));}
+    static Float select(Mask mask, Float a, Float b){return _mm256_blendv_ps(b, a, mask);}
+    static uint bits(Mask mask){return (uint)_mm256_movemask_ps(mask);}
+    static void store(float* pointer, Float a){_mm256_storeu_ps(pointer, a);}
+};
+
+const SimdKernels avx2Kernels{SimdLevel::AVX2, closestSphere<AVX2Lanes>, anySphere<AVX2Lanes>,
+                              closestQuad<AVX2Lanes>, anyQuad<AVX2Lanes>,
+                              packetBox<AVX2Lanes>, packetSphere<AVX2Lanes>, packetQuad<AVX2Lanes>,
+                              packetTriangle<AVX2Lanes>, wideBox<SSELanes, 4>, wideBox<AVX2Lanes, 8>,
+                              quantizedBox<SSELanes, 4, uint8_t>, quantizedBox<AVX2Lanes, 8, uint8_t>,
+                              quantizedBox<SSELanes, 4, uint16_t>, quantizedBox<AVX2Lanes, 8, uint16_t>,
+                              decodeBounds<SSELanes, uint8_t>, decodeBounds<SSELanes, uint16_t>};
+
+}
+
+const SimdKernels* getAVX2Kernels(){return &avx2Kernels;}
+#else
+const SimdKernels* getAVX2Kernels(){return nullptr;}
+#endif
+#endif
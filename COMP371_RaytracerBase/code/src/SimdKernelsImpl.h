@@ -0,0 +1,440 @@
+#pragma once
+//Lane-generic intersection kernels, included by SimdKernels.cpp and SimdKernelsAVX2.cpp
+//Everything lives in an anonymous namespace so that every translation unit keeps its own copy,
+//compiled for its own instruction set
+//The vector lanes only use intrinsics, not the operators that GCC and Clang define on the vector types, so that MSVC builds them too
+#include "SimdKernels.h"
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <emmintrin.h>
+#define RAYTRACER_X86 1
+#else
+#include <cmath>
+#endif
+#include <cstring>
+
+namespace {
+
+//One lane of plain floats, used for the scalar kernels and for the tail of the vector loops
+struct ScalarLanes{
+    typedef float Float;
+    typedef bool Mask;
+    static const uint WIDTH = 1;
+    static Float load(const float* pointer){return *pointer;}
+    //Unsigned integers converted to floats
+    static Float convert(const uint8_t* pointer){return (float)*pointer;}
+    static Float convert(const uint16_t* pointer){return (float)*pointer;}
+    static Float set(float value){return value;}
+#ifdef RAYTRACER_X86
+    //std::sqrt is an inline function of a shared header, the AVX2 translation unit must not provide its copy
+    static Float sqrt(Float a){return _mm_cvtss_f32(_mm_sqrt_ss(_mm_set_ss(a)));}
+#else
+    static Float sqrt(Float a){return std::sqrt(a);}
+#endif
+    static Float min(Float a, Float b){return a < b ? a : b;}
+    static Float max(Float a, Float b){return a > b ? a : b;}
+    static Mask lessEqual(Float a, Float b){return a <= b;}
+    static Mask greaterEqual(Float a, Float b){return a >= b;}
+    static Mask both(Mask a, Mask b){return a && b;}
+    static Mask either(Mask a, Mask b){return a || b;}
+    static Mask notMask(Mask a){return !a;}
+    static Float select(Mask mask, Float a, Float b){return mask ? a : b;}
+    static uint bits(Mask mask){return mask ? 1u : 0u;}
+    static void store(float* pointer, Float a){*pointer = a;}
+};
+
+#ifdef RAYTRACER_X86
+//Four floats of SSE with the arithmetic of the kernels
+struct SSEFloat{
+    __m128 value;
+    SSEFloat() = default;
+    SSEFloat(__m128 value): value(value){}
+    operator __m128() const{return value;}
+};
+inline SSEFloat operator + (SSEFloat a, SSEFloat b){return _mm_add_ps(a, b);}
+inline SSEFloat operator - (SSEFloat a, SSEFloat b){return _mm_sub_ps(a, b);}
+inline SSEFloat operator * (SSEFloat a, SSEFloat b){return _mm_mul_ps(a, b);}
+inline SSEFloat operator / (SSEFloat a, SSEFloat b){return _mm_div_ps(a, b);}
+
+//Four lanes of SSE2, always available on x86-64
+//Also used by the AVX2 kernels for the nodes of 4 children
+struct SSELanes{
+    typedef SSEFloat Float;
+    typedef __m128 Mask;
+    static const uint WIDTH = 4;
+    static Float load(const float* pointer){return _mm_loadu_ps(pointer);}
+    static Float convert(const uint8_t* pointer){
+        int32_t bytes;
+        std::memcpy(&bytes, pointer, sizeof(bytes));
+        const __m128i zero = _mm_setzero_si128();
+        return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero), zero));
+    }
+    static Float convert(const uint16_t* pointer){
+        return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)pointer), _mm_setzero_si128()));
+    }
+    static Float set(float value){return _mm_set1_ps(value);}
+    static Float sqrt(Float a){return _mm_sqrt_ps(a);}
+    static Float min(Float a, Float b){return _mm_min_ps(a, b);}
+    static Float max(Float a, Float b){return _mm_max_ps(a, b);}
+    static Mask lessEqual(Float a, Float b){return _mm_cmple_ps(a, b);}
+    static Mask greaterEqual(Float a, Float b){return _mm_cmpge_ps(a, b);}
+    static Mask both(Mask a, Mask b){return _mm_and_ps(a, b);}
+    static Mask either(Mask a, Mask b){return _mm_or_ps(a, b);}
+    static Mask notMask(Mask a){return _mm_xor_ps(a, _mm_castsi128_ps(_mm_set1_epi32(-1)));}
+    static Float select(Mask mask, Float a, Float b){return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));}
+    static uint bits(Mask mask){return (uint)_mm_movemask_ps(mask);}
+    static void store(float* pointer, Float a){_mm_storeu_ps(pointer, a);}
+};
+#endif
+
+//Rays held by the lanes, either one ray broadcast to every lane or one ray of a packet per lane
+template<class L>
+struct RayLanes{
+    typename L::Float ox, oy, oz, dx, dy, dz;
+    //Squared length of the direction, same summation order as Eigen's squaredNorm
+    //so that the kernels agree with CompiledScene::intersectSphere
+    typename L::Float a;
+    explicit RayLanes(const RayData& ray): ox(L::set(ray.origin[0])), oy(L::set(ray.origin[1])), oz(L::set(ray.origin[2])),
+            dx(L::set(ray.direction[0])), dy(L::set(ray.direction[1])), dz(L::set(ray.direction[2])), a(dx * dx + (dy * dy + dz * dz)){}
+    RayLanes(const RayPacket& packet, uint i): ox(L::load(packet.ox + i)), oy(L::load(packet.oy + i)), oz(L::load(packet.oz + i)),
+            dx(L::load(packet.dx + i)), dy(L::load(packet.dy + i)), dz(L::load(packet.dz + i)), a(dx * dx + (dy * dy + dz * dz)){}
+};
+
+//Spheres held by the lanes, either consecutive spheres or one sphere broadcast to every lane
+template<class L>
+struct SphereLanes{
+    typename L::Float x, y, z, radius;
+    static SphereLanes load(const SphereArrays& spheres, uint i){
+        return {L::load(spheres.x + i), L::load(spheres.y + i), L::load(spheres.z + i), L::load(spheres.radius + i)};
+    }
+    static SphereLanes broadcast(const SphereArrays& spheres, uint i){
+        return {L::set(spheres.x[i]), L::set(spheres.y[i]), L::set(spheres.z[i]), L::set(spheres.radius[i])};
+    }
+};
+
+//Quads held by the lanes, either consecutive quads or one quad broadcast to every lane
+template<class L>
+struct QuadLanes{
+    typename L::Float px, py, pz, nx, ny, nz;
+    typename L::Float du1x, du1y, du1z, dv1x, dv1y, dv1z, du2x, du2y, du2z, dv2x, dv2y, dv2z;
+    typename L::Float parallelogram;
+    static QuadLanes load(const QuadArrays& q, uint i){
+        return {L::load(q.px + i), L::load(q.py + i), L::load(q.pz + i), L::load(q.nx + i), L::load(q.ny + i), L::load(q.nz + i),
+                L::load(q.du1x + i), L::load(q.du1y + i), L::load(q.du1z + i), L::load(q.dv1x + i), L::load(q.dv1y + i), L::load(q.dv1z + i),
+                L::load(q.du2x + i), L::load(q.du2y + i), L::load(q.du2z + i), L::load(q.dv2x + i), L::load(q.dv2y + i), L::load(q.dv2z + i),
+                L::load(q.parallelogram + i)};
+    }
+    static QuadLanes broadcast(const QuadArrays& q, uint i){
+        return {L::set(q.px[i]), L::set(q.py[i]), L::set(q.pz[i]), L::set(q.nx[i]), L::set(q.ny[i]), L::set(q.nz[i]),
+                L::set(q.du1x[i]), L::set(q.du1y[i]), L::set(q.du1z[i]), L::set(q.dv1x[i]), L::set(q.dv1y[i]), L::set(q.dv1z[i]),
+                L::set(q.du2x[i]), L::set(q.du2y[i]), L::set(q.du2z[i]), L::set(q.dv2x[i]), L::set(q.dv2y[i]), L::set(q.dv2z[i]),
+                L::set(q.parallelogram[i])};
+    }
+};
+
+//One triangle broadcast to every lane, its vertices are fetched through the index buffer
+template<class L>
+struct TriangleLanes{
+    typename L::Float x0, y0, z0, e1x, e1y, e1z, e2x, e2y, e2z;
+    static TriangleLanes broadcast(const TriangleArrays& t, uint i){
+        const uint a = t.indices[3 * i], b = t.indices[3 * i + 1], c = t.indices[3 * i + 2];
+        return {L::set(t.x[a]), L::set(t.y[a]), L::set(t.z[a]),
+                L::set(t.x[b] - t.x[a]), L::set(t.y[b] - t.y[a]), L::set(t.z[b] - t.z[a]),
+                L::set(t.x[c] - t.x[a]), L::set(t.y[c] - t.y[a]), L::set(t.z[c] - t.z[a])};
+    }
+};
+
+//Sphere test of every lane, same arithmetic as CompiledScene::intersectSphere
+template<class L>
+inline typename L::Mask sphereLanes(const SphereLanes<L>& sphere, const RayLanes<L>& ray, typename L::Float tMin, typename L::Float tMax,
+                                    typename L::Float& t){
+    typedef typename L::Float F;
+    const F dx = ray.ox - sphere.x;
+    const F dy = ray.oy - sphere.y;
+    const F dz = ray.oz - sphere.z;
+    const F half_b = dx * ray.dx + dy * ray.dy + dz * ray.dz;
+    const F c = dx * dx + dy * dy + dz * dz - sphere.radius * sphere.radius;
+    const F discriminant = half_b * half_b - ray.a * c;
+    const auto valid = L::greaterEqual(discriminant, L::set(0));
+    //Most blocks miss every sphere
+    if(L::bits(valid) == 0) return valid;
+    const F root = L::sqrt(L::max(discriminant, L::set(0)));
+    const F tNear = (L::set(0) - half_b - root) / ray.a;
+    const F tFar = (L::set(0) - half_b + root) / ray.a;
+    const auto nearInside = L::both(L::greaterEqual(tNear, tMin), L::lessEqual(tNear, tMax));
+    t = L::select(nearInside, tNear, tFar);
+    return L::both(valid, L::both(L::greaterEqual(t, tMin), L::lessEqual(t, tMax)));
+}
+
+//Quad test of every lane, same arithmetic as CompiledScene::intersectQuad
+template<class L>
+inline typename L::Mask quadLanes(const QuadLanes<L>& quad, const RayLanes<L>& ray, typename L::Float tMin, typename L::Float tMax,
+                                  typename L::Float& t){
+    typedef typename L::Float F;
+    const F denominator = quad.nx * ray.dx + quad.ny * ray.dy + quad.nz * ray.dz;
+    const auto frontFacing = L::lessEqual(L::set(0.0000000000001f), L::set(0) - denominator);
+    //Only the front face is hit
+    if(L::bits(frontFacing) == 0) return frontFacing;
+    const F ox = quad.px - ray.ox;
+    const F oy = quad.py - ray.oy;
+    const F oz = quad.pz - ray.oz;
+    t = (quad.nx * ox + quad.ny * oy + quad.nz * oz) / denominator;
+    const auto inRange = L::both(frontFacing, L::both(L::greaterEqual(t, tMin), L::lessEqual(t, tMax)));
+    if(L::bits(inRange) == 0) return inRange;
+    const F rx = t * ray.dx - ox;
+    const F ry = t * ray.dy - oy;
+    const F rz = t * ray.dz - oz;
+    const F u1 = rx * quad.du1x + ry * quad.du1y + rz * quad.du1z;
+    const F v1 = rx * quad.dv1x + ry * quad.dv1y + rz * quad.dv1z;
+    const F u2 = rx * quad.du2x + ry * quad.du2y + rz * quad.du2z;
+    const F v2 = rx * quad.dv2x + ry * quad.dv2y + rz * quad.dv2z;
+    const auto isParallelogram = L::greaterEqual(quad.parallelogram, L::set(0.5f));
+    //Parallelogram --> u and v in [0, 1], triangle --> u, v >= 0 and u + v <= 1
+    const F limit1 = L::select(isParallelogram, L::max(u1, v1), u1 + v1);
+    const auto inside1 = L::both(L::both(L::greaterEqual(u1, L::set(0)), L::greaterEqual(v1, L::set(0))), L::lessEqual(limit1, L::set(1)));
+    const auto inside2 = L::both(L::notMask(isParallelogram),
+                                 L::both(L::both(L::greaterEqual(u2, L::set(0)), L::greaterEqual(v2, L::set(0))), L::lessEqual(u2 + v2, L::set(1))));
+    return L::both(inRange, L::either(inside1, inside2));
+}
+
+//Triangle test of every lane (Moller-Trumbore, both faces are hit), same arithmetic as CompiledScene::intersectTriangle
+template<class L>
+inline typename L::Mask triangleLanes(const TriangleLanes<L>& triangle, const RayLanes<L>& ray, typename L::Float tMin, typename L::Float tMax,
+                                      typename L::Float& t){
+    typedef typename L::Float F;
+    //p = direction x e2
+    const F px = ray.dy * triangle.e2z - ray.dz * triangle.e2y;
+    const F py = ray.dz * triangle.e2x - ray.dx * triangle.e2z;
+    const F pz = ray.dx * triangle.e2y - ray.dy * triangle.e2x;
+    const F determinant = triangle.e1x * px + triangle.e1y * py + triangle.e1z * pz;
+    //Rays parallel to the plane of the triangle miss it
+    const auto notParallel = L::either(L::lessEqual(L::set(1e-12f), determinant), L::lessEqual(determinant, L::set(-1e-12f)));
+    if(L::bits(notParallel) == 0) return notParallel;
+    const F inverse = L::set(1) / determinant;
+    const F sx = ray.ox - triangle.x0, sy = ray.oy - triangle.y0, sz = ray.oz - triangle.z0;
+    const F u = (sx * px + sy * py + sz * pz) * inverse;
+    //q = s x e1
+    const F qx = sy * triangle.e1z - sz * triangle.e1y;
+    const F qy = sz * triangle.e1x - sx * triangle.e1z;
+    const F qz = sx * triangle.e1y - sy * triangle.e1x;
+    const F v = (ray.dx * qx + ray.dy * qy + ray.dz * qz) * inverse;
+    t = (triangle.e2x * qx + triangle.e2y * qy + triangle.e2z * qz) * inverse;
+    const auto inside = L::both(L::both(L::greaterEqual(u, L::set(0)), L::greaterEqual(v, L::set(0))), L::lessEqual(u + v, L::set(1)));
+    return L::both(L::both(notParallel, inside), L::both(L::greaterEqual(t, tMin), L::lessEqual(t, tMax)));
+}
+
+template<class L>
+int closestSphere(const SphereArrays& spheres, const RayData& ray, float tMin, float& tMax){
+    const RayLanes<L> rays(ray);
+    const RayLanes<ScalarLanes> scalarRay(ray);
+    int closest = -1;
+    float lanes[L::WIDTH];
+    uint i = 0;
+    for(; i + L::WIDTH <= spheres.count; i += L::WIDTH){
+        typename L::Float t;
+        uint hits = L::bits(sphereLanes<L>(SphereLanes<L>::load(spheres, i), rays, L::set(tMin), L::set(tMax), t));
+        if(hits == 0) continue;
+        L::store(lanes, t);
+        for(uint lane = 0; lane < L::WIDTH; lane++){
+            if((hits >> lane & 1u) && lanes[lane] <= tMax){
+                tMax = lanes[lane];
+                closest = (int)(i + lane);
+            }
+        }
+    }
+    for(; i < spheres.count; i++){
+        float t;
+        if(sphereLanes<ScalarLanes>(SphereLanes<ScalarLanes>::load(spheres, i), scalarRay, tMin, tMax, t)){
+            tMax = t;
+            closest = (int)i;
+        }
+    }
+    return closest;
+}
+
+template<class L>
+bool anySphere(const SphereArrays& spheres, const RayData& ray, float tMin, float tMax){
+    const RayLanes<L> rays(ray);
+    const RayLanes<ScalarLanes> scalarRay(ray);
+    uint i = 0;
+    for(; i + L::WIDTH <= spheres.count; i += L::WIDTH){
+        typename L::Float t;
+        if(L::bits(sphereLanes<L>(SphereLanes<L>::load(spheres, i), rays, L::set(tMin), L::set(tMax), t)) != 0) return true;
+    }
+    for(; i < spheres.count; i++){
+        float t;
+        if(sphereLanes<ScalarLanes>(SphereLanes<ScalarLanes>::load(spheres, i), scalarRay, tMin, tMax, t)) return true;
+    }
+    return false;
+}
+
+template<class L>
+int closestQuad(const QuadArrays& quads, const RayData& ray, float tMin, float& tMax){
+    const RayLanes<L> rays(ray);
+    const RayLanes<ScalarLanes> scalarRay(ray);
+    int closest = -1;
+    float lanes[L::WIDTH];
+    uint i = 0;
+    for(; i + L::WIDTH <= quads.count; i += L::WIDTH){
+        typename L::Float t;
+        uint hits = L::bits(quadLanes<L>(QuadLanes<L>::load(quads, i), rays, L::set(tMin), L::set(tMax), t));
+        if(hits == 0) continue;
+        L::store(lanes, t);
+        for(uint lane = 0; lane < L::WIDTH; lane++){
+            if((hits >> lane & 1u) && lanes[lane] <= tMax){
+                tMax = lanes[lane];
+                closest = (int)(i + lane);
+            }
+        }
+    }
+    for(; i < quads.count; i++){
+        float t;
+        if(quadLanes<ScalarLanes>(QuadLanes<ScalarLanes>::load(quads, i), scalarRay, tMin, tMax, t)){
+            tMax = t;
+            closest = (int)i;
+        }
+    }
+    return closest;
+}
+
+template<class L>
+bool anyQuad(const QuadArrays& quads, const RayData& ray, float tMin, float tMax){
+    const RayLanes<L> rays(ray);
+    const RayLanes<ScalarLanes> scalarRay(ray);
+    uint i = 0;
+    for(; i + L::WIDTH <= quads.count; i += L::WIDTH){
+        typename L::Float t;
+        if(L::bits(quadLanes<L>(QuadLanes<L>::load(quads, i), rays, L::set(tMin), L::set(tMax), t)) != 0) return true;
+    }
+    for(; i < quads.count; i++){
+        float t;
+        if(quadLanes<ScalarLanes>(QuadLanes<ScalarLanes>::load(quads, i), scalarRay, tMin, tMax, t)) return true;
+    }
+    return false;
+}
+
+//Packet kernels : one ray of the packet per lane, starting at the group of lanes holding ray first
+//The lanes past the end of the packet are padded (see RayPacket::pad) so that whole groups can be loaded
+
+template<class L>
+uint packetBox(const RayPacket& packet, uint first, const float* boxMin, const float* boxMax, float tMin){
+    typedef typename L::Float F;
+    const F minX = L::set(boxMin[0]), minY = L::set(boxMin[1]), minZ = L::set(boxMin[2]);
+    const F maxX = L::set(boxMax[0]), maxY = L::set(boxMax[1]), maxZ = L::set(boxMax[2]);
+    for(uint i = first - first % L::WIDTH; i < packet.size; i += L::WIDTH){
+        const F ox = L::load(packet.ox + i), oy = L::load(packet.oy + i), oz = L::load(packet.oz + i);
+        const F invX = L::load(packet.invX + i), invY = L::load(packet.invY + i), invZ = L::load(packet.invZ + i);
+        //Slab test, same as AABB::intersect
+        const F x0 = (minX - ox) * invX, x1 = (maxX - ox) * invX;
+        const F y0 = (minY - oy) * invY, y1 = (maxY - oy) * invY;
+        const F z0 = (minZ - oz) * invZ, z1 = (maxZ - oz) * invZ;
+        const F entry = L::max(L::max(L::min(x0, x1), L::min(y0, y1)), L::max(L::min(z0, z1), L::set(tMin)));
+        const F exit = L::min(L::min(L::max(x0, x1), L::max(y0, y1)), L::min(L::max(z0, z1), L::load(packet.tMax + i)));
+        //Rays before first already missed an ancestor of the box
+        const uint hits = L::bits(L::lessEqual(entry, exit)) >> (i < first ? first - i : 0) << (i < first ? first - i : 0);
+        if(hits != 0) return i + lowestBit(hits);
+    }
+    return packet.size;
+}
+
+template<class L>
+void packetSphere(RayPacket& packet, uint first, const SphereArrays& spheres, uint sphere, int primitiveId, float tMin){
+    const SphereLanes<L> broadcastSphere = SphereLanes<L>::broadcast(spheres, sphere);
+    float lanes[L::WIDTH];
+    for(uint i = first - first % L::WIDTH; i < packet.size; i += L::WIDTH){
+        typename L::Float t;
+        const uint hits = L::bits(sphereLanes<L>(broadcastSphere, RayLanes<L>(packet, i), L::set(tMin), L::load(packet.tMax + i), t));
+        if(hits == 0) continue;
+        L::store(lanes, t);
+        for(uint lane = 0; lane < L::WIDTH; lane++){
+            if(hits >> lane & 1u){
+                packet.tMax[i + lane] = lanes[lane];
+                packet.primitiveId[i + lane] = primitiveId;
+            }
+        }
+    }
+}
+
+template<class L>
+void packetQuad(RayPacket& packet, uint first, const QuadArrays& quads, uint quad, int primitiveId, float tMin){
+    const QuadLanes<L> broadcastQuad = QuadLanes<L>::broadcast(quads, quad);
+    float lanes[L::WIDTH];
+    for(uint i = first - first % L::WIDTH; i < packet.size; i += L::WIDTH){
+        typename L::Float t;
+        const uint hits = L::bits(quadLanes<L>(broadcastQuad, RayLanes<L>(packet, i), L::set(tMin), L::load(packet.tMax + i), t));
+        if(hits == 0) continue;
+        L::store(lanes, t);
+        for(uint lane = 0; lane < L::WIDTH; lane++){
+            if(hits >> lane & 1u){
+                packet.tMax[i + lane] = lanes[lane];
+                packet.primitiveId[i + lane] = primitiveId;
+            }
+        }
+    }
+}
+
+template<class L>
+void packetTriangle(RayPacket& packet, uint first, const TriangleArrays& triangles, uint triangle, int primitiveId, float tMin){
+    const TriangleLanes<L> broadcastTriangle = TriangleLanes<L>::broadcast(triangles, triangle);
+    float lanes[L::WIDTH];
+    for(uint i = first - first % L::WIDTH; i < packet.size; i += L::WIDTH){
+        typename L::Float t;
+        const uint hits = L::bits(triangleLanes<L>(broadcastTriangle, RayLanes<L>(packet, i), L::set(tMin), L::load(packet.tMax + i), t));
+        if(hits == 0) continue;
+        L::store(lanes, t);
+        for(uint lane = 0; lane < L::WIDTH; lane++){
+            if(hits >> lane & 1u){
+                packet.tMax[i + lane] = lanes[lane];
+                packet.primitiveId[i + lane] = primitiveId;
+            }
+        }
+    }
+}
+
+
+//One ray against the W child boxes of a wide node, L::WIDTH boxes per instruction, W must be a multiple of L::WIDTH
+//plane(p, i) gives the lanes of plane p (min x, min y, min z, max x, max y, max z) of the boxes from i
+//Slab test with the same arithmetic as packetBox
+template<class L, uint W, class Planes>
+uint boxLanes(Planes plane, const float* origin, const float* inverseDirection, float tMin, float tMax, float* entries){
+    typedef typename L::Float F;
+    const F ox = L::set(origin[0]), oy = L::set(origin[1]), oz = L::set(origin[2]);
+    const F invX = L::set(inverseDirection[0]), invY = L::set(inverseDirection[1]), invZ = L::set(inverseDirection[2]);
+    const F rayTMin = L::set(tMin), rayTMax = L::set(tMax);
+    uint hits = 0;
+    for(uint i = 0; i < W; i += L::WIDTH){
+        const F x0 = (plane(0, i) - ox) * invX, x1 = (plane(3, i) - ox) * invX;
+        const F y0 = (plane(1, i) - oy) * invY, y1 = (plane(4, i) - oy) * invY;
+        const F z0 = (plane(2, i) - oz) * invZ, z1 = (plane(5, i) - oz) * invZ;
+        const F entry = L::max(L::max(L::min(x0, x1), L::min(y0, y1)), L::max(L::min(z0, z1), rayTMin));
+        const F exit = L::min(L::min(L::max(x0, x1), L::max(y0, y1)), L::min(L::max(z0, z1), rayTMax));
+        L::store(entries + i, entry);
+        hits |= L::bits(L::lessEqual(entry, exit)) << i;
+    }
+    return hits;
+}
+
+template<class L, uint W>
+uint wideBox(const float* bounds, const float* origin, const float* inverseDirection, float tMin, float tMax, float* entries){
+    return boxLanes<L, W>([bounds](uint p, uint i){return L::load(bounds + p * W + i);}, origin, inverseDirection, tMin, tMax, entries);
+}
+
+//Same as wideBox on quantized planes, decoded as origin + q * scale like BVH::childBounds
+//The scales are powers of two, so q * scale is exact and the decoded planes do not depend on the instruction set
+template<class L, uint W, typename Q>
+uint quantizedBox(const Q* bounds, const float* frame, const float* origin, const float* inverseDirection, float tMin, float tMax, float* entries){
+    typedef typename L::Float F;
+    const F frameOrigin[3] = {L::set(frame[0]), L::set(frame[1]), L::set(frame[2])};
+    const F frameScale[3] = {L::set(frame[3]), L::set(frame[4]), L::set(frame[5])};
+    return boxLanes<L, W>([&](uint p, uint i){return frameOrigin[p % 3] + L::convert(bounds + p * W + i) * frameScale[p % 3];},
+                          origin, inverseDirection, tMin, tMax, entries);
+}
+
+template<class L, typename Q>
+void decodeBounds(const Q* bounds, const float* frame, uint width, float* decoded){
+    for(uint p = 0; p < 6; p++){
+        const typename L::Float origin = L::set(frame[p % 3]), scale = L::set(frame[3 + p % 3]);
+        for(uint i = 0; i < width; i += L::WIDTH) L::store(decoded + p * width + i, origin + L::convert(bounds + p * width + i) * scale);
+    }
+}
+
+}
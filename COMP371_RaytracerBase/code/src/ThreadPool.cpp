@@ -0,0 +1,114 @@
+#include "ThreadPool.h"
+
+namespace {
+    //Pool and worker index of the calling thread
+    thread_local const ThreadPool* localPool = nullptr;
+    thread_local int localWorker = -1;
+}
+
+ThreadPool::ThreadPool(uint threadCount) {
+    if(threadCount == 0) threadCount = std::thread::hardware_concurrency();
+    if(threadCount == 0) threadCount = 1;
+    for(uint i = 0; i < threadCount; i++) queues.emplace_back(new WorkQueue());
+    for(uint i = 0; i < threadCount; i++) workers.emplace_back(&ThreadPool::workerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    wakeWorkers.notify_all();
+    for(auto& worker : workers) worker.join();
+}
+
+int ThreadPool::currentWorker() const {
+    return localPool == this ? localWorker : -1;
+}
+
+void ThreadPool::submit(TaskGroup &group, Task task) {
+    group.pending.fetch_add(1, std::memory_order_relaxed);
+    int worker = currentWorker();
+    uint index = worker >= 0 ? (uint)worker : nextQueue.fetch_add(1, std::memory_order_relaxed) % queues.size();
+    {
+        std::lock_guard<std::mutex> lock(queues[index]->mutex);
+        queues[index]->tasks.push_back(QueuedTask{std::move(task), &group});
+    }
+    {
+        //Taking the lock so that a worker going to sleep cannot miss the notification
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        queuedTasks.fetch_add(1, std::memory_order_release);
+    }
+    wakeWorkers.notify_one();
+}
+
+bool ThreadPool::popTask(uint index, QueuedTask &task) {
+    //Own deque first, newest task first
+    {
+        std::lock_guard<std::mutex> lock(queues[index]->mutex);
+        if(!queues[index]->tasks.empty()){
+            task = std::move(queues[index]->tasks.back());
+            queues[index]->tasks.pop_back();
+            queuedTasks.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    //Stealing the oldest task of the other workers
+    for(uint i = 1; i < queues.size(); i++){
+        auto& victim = *queues[(index + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if(!victim.tasks.empty()){
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            queuedTasks.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::execute(uint index, QueuedTask &task) {
+    task.function(index);
+    if(task.group->pending.fetch_sub(1, std::memory_order_acq_rel) == 1){
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        groupFinished.notify_all();
+    }
+}
+
+void ThreadPool::workerLoop(uint index) {
+    localPool = this;
+    localWorker = (int)index;
+    QueuedTask task;
+    while(true){
+        if(popTask(index, task)){
+            execute(index, task);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wakeWorkers.wait(lock, [this]{return stopping || queuedTasks.load(std::memory_order_acquire) > 0;});
+        if(stopping) return;
+    }
+}
+
+void ThreadPool::wait(TaskGroup &group) {
+    int worker = currentWorker();
+    if(worker >= 0){
+        //Helping with the queued work instead of blocking the worker
+        QueuedTask task;
+        while(!group.isDone()){
+            if(popTask((uint)worker, task)) execute((uint)worker, task);
+            else std::this_thread::yield();
+        }
+        return;
+    }
+    std::unique_lock<std::mutex> lock(sleepMutex);
+    groupFinished.wait(lock, [&group]{return group.isDone();});
+}
+
+void ThreadPool::parallelFor(uint taskCount, const std::function<void(uint, uint)> &task) {
+    TaskGroup group;
+    for(uint i = 0; i < taskCount; i++){
+        submit(group, [&task, i](uint worker){task(i, worker);});
+    }
+    wait(group);
+}
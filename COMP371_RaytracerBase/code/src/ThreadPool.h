@@ -0,0 +1,65 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//Counts the tasks of one batch that have not finished yet
+class TaskGroup{
+private:
+    std::atomic<uint> pending{0};
+    friend class ThreadPool;
+public:
+    bool isDone() const{return pending.load(std::memory_order_acquire) == 0;}
+};
+
+//Pool of worker threads with work stealing
+//Every worker owns a deque of tasks : it takes its own work from the back and,
+//once its deque is empty, steals from the front of the other workers' deques
+class ThreadPool{
+public:
+    //Task receives the index of the worker running it (between 0 and getThreadCount() - 1)
+    using Task = std::function<void(uint)>;
+    //threadCount of 0 --> one worker per hardware thread
+    explicit ThreadPool(uint threadCount = 0);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator = (const ThreadPool&) = delete;
+    uint getThreadCount() const{return (uint)workers.size();}
+    //Queues a task in the given group. Tasks submitted from a worker go to that worker's own deque,
+    //tasks submitted from outside the pool are spread over the workers
+    void submit(TaskGroup& group, Task task);
+    //Blocks until every task of the group finished. When called from a worker, that worker keeps
+    //executing tasks while waiting so that tasks can safely spawn and wait for other tasks
+    void wait(TaskGroup& group);
+    //Runs task(index, worker) for every index in [0, taskCount) and waits for all of them
+    void parallelFor(uint taskCount, const std::function<void(uint, uint)>& task);
+private:
+    struct QueuedTask{
+        Task function;
+        TaskGroup* group;
+    };
+    struct WorkQueue{
+        std::mutex mutex;
+        std::deque<QueuedTask> tasks;
+    };
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+    //Number of tasks sitting in the deques, used to put idle workers to sleep
+    std::atomic<uint> queuedTasks{0};
+    //Round robin position for tasks submitted from outside the pool
+    std::atomic<uint> nextQueue{0};
+    std::atomic<bool> stopping{false};
+    std::mutex sleepMutex;
+    std::condition_variable wakeWorkers;
+    std::condition_variable groupFinished;
+    void workerLoop(uint index);
+    bool popTask(uint index, QueuedTask& task);
+    void execute(uint index, QueuedTask& task);
+    //Index of the worker owned by the calling thread, -1 if the caller is not a worker of this pool
+    int currentWorker() const;
+};
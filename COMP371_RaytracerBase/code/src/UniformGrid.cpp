@@ -0,0 +1,225 @@
+#include "UniformGrid.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+
+namespace {
+
+//Fraction of a cell added around the boxes of the primitives, so that a hit on the border of a cell is in the cells on both sides
+const float CELL_MARGIN = 1e-3f;
+
+//No primitive in an entry of the mailbox
+const uint NO_PRIMITIVE = ~0u;
+
+//Cell of a coordinate given in cells from the lower corner of the grid, clamped to the grid
+inline uint clampCell(float cell, uint resolution){
+    if(!(cell > 0)) return 0;
+    return cell >= (float)(resolution - 1) ? resolution - 1 : (uint)cell;
+}
+
+}
+
+UniformGrid::UniformGrid(const CompiledScene &scene, ThreadPool &pool, float density) : scene(scene), pool(pool), density(density) {
+    build();
+}
+
+void UniformGrid::build() {
+    auto start = std::chrono::steady_clock::now();
+    const uint primitiveCount = scene.getPrimitiveCount();
+    std::vector<AABB> boxes(primitiveCount);
+    pool.parallelFor((primitiveCount + BOUNDS_CHUNK_SIZE - 1) / BOUNDS_CHUNK_SIZE, [&](uint chunk, uint){
+        const uint end = std::min(primitiveCount, (chunk + 1) * BOUNDS_CHUNK_SIZE);
+        for(uint i = chunk * BOUNDS_CHUNK_SIZE; i < end; i++){
+            boxes[i] = scene.getBounds(i);
+            boxes[i].pad();
+        }
+    });
+    bounds = AABB();
+    for(const AABB& box : boxes) bounds.expand(box);
+    if(bounds.isEmpty()){
+        resolution[0] = resolution[1] = resolution[2] = 1;
+        cellOffsets.assign(2, 0);
+        references.clear();
+        emptyCells = 1;
+        buildTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return;
+    }
+    setResolution(primitiveCount);
+    for(int a = 0; a < 3; a++){
+        cellSize[a] = (bounds.max[a] - bounds.min[a]) / resolution[a];
+        inverseCellSize[a] = resolution[a] / (bounds.max[a] - bounds.min[a]);
+    }
+    //Counting the references of every cell, then turning the counts into the end of the range of every cell
+    const uint cellCount = getCellCount();
+    cellOffsets.assign(cellCount + 1, 0);
+    uint first[3], last[3];
+    for(const AABB& box : boxes){
+        getCellRange(box, first, last);
+        for(uint z = first[2]; z <= last[2]; z++){
+            for(uint y = first[1]; y <= last[1]; y++){
+                for(uint x = first[0]; x <= last[0]; x++) cellOffsets[x + resolution[0] * (y + resolution[1] * z)]++;
+            }
+        }
+    }
+    emptyCells = (uint)std::count(cellOffsets.begin(), cellOffsets.end() - 1, 0u);
+    for(uint c = 0; c < cellCount; c++) cellOffsets[c + 1] += cellOffsets[c];
+    //Filling the ranges from their end, the primitives taken last to first so that every cell lists them in increasing order
+    //Once filled the offset of a cell is the start of its range
+    references.resize(cellOffsets[cellCount]);
+    for(uint i = primitiveCount; i-- > 0;){
+        getCellRange(boxes[i], first, last);
+        for(uint z = first[2]; z <= last[2]; z++){
+            for(uint y = first[1]; y <= last[1]; y++){
+                for(uint x = first[0]; x <= last[0]; x++) references[--cellOffsets[x + resolution[0] * (y + resolution[1] * z)]] = i;
+            }
+        }
+    }
+    buildTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void UniformGrid::setResolution(uint primitiveCount) {
+    const Eigen::Vector3f extent = bounds.getExtent();
+    const float cells = density * (float)primitiveCount;
+    bool flat[3] = {false, false, false};
+    float cellsPerUnit = 0;
+    for(int pass = 0; pass < 3; pass++){
+        float volume = 1;
+        int axes = 0;
+        for(int a = 0; a < 3; a++){
+            if(flat[a]) continue;
+            volume *= extent[a];
+            axes++;
+        }
+        if(axes == 0) break;
+        cellsPerUnit = std::pow(cells / volume, 1.0f / (float)axes);
+        bool changed = false;
+        for(int a = 0; a < 3; a++){
+            if(flat[a] || extent[a] * cellsPerUnit >= 1) continue;
+            flat[a] = true;
+            changed = true;
+        }
+        if(!changed) break;
+    }
+    for(int a = 0; a < 3; a++){
+        const float axisCells = flat[a] ? 1 : std::round(extent[a] * cellsPerUnit);
+        resolution[a] = axisCells < 1 ? 1 : (axisCells > (float)MAX_RESOLUTION ? MAX_RESOLUTION : (uint)axisCells);
+    }
+    while((size_t)resolution[0] * resolution[1] * resolution[2] > MAX_CELLS){
+        for(int a = 0; a < 3; a++) resolution[a] = std::max(1u, resolution[a] * 3 / 4);
+    }
+}
+
+void UniformGrid::getCellRange(const AABB &box, uint *first, uint *last) const {
+    //An empty box (instance of an empty object) gives first past last on every axis and no cell
+    for(int a = 0; a < 3; a++){
+        first[a] = clampCell((box.min[a] - bounds.min[a]) * inverseCellSize[a] - CELL_MARGIN, resolution[a]);
+        last[a] = clampCell((box.max[a] - bounds.min[a]) * inverseCellSize[a] + CELL_MARGIN, resolution[a]);
+    }
+}
+
+template<typename F>
+void UniformGrid::traverse(const Ray &ray, float tMin, float tMax, F visitCell) const {
+    const Eigen::Vector3f& origin = ray.getOrigin();
+    const Eigen::Vector3f& direction = ray.getDirection();
+    const Eigen::Vector3f inverseDirection = direction.cwiseInverse();
+    float tEntry;
+    if(references.empty() || !bounds.intersect(origin, inverseDirection, tMin, tMax, tEntry)) return;
+    //Cell of the point where the ray enters the grid, then distance to the next plane between cells and between two planes
+    int cell[3], step[3], end[3];
+    float tNext[3], tDelta[3];
+    for(int a = 0; a < 3; a++){
+        cell[a] = (int)clampCell((origin[a] + tEntry * direction[a] - bounds.min[a]) * inverseCellSize[a], resolution[a]);
+        if(direction[a] > 0){
+            step[a] = 1;
+            end[a] = (int)resolution[a];
+            tNext[a] = (bounds.min[a] + (float)(cell[a] + 1) * cellSize[a] - origin[a]) * inverseDirection[a];
+            tDelta[a] = cellSize[a] * inverseDirection[a];
+        }
+        else if(direction[a] < 0){
+            step[a] = -1;
+            end[a] = -1;
+            tNext[a] = (bounds.min[a] + (float)cell[a] * cellSize[a] - origin[a]) * inverseDirection[a];
+            tDelta[a] = -cellSize[a] * inverseDirection[a];
+        }
+        else{
+            //The ray never leaves the slab of the cell on this axis
+            step[a] = 0;
+            end[a] = -1;
+            tNext[a] = tDelta[a] = std::numeric_limits<float>::infinity();
+        }
+    }
+    while(true){
+        //The ray leaves the cell through the nearest plane
+        const int axis = tNext[0] < tNext[1] ? (tNext[0] < tNext[2] ? 0 : 2) : (tNext[1] < tNext[2] ? 1 : 2);
+        const float tExit = tNext[axis];
+        const uint c = (uint)cell[0] + resolution[0] * ((uint)cell[1] + resolution[1] * (uint)cell[2]);
+        if(visitCell(cellOffsets[c], cellOffsets[c + 1], tExit)) return;
+        if(tExit >= tMax) return;
+        cell[axis] += step[axis];
+        if(cell[axis] == end[axis]) return;
+        tNext[axis] += tDelta[axis];
+    }
+}
+
+bool UniformGrid::intersect(const Ray &ray, float tMin, float tMax, HitRecord &hit) const {
+    bool intersected = false;
+    //A primitive overlapping several cells is tested once per ray
+    uint mailbox[MAILBOX_SIZE];
+    std::fill(mailbox, mailbox + MAILBOX_SIZE, NO_PRIMITIVE);
+    traverse(ray, tMin, tMax, [&](uint first, uint last, float tExit){
+        for(uint i = first; i < last; i++){
+            const uint primitive = references[i];
+            uint& tested = mailbox[primitive & (MAILBOX_SIZE - 1)];
+            if(tested == primitive) continue;
+            tested = primitive;
+            //tMax shrinks to the closest hit so far
+            if(scene.intersect(primitive, ray, tMin, tMax, hit)){
+                intersected = true;
+                tMax = hit.t;
+                hit.primitiveId = (int)primitive;
+            }
+        }
+        //A hit before the ray leaves the cell is closer than anything in the next cells
+        return tMax <= tExit;
+    });
+    return intersected;
+}
+
+bool UniformGrid::occluded(const Ray &ray, float tMin, float tMax) const {
+    bool occluder = false;
+    uint mailbox[MAILBOX_SIZE];
+    std::fill(mailbox, mailbox + MAILBOX_SIZE, NO_PRIMITIVE);
+    traverse(ray, tMin, tMax, [&](uint first, uint last, float){
+        for(uint i = first; i < last; i++){
+            const uint primitive = references[i];
+            uint& tested = mailbox[primitive & (MAILBOX_SIZE - 1)];
+            if(tested == primitive) continue;
+            tested = primitive;
+            //Any hit ends the query, no hit record is filled
+            if(scene.occludes(primitive, ray, tMin, tMax)){
+                occluder = true;
+                return true;
+            }
+        }
+        return false;
+    });
+    return occluder;
+}
+
+void UniformGrid::intersect(RayPacket &packet, float tMin) const {
+    for(uint i = 0; i < packet.size; i++){
+        const Ray ray(Eigen::Vector3f(packet.ox[i], packet.oy[i], packet.oz[i]), Eigen::Vector3f(packet.dx[i], packet.dy[i], packet.dz[i]));
+        HitRecord hit;
+        if(!intersect(ray, tMin, packet.tMax[i], hit)) continue;
+        packet.tMax[i] = hit.t;
+        packet.primitiveId[i] = hit.primitiveId;
+    }
+}
+
+void UniformGrid::occluded(RayPacket &packet, float tMin) const {
+    for(uint i = 0; i < packet.size; i++){
+        const Ray ray(Eigen::Vector3f(packet.ox[i], packet.oy[i], packet.oz[i]), Eigen::Vector3f(packet.dx[i], packet.dy[i], packet.dz[i]));
+        if(occluded(ray, tMin, packet.tMax[i])) packet.primitiveId[i] = 0;
+    }
+}
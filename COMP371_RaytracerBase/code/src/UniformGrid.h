@@ -0,0 +1,62 @@
+#pragma once
+#include <vector>
+#include "AABB.h"
+#include "AccelerationStructure.h"
+#include "CompiledScene.h"
+#include "ThreadPool.h"
+
+//Uniform grid over the primitives of the compiled scene, traversed cell by cell with a 3D-DDA (Amanatides and Woo)
+//Used when the output has speedup set to 2
+//The build is a single pass over the bounds of the primitives, much cheaper than a BVH, and the traversal visits the cells
+//in the order of the ray, which suits scenes of many small primitives spread evenly like particles
+//A primitive is referenced by every cell its box overlaps, the cells are stored as ranges of one reference array
+class UniformGrid final : public AccelerationStructure{
+public:
+    //Cells along one axis at most
+    static const uint MAX_RESOLUTION = 1024;
+    //Cells of the grid at most, the resolution is lowered past it
+    static const uint MAX_CELLS = 1u << 25;
+    //Entries of the table of the primitives already tested by a ray (mailboxing), a power of two
+    static const uint MAILBOX_SIZE = 64;
+    //Primitives whose bounds are computed by one task of the thread pool
+    static const uint BOUNDS_CHUNK_SIZE = 4096;
+    //density --> cells per primitive, the resolution is the cube root of density * primitives / volume per unit of length
+    UniformGrid(const CompiledScene& scene, ThreadPool& pool, float density);
+    //Rebuilds the cells from the current bounds of the primitives (animated instances)
+    //Must not run while rays traverse the grid
+    void build();
+    bool intersect(const Ray& ray, float tMin, float tMax, HitRecord& hit) const override;
+    //The rays of the packet are traced one by one, the cells differ from one ray to the next
+    void intersect(RayPacket& packet, float tMin) const override;
+    bool occluded(const Ray& ray, float tMin, float tMax) const override;
+    void occluded(RayPacket& packet, float tMin) const override;
+    const uint* getResolution() const{return resolution;}
+    uint getCellCount() const{return resolution[0] * resolution[1] * resolution[2];}
+    uint getEmptyCellCount() const{return emptyCells;}
+    uint getReferenceCount() const{return (uint)references.size();}
+    size_t getBytes() const{return (cellOffsets.size() + references.size()) * sizeof(uint);}
+    float getDensity() const{return density;}
+    //Wall clock time of the last build in seconds
+    double getBuildTime() const{return buildTime;}
+private:
+    const CompiledScene& scene;
+    ThreadPool& pool;
+    float density;
+    AABB bounds;
+    uint resolution[3] = {1, 1, 1};
+    Eigen::Vector3f cellSize{1, 1, 1}, inverseCellSize{1, 1, 1};
+    //References of cell c --> references[cellOffsets[c]] to references[cellOffsets[c + 1]] (excluded)
+    //Cells are numbered x first, then y, then z
+    std::vector<uint> cellOffsets;
+    std::vector<uint> references;
+    uint emptyCells = 0;
+    double buildTime = 0;
+    //Cells per axis for the density, an axis too flat for one cell gets one and its share goes to the others
+    void setResolution(uint primitiveCount);
+    //Range of the cells overlapped by a box on every axis, widened by a fraction of a cell against rounding
+    void getCellRange(const AABB& box, uint* first, uint* last) const;
+    //Visits the cells pierced by the ray in [tMin, tMax] in order, visitCell(first, last, tExit) receives the range of
+    //the references of a cell and the distance at which the ray leaves it, and returns true to end the traversal
+    template<typename F>
+    void traverse(const Ray& ray, float tMin, float tMax, F visitCell) const;
+};
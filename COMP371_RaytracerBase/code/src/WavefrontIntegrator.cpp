@@ -0,0 +1,229 @@
+#include "WavefrontIntegrator.h"
+#include <algorithm>
+#include <limits>
+
+WavefrontIntegrator::WavefrontIntegrator(RayTracer &rayTracer, Output *output, const AccelerationStructure *structure, const Camera &camera,
+                                         const AABB &sceneBounds) :
+        rayTracer(rayTracer), output(output), structure(structure), camera(camera), sceneBounds(sceneBounds) {}
+
+void WavefrontIntegrator::renderTile(const RayTracer::SamplePattern &pattern, uint startW, uint startH, uint endW, uint endH,
+                                     uint sampleCount, SampleAccumulator &accumulator) {
+    const uint pixelCount = (endW - startW) * (endH - startH);
+    const uint samplesPerWave = std::max(1u, MAX_WAVE_SIZE / pixelCount);
+    for(uint firstSample = 0; firstSample < sampleCount; firstSample += samplesPerWave){
+        const uint endSample = std::min(firstSample + samplesPerWave, sampleCount);
+        generate(pattern, startW, startH, endW, endH, firstSample, endSample);
+        colors.assign(paths.size(), Color());
+        //One bounce of every path per iteration, the finished paths leave the queue
+        while(!paths.empty()){
+            intersect();
+            shade();
+            traceShadowRays();
+            nextPaths.clear();
+            for(PathState& path : paths){
+                if(path.alive) nextPaths.push_back(path);
+                else colors[path.slot] = Color(path.radiance);
+            }
+            paths.swap(nextPaths);
+        }
+        uint slot = 0;
+        for(uint sample = firstSample; sample < endSample; sample++){
+            for(uint h = startH; h < endH; h++){
+                for(uint w = startW; w < endW; w++) accumulator.add(w, h, colors[slot++]);
+            }
+        }
+    }
+}
+
+void WavefrontIntegrator::generate(const RayTracer::SamplePattern &pattern, uint startW, uint startH, uint endW, uint endH,
+                                   uint firstSample, uint endSample) {
+    paths.clear();
+    for(uint sample = firstSample; sample < endSample; sample++){
+        for(uint h = startH; h < endH; h++){
+            for(uint w = startW; w < endW; w++){
+                PathState path;
+                path.sampler = Sampler(output->getSampler(), output->getSeed());
+                path.sampler.startSample(w, h, sample);
+                float dx, dy;
+                RayTracer::getSampleOffset(pattern, sample, path.sampler, dx, dy);
+                Ray ray = camera.generateRay(w, h, dx, dy);
+                path.origin = ray.getOrigin();
+                path.direction = ray.getDirection();
+                path.throughput = Eigen::Vector3f(1, 1, 1);
+                path.radiance = Eigen::Vector3f(0, 0, 0);
+                path.w = w;
+                path.h = h;
+                path.slot = (uint)paths.size();
+                path.bounce = 0;
+                path.alive = true;
+                paths.push_back(path);
+            }
+        }
+    }
+}
+
+void WavefrontIntegrator::intersect() {
+    //Rays leaving the same region in the same octant traverse the same nodes, so they are traced next to each other
+    keys.resize(paths.size());
+    for(uint i = 0; i < paths.size(); i++) keys[i] = {getRayKey(paths[i].origin, paths[i].direction), i};
+    sortKeys();
+    const CompiledScene& scene = *rayTracer.compiledScene;
+    if(structure == nullptr){
+        for(auto& key : keys){
+            PathState& path = paths[key.second];
+            Ray ray(path.origin, path.direction);
+            path.hit = HitRecord();
+            rayTracer.closestHit(nullptr, ray, 0, std::numeric_limits<float>::infinity(), path.hit);
+        }
+    }
+    else{
+        RayPacket packet;
+        for(uint first = 0; first < paths.size(); first += RayPacket::MAX_SIZE){
+            packet.size = std::min((uint)paths.size(), first + RayPacket::MAX_SIZE) - first;
+            for(uint i = 0; i < packet.size; i++){
+                const PathState& path = paths[keys[first + i].second];
+                packet.setRay(i, path.origin.data(), path.direction.data(), std::numeric_limits<float>::infinity());
+            }
+            structure->intersect(packet, 0);
+            for(uint i = 0; i < packet.size; i++){
+                PathState& path = paths[keys[first + i].second];
+                Ray ray(path.origin, path.direction);
+                path.hit = HitRecord();
+                //The packet only keeps the closest primitive and its distance, the scalar test fills the hit record
+                scene.fillPacketHit(packet.primitiveId[i], ray, 0, packet.tMax[i], path.hit);
+            }
+        }
+    }
+    for(PathState& path : paths){
+        if(path.hit.primitiveId >= 0) continue;
+        //Primary rays that miss see the background, the light of the lights is already counted by the next event estimation
+        if(path.bounce == 0) path.radiance = output->getBKC();
+        path.alive = false;
+    }
+}
+
+void WavefrontIntegrator::shade() {
+    const CompiledScene& scene = *rayTracer.compiledScene;
+    //Paths hitting the same material run the same shading code on the same data, the finished paths go last
+    keys.resize(paths.size());
+    for(uint i = 0; i < paths.size(); i++){
+        keys[i] = {paths[i].alive ? scene.getMaterialIndex((uint)paths[i].hit.primitiveId) : std::numeric_limits<uint>::max(), i};
+    }
+    sortKeys();
+    lightGroups.clear();
+    shadowRays.clear();
+    const float probTerminate = output->getProbTerminate();
+    for(auto& key : keys){
+        const uint i = key.second;
+        PathState& path = paths[i];
+        if(!path.alive) break;
+        Ray ray(path.origin, path.direction);
+        const Eigen::Vector3f intersectionPoint = ray.at(path.hit.t);
+        const Material& material = scene.getMaterial((uint)path.hit.primitiveId);
+        Eigen::Vector3f normal = (path.direction.dot(path.hit.normal) < 0) ? path.hit.normal : -path.hit.normal;
+        const float offsetLength = RayTracer::getShadowOffset(intersectionPoint);
+        //Next event estimation : one group of shadow rays per light, drawn like RayTracer::shadeLight does
+        rayTracer.forEachLight(output, intersectionPoint, normal, path.sampler, [&](Light* light, float weight){
+            LightGroup group{i, path.throughput * weight, (uint)shadowRays.size(), 0};
+            Eigen::Vector3f id = light->getId(), is = light->getIs();
+            lightSamples.clear();
+            if(light->getType() == LightType::POINT) lightSamples.push_back(static_cast<Point*>(light)->getCenter());
+            else if(light->getType() == LightType::AREA){
+                auto* areaLight = static_cast<Area*>(light);
+                const uint n = areaLight->getUseCenter() ? 1 : areaLight->getN();
+                id /= (float)(n * n);
+                is /= (float)(n * n);
+                for(uint sample = 0; sample < n * n; sample++){
+                    if(areaLight->getUseCenter()) lightSamples.push_back(areaLight->getCenter());
+                    else{
+                        float u, v;
+                        path.sampler.get2D(u, v);
+                        lightSamples.push_back(areaLight->samplePoint((sample % n + u) / n, (sample / n + v) / n));
+                    }
+                }
+            }
+            for(const Eigen::Vector3f& samplePoint : lightSamples){
+                const Eigen::Vector3f toLight = samplePoint - intersectionPoint;
+                const float lightDistance = toLight.norm();
+                ShadowRay shadowRay;
+                shadowRay.origin = intersectionPoint + (normal.dot(toLight) < 0 ? -normal : normal) * offsetLength;
+                shadowRay.direction = toLight / lightDistance;
+                shadowRay.tMax = lightDistance;
+                shadowRay.light = RayTracer::calculateColorChangeUsingPhong(ray, output, intersectionPoint, samplePoint, id, is, normal, material);
+                shadowRays.push_back(shadowRay);
+            }
+            group.endRay = (uint)shadowRays.size();
+            lightGroups.push_back(group);
+        });
+        if(path.bounce >= output->getMaxBounces() || path.sampler.get1D() < probTerminate){
+            path.alive = false;
+            continue;
+        }
+        path.throughput = path.throughput.cwiseProduct(material.dc) * (material.kd / (1 - probTerminate));
+        if(path.throughput.maxCoeff() <= 0){
+            path.alive = false;
+            continue;
+        }
+        float u1, u2;
+        path.sampler.get2D(u1, u2);
+        path.direction = RayTracer::sampleCosineHemisphere(normal, u1, u2);
+        path.origin = intersectionPoint + normal * offsetLength;
+        path.bounce++;
+    }
+}
+
+void WavefrontIntegrator::traceShadowRays() {
+    //The shadow rays are traced sorted like the paths, the light groups read the results in their own order
+    keys.resize(shadowRays.size());
+    for(uint i = 0; i < shadowRays.size(); i++) keys[i] = {getRayKey(shadowRays[i].origin, shadowRays[i].direction), i};
+    sortKeys();
+    occluded.assign(shadowRays.size(), false);
+    RayPacket packet;
+    for(uint first = 0; first < keys.size(); first += RayPacket::MAX_SIZE){
+        packet.size = std::min((uint)keys.size(), first + RayPacket::MAX_SIZE) - first;
+        for(uint i = 0; i < packet.size; i++){
+            const ShadowRay& shadowRay = shadowRays[keys[first + i].second];
+            packet.setRay(i, shadowRay.origin.data(), shadowRay.direction.data(), shadowRay.tMax);
+        }
+        rayTracer.inShadow(structure, packet, RayTracer::SHADOW_EPSILON);
+        for(uint i = 0; i < packet.size; i++) occluded[keys[first + i].second] = packet.primitiveId[i] >= 0;
+    }
+    for(const LightGroup& group : lightGroups){
+        Eigen::Vector3f light(0, 0, 0);
+        for(uint ray = group.firstRay; ray < group.endRay; ray++){
+            if(!occluded[ray]) light += shadowRays[ray].light;
+        }
+        paths[group.path].radiance += group.throughput.cwiseProduct(light);
+    }
+}
+
+void WavefrontIntegrator::sortKeys() {
+    //Least significant digit radix sort, one pass per byte of the keys
+    sortedKeys.resize(keys.size());
+    for(uint shift = 0; shift < 32; shift += 8){
+        uint offsets[257] = {0};
+        for(const auto& key : keys) offsets[((key.first >> shift) & 255) + 1]++;
+        //Byte shared by all the keys, the pass would not change the order
+        if(std::find(offsets + 1, offsets + 257, (uint)keys.size()) != offsets + 257) continue;
+        for(uint digit = 1; digit < 257; digit++) offsets[digit] += offsets[digit - 1];
+        for(const auto& key : keys) sortedKeys[offsets[(key.first >> shift) & 255]++] = key;
+        keys.swap(sortedKeys);
+    }
+}
+
+uint WavefrontIntegrator::getRayKey(const Eigen::Vector3f &origin, const Eigen::Vector3f &direction) const {
+    const uint octant = (direction.x() < 0 ? 4 : 0) | (direction.y() < 0 ? 2 : 0) | (direction.z() < 0 ? 1 : 0);
+    if(sceneBounds.isEmpty()) return octant << 27;
+    const Eigen::Vector3f extent = sceneBounds.getExtent();
+    uint morton = 0;
+    uint cells[3];
+    for(int axis = 0; axis < 3; axis++){
+        const float position = (origin[axis] - sceneBounds.min[axis]) / extent[axis];
+        cells[axis] = (uint)std::min(std::max(position * 512.0f, 0.0f), 511.0f);
+    }
+    //Interleaving the 9 bits of the cells
+    for(uint bit = 0; bit < 9; bit++){
+        for(int axis = 0; axis < 3; axis++) morton |= ((cells[axis] >> bit) & 1) << (3 * bit + axis);
+    }
+    return octant << 27 | morton;
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include <utility>
+#include <vector>
+#include "Eigen/Core"
+#include "RayTracer.h"
+
+//Path tracer of global illumination working on large queues of paths instead of one path at a time
+//Every bounce of all the paths of a wave goes through the same stages :
+//intersection --> rays sorted by the direction and origin, traced as packets through the BVH
+//shading --> hits sorted by material, next event estimation queues the shadow rays and the paths pick their next direction
+//shadow --> shadow rays sorted like the rays of the paths, traced as packets
+//The stages sort (key, index) pairs and visit the paths through them, the path states themselves do not move
+//It computes the same estimate as RayTracer::tracePath, each path drawing its numbers from its own sampler
+//One integrator per worker, its queues are reused from one tile to the next
+class WavefrontIntegrator{
+public:
+    //Maximum number of paths of a wave, the samples of a tile are split into waves of at most this many paths
+    static const uint MAX_WAVE_SIZE = 16384;
+    //sceneBounds --> padded bounds of the scene, shared by the integrators and updated by the ray tracer between frames
+    WavefrontIntegrator(RayTracer& rayTracer, Output* output, const AccelerationStructure* structure, const Camera& camera,
+                        const AABB& sceneBounds);
+    //Traces the samples [0, sampleCount) of the pixels [startW, endW) x [startH, endH) and adds them to the accumulator
+    //in the order of the samples, like the per pixel path tracer
+    void renderTile(const RayTracer::SamplePattern& pattern, uint startW, uint startH, uint endW, uint endH, uint sampleCount,
+                    SampleAccumulator& accumulator);
+private:
+    //State of a path between two stages
+    struct PathState{
+        //Ray of the current segment of the path
+        Eigen::Vector3f origin, direction;
+        //Product of the reflectances met so far and light gathered by the path
+        Eigen::Vector3f throughput, radiance;
+        Sampler sampler;
+        HitRecord hit;
+        //Pixel of the path and position of its color in the colors of the wave
+        uint w, h, slot;
+        uint bounce;
+        bool alive;
+    };
+    //Shadow rays of the samples of one light seen from one hit, their light is summed then weighted by the throughput of the path
+    struct LightGroup{
+        uint path;
+        Eigen::Vector3f throughput;
+        //Shadow rays [firstRay, endRay)
+        uint firstRay, endRay;
+    };
+    struct ShadowRay{
+        Eigen::Vector3f origin, direction;
+        float tMax;
+        //Blinn-Phong light brought by the sample when it is not occluded
+        Eigen::Vector3f light;
+    };
+    RayTracer& rayTracer;
+    Output* output;
+    const AccelerationStructure* structure;
+    const Camera& camera;
+    //Bounds of the scene, used to quantize the ray origins of the sort keys
+    const AABB& sceneBounds;
+    //Paths of the wave that are still traced, compacted into nextPaths after every bounce
+    std::vector<PathState> paths, nextPaths;
+    std::vector<LightGroup> lightGroups;
+    std::vector<ShadowRay> shadowRays;
+    std::vector<bool> occluded;
+    //Points sampled on the light being shaded
+    std::vector<Eigen::Vector3f> lightSamples;
+    //Sort key and position in the queue, the stages visit the queue in the order of the sorted keys
+    std::vector<std::pair<uint, uint>> keys, sortedKeys;
+    //Color of every path of the wave, in the order of the samples
+    std::vector<Color> colors;
+    void generate(const RayTracer::SamplePattern& pattern, uint startW, uint startH, uint endW, uint endH, uint firstSample, uint endSample);
+    void intersect();
+    void shade();
+    void traceShadowRays();
+    //Sorts the keys with a radix sort
+    void sortKeys();
+    //Octant of the direction in the high bits, Morton code of the origin in the scene bounds in the low bits
+    uint getRayKey(const Eigen::Vector3f& origin, const Eigen::Vector3f& direction) const;
+};